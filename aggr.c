@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "aggr.h"
+
+// The range sums are the difference of two prefix sums, so
+// they take O(1) time. The range min/max queries use a sparse
+// table over blocks of AGGR_BLOCK_SIZE TrkPt's: the blocks
+// fully within the range are covered by two overlapping runs
+// of 2^k blocks, and the TrkPt's in the partial blocks at
+// either end are scanned. So the queries take O(1) time too,
+// while the tables only need O(N/B log N/B) space.
+#define AGGR_BLOCK_SIZE     32
+
+struct TrkAggr {
+    int numPts;
+    const TrkPt **pts;
+    double *sum[numAggrCols];       // sum[c][i]: sum of the values of TrkPt's 0..i
+    double *val[numAggrMetrics];    // val[m][i]: value of TrkPt i
+    int numBlocks;
+    int numLevels;
+    int **maxTbl[numAggrMetrics];   // maxTbl[m][k][j]: pos of the max in blocks j..j+2^k-1
+    int **minTbl[numAggrMetrics];   // minTbl[m][k][j]: pos of the min in blocks j..j+2^k-1
+};
+
+static int log2Int(int n)
+{
+    return (31 - __builtin_clz(n));
+}
+
+// Position of the larger (isMax) or smaller value, preferring
+// the first one on a tie.
+static int pickPos(const double *val, int i, int j, Bool isMax)
+{
+    if (isMax) {
+        return (val[j] > val[i]) ? j : i;
+    } else {
+        return (val[j] < val[i]) ? j : i;
+    }
+}
+
+static int scanPos(const double *val, int a, int b, Bool isMax)
+{
+    int pos = a;
+
+    for (int i = a + 1; i <= b; i++) {
+        pos = pickPos(val, pos, i, isMax);
+    }
+
+    return pos;
+}
+
+static int **buildTbl(const TrkAggr *pAggr, const double *val, Bool isMax)
+{
+    int **tbl;
+
+    if ((tbl = calloc(pAggr->numLevels, sizeof (int *))) == NULL) {
+        return NULL;
+    }
+
+    for (int k = 0; k < pAggr->numLevels; k++) {
+        int len = pAggr->numBlocks - (1 << k) + 1;
+
+        if ((tbl[k] = malloc(len * sizeof (int))) == NULL) {
+            return tbl;
+        }
+        for (int j = 0; j < len; j++) {
+            if (k == 0) {
+                int a = j * AGGR_BLOCK_SIZE;
+                int b = ((a + AGGR_BLOCK_SIZE) < pAggr->numPts) ? (a + AGGR_BLOCK_SIZE - 1) : (pAggr->numPts - 1);
+                tbl[k][j] = scanPos(val, a, b, isMax);
+            } else {
+                tbl[k][j] = pickPos(val, tbl[k - 1][j], tbl[k - 1][j + (1 << (k - 1))], isMax);
+            }
+        }
+    }
+
+    return tbl;
+}
+
+static void freeTbl(const TrkAggr *pAggr, int **tbl)
+{
+    if (tbl != NULL) {
+        for (int k = 0; k < pAggr->numLevels; k++) {
+            free(tbl[k]);
+        }
+        free(tbl);
+    }
+}
+
+static void freeAggr(TrkAggr *pAggr)
+{
+    if (pAggr == NULL)
+        return;
+
+    free(pAggr->pts);
+    for (int c = 0; c < numAggrCols; c++) {
+        free(pAggr->sum[c]);
+    }
+    for (int m = 0; m < numAggrMetrics; m++) {
+        free(pAggr->val[m]);
+        freeTbl(pAggr, pAggr->maxTbl[m]);
+        freeTbl(pAggr, pAggr->minTbl[m]);
+    }
+    free(pAggr);
+}
+
+static Bool aggrIsValid(const TrkAggr *pAggr)
+{
+    if (pAggr->pts == NULL)
+        return false;
+    for (int c = 0; c < numAggrCols; c++) {
+        if (pAggr->sum[c] == NULL)
+            return false;
+    }
+    for (int m = 0; m < numAggrMetrics; m++) {
+        if ((pAggr->val[m] == NULL) || (pAggr->maxTbl[m] == NULL) || (pAggr->minTbl[m] == NULL))
+            return false;
+        for (int k = 0; k < pAggr->numLevels; k++) {
+            if ((pAggr->maxTbl[m][k] == NULL) || (pAggr->minTbl[m][k] == NULL))
+                return false;
+        }
+    }
+    return true;
+}
+
+const TrkAggr *getTrkAggr(GpsTrk *pTrk)
+{
+    TrkAggr *pAggr;
+    const TrkPt *p;
+    int n;
+
+    if (pTrk->aggr != NULL) {
+        return pTrk->aggr;
+    }
+
+    if ((pAggr = calloc(1, sizeof (TrkAggr))) == NULL) {
+        fprintf(stderr, "Failed to alloc TrkAggr object !!!\n");
+        return NULL;
+    }
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        pAggr->numPts++;
+    }
+    if (pAggr->numPts == 0) {
+        free(pAggr);
+        return NULL;
+    }
+    pAggr->numBlocks = (pAggr->numPts + AGGR_BLOCK_SIZE - 1) / AGGR_BLOCK_SIZE;
+    pAggr->numLevels = log2Int(pAggr->numBlocks) + 1;
+
+    pAggr->pts = malloc(pAggr->numPts * sizeof (TrkPt *));
+    for (int c = 0; c < numAggrCols; c++) {
+        pAggr->sum[c] = malloc(pAggr->numPts * sizeof (double));
+    }
+    for (int m = 0; m < numAggrMetrics; m++) {
+        pAggr->val[m] = malloc(pAggr->numPts * sizeof (double));
+    }
+    if (pAggr->pts == NULL) {
+        goto error;
+    }
+    for (int c = 0; c < numAggrCols; c++) {
+        if (pAggr->sum[c] == NULL)
+            goto error;
+    }
+    for (int m = 0; m < numAggrMetrics; m++) {
+        if (pAggr->val[m] == NULL)
+            goto error;
+    }
+
+    // Fill in the columns in a single pass
+    n = 0;
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        double v[numAggrCols] = {0};
+
+        // The first TrkPt is the baseline, and it
+        // doesn't contribute to the sums.
+        if (n != 0) {
+            v[acTime] = p->deltaT;
+            v[acDist] = p->dist;
+            v[acRise] = p->rise;
+            v[acGain] = (p->rise > 0.0) ? p->rise : 0.0;
+            v[acLoss] = (p->rise < 0.0) ? -p->rise : 0.0;
+            v[acGrade] = p->grade;
+            v[acPowerDt] = p->power * p->deltaT;
+            v[acHrDt] = p->heartRate * p->deltaT;
+            v[acCadenceDt] = p->cadence * p->deltaT;
+        }
+        for (int c = 0; c < numAggrCols; c++) {
+            pAggr->sum[c][n] = (n == 0) ? v[c] : (pAggr->sum[c][n - 1] + v[c]);
+        }
+
+        pAggr->val[amElevation][n] = p->elevation;
+        pAggr->val[amGrade][n] = p->grade;
+        pAggr->val[amSpeed][n] = p->speed;
+        pAggr->val[amPower][n] = p->power;
+        pAggr->val[amHeartRate][n] = p->heartRate;
+
+        pAggr->pts[n++] = p;
+    }
+
+    for (int m = 0; m < numAggrMetrics; m++) {
+        pAggr->maxTbl[m] = buildTbl(pAggr, pAggr->val[m], true);
+        pAggr->minTbl[m] = buildTbl(pAggr, pAggr->val[m], false);
+    }
+
+    if (!aggrIsValid(pAggr)) {
+        goto error;
+    }
+
+    pTrk->aggr = pAggr;
+
+    return pAggr;
+
+error:
+    fprintf(stderr, "Failed to alloc TrkAggr columns !!!\n");
+    freeAggr(pAggr);
+    return NULL;
+}
+
+int aggrRange(const TrkAggr *pAggr, const TrkPtRange *pRange, int *pA, int *pB)
+{
+    int lo, hi;
+
+    // The TrkPt indices are in increasing order, but
+    // there may be gaps between them.
+    for (lo = 0, hi = pAggr->numPts; lo < hi; ) {
+        int mid = (lo + hi) / 2;
+        if (pAggr->pts[mid]->index < pRange->from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *pA = lo;
+
+    for (lo = 0, hi = pAggr->numPts; lo < hi; ) {
+        int mid = (lo + hi) / 2;
+        if (pAggr->pts[mid]->index <= pRange->to)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *pB = lo - 1;
+
+    return (*pA <= *pB) ? 0 : -1;
+}
+
+double aggrSum(const TrkAggr *pAggr, AggrCol col, int a, int b)
+{
+    return (pAggr->sum[col][b] - pAggr->sum[col][a]);
+}
+
+static const TrkPt *aggrExt(const TrkAggr *pAggr, AggrMetric metric, int a, int b, double *pValue, Bool isMax)
+{
+    const double *val = pAggr->val[metric];
+    int **tbl = isMax ? pAggr->maxTbl[metric] : pAggr->minTbl[metric];
+    int ba, bb, pos;
+
+    if ((metric != amElevation) && (b > a)) {
+        a++;
+    }
+
+    ba = a / AGGR_BLOCK_SIZE;
+    bb = b / AGGR_BLOCK_SIZE;
+
+    if ((bb - ba) <= 1) {
+        pos = scanPos(val, a, b, isMax);
+    } else {
+        int k = log2Int(bb - ba - 1);
+
+        pos = scanPos(val, a, ((ba + 1) * AGGR_BLOCK_SIZE - 1), isMax);
+        pos = pickPos(val, pos, tbl[k][ba + 1], isMax);
+        pos = pickPos(val, pos, tbl[k][bb - (1 << k)], isMax);
+        pos = pickPos(val, pos, scanPos(val, (bb * AGGR_BLOCK_SIZE), b, isMax), isMax);
+    }
+
+    *pValue = val[pos];
+
+    return pAggr->pts[pos];
+}
+
+const TrkPt *aggrMax(const TrkAggr *pAggr, AggrMetric metric, int a, int b, double *pValue)
+{
+    return aggrExt(pAggr, metric, a, b, pValue, true);
+}
+
+const TrkPt *aggrMin(const TrkAggr *pAggr, AggrMetric metric, int a, int b, double *pValue)
+{
+    return aggrExt(pAggr, metric, a, b, pValue, false);
+}
+
+void freeTrkAggr(GpsTrk *pTrk)
+{
+    freeAggr(pTrk->aggr);
+    pTrk->aggr = NULL;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Prefix-sum columns. The value of each TrkPt is the one
+// of the segment that ends at it.
+typedef enum AggrCol {
+    acTime = 0,         // deltaT (in seconds)
+    acDist = 1,         // dist (in meters)
+    acRise = 2,         // rise (in meters)
+    acGain = 3,         // positive rise (in meters)
+    acLoss = 4,         // negative rise (in meters)
+    acGrade = 5,        // grade (in %)
+    acPowerDt = 6,      // power x deltaT (in joules)
+    acHrDt = 7,         // heart rate x deltaT (in beats x 60)
+    acCadenceDt = 8,    // cadence x deltaT (in revs x 60)
+    numAggrCols = 9
+} AggrCol;
+
+// Metrics that support range min/max queries
+typedef enum AggrMetric {
+    amElevation = 0,
+    amGrade = 1,
+    amSpeed = 2,
+    amPower = 3,
+    amHeartRate = 4,
+    numAggrMetrics = 5
+} AggrMetric;
+
+// Range aggregates of the track. They are built on the first
+// query, and cached in the GpsTrk until the TrkPt's are
+// modified.
+typedef struct TrkAggr TrkAggr;
+
+extern const TrkAggr *getTrkAggr(GpsTrk *pTrk);
+
+// Map the specified TrkPt range to the positions [*pA, *pB]
+// of the TrkPt's within it. Returns -1 if the range is empty.
+extern int aggrRange(const TrkAggr *pAggr, const TrkPtRange *pRange, int *pA, int *pB);
+
+// Sum of the column over the segments within the positions
+// [a, b]; i.e. those that end at a+1..b.
+extern double aggrSum(const TrkAggr *pAggr, AggrCol col, int a, int b);
+
+// TrkPt with the max/min value of the metric within the
+// positions [a, b]. The metrics of the segments are taken
+// from the ones that end at a+1..b, if there are any.
+extern const TrkPt *aggrMax(const TrkAggr *pAggr, AggrMetric metric, int a, int b, double *pValue);
+extern const TrkPt *aggrMin(const TrkAggr *pAggr, AggrMetric metric, int a, int b, double *pValue);
+
+// Discard the cached range aggregates
+extern void freeTrkAggr(GpsTrk *pTrk);
+
+#ifdef __cplusplus
+};
+#endif
@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,9 +8,20 @@
 #include <readline/history.h>
 
 #include "cli.h"
+#include "climbs.h"
 #include "comp.h"
+#include "compact.h"
+#include "compare.h"
+#include "curve.h"
+#include "packed.h"
+#include "dem.h"
+#include "grid.h"
 #include "output.h"
+#include "resample.h"
+#include "simplify.h"
+#include "sync.h"
 #include "trkpt.h"
+#include "zio.h"
 
 // Command status code
 typedef enum CmdStat {
@@ -21,29 +33,79 @@ typedef enum CmdStat {
 static const char *cliHelp = \
     "Supported CLI commands:\n"
     "\n"
+    "climbs                             List the climbs and descents, with their category,\n"
+    "                                   length, gain, and average and max grade.\n"
     "cma <metric> <window> [<range>]    Smooth the specified metric using a CMA filter.\n"
+    "compact [<file> [<format>]]        Report the memory used by the compact and packed\n"
+    "                                   representations of the track, and the precision\n"
+    "                                   lost in them, which fails if any value is off by\n"
+    "                                   more than its column allows; or save the data, as\n"
+    "                                   read back from the packed representation, in the\n"
+    "                                   specified file.\n"
+    "compare <file> [elevation]         Align the track with the one in the specified FIT\n"
+    "                                   or MP4 file, and report the offset between them, the\n"
+    "                                   difference in their elevation, and the sections\n"
+    "                                   where they diverge; optionally copy the elevation\n"
+    "                                   values of the other track.\n"
+    "curve <metric> [<file>]            Print the best average value of the specified metric\n"
+    "                                   for the standard durations, or save it to the file\n"
+    "                                   for every duration from 1 s to the whole ride. The\n"
+    "                                   metric can be: cadence, heartRate, power, speed.\n"
+    "elevation dem <dir> [<range>]      Replace the elevation values with those from the\n"
+    "                                   SRTM (.hgt) DEM tiles in the specified directory.\n"
+    "ema <metric> <window> [<range>]    Smooth the specified metric using an EMA filter.\n"
     "exit                               Exit the tool\n"
+    "hampel <metric> <window> [<range>] Remove the outliers of the specified metric using a\n"
+    "                                   Hampel filter.\n"
     "help                               Print this help\n"
     "history                            Print the command history.\n"
+    "lowpass <metric> <period> [<range>]\n"
+    "                                   Smooth the specified metric using a zero-phase\n"
+    "                                   Butterworth low-pass filter, with a cutoff period\n"
+    "                                   of the specified number of trackpoints.\n"
     "max <metric> <value> [<range>]     Limit the maximum value of the specified metric.\n"
+    "median <metric> <window> [<range>] Smooth the specified metric using a sliding median\n"
+    "                                   filter.\n"
     "min <metric> <value> [<range>]     Limit the minimum value of the specified metric.\n"
-    "save <file> [<format>]             Save the data in the specified format and file.\n"
-    "                                   The output format can be: csv, gpx, shiz, tcx.\n"
+    "near <lat,lon> [<radius>]          Find the trackpoint nearest to the specified position,\n"
+    "                                   or every pass within the specified radius (m).\n"
+    "resample {time|dist} <step>        Resample the trackpoints so that they are uniformly\n"
+    "                                   spaced in time (s) or distance (m).\n"
+    "save <file> [<format> [<compression> [<level>]]]\n"
+    "                                   Save the data in the specified format and file.\n"
+    "                                   The output format can be: csv, fit, gpx, shiz,\n"
+    "                                   tcx.\n"
+    "                                   The data can be compressed using: gzip, zstd.\n"
     "scale <metric> <factor> [<range>]  Scale the specified metric by the specified factor.\n"
     "sgf <metric> <window> [<range>]    Smooth the specified metric using the Savitzky-Golay\n"
     "                                   filter.\n"
     "show [<range>]                     Show trackpoints in plain text form.\n"
+    "simplify <dist> <elev> <grade> [<range>]\n"
+    "                                   Remove the trackpoints that can be dropped without\n"
+    "                                   the track deviating more than the specified distance\n"
+    "                                   (m), elevation (m), and grade (%) from the original.\n"
     "sma <metric> <window> [<range>]    Smooth the specified metric using an SMA filter.\n"
-    "summary [detail]                   Print a summary of the data.\n"
+    "summary [detail | <range>]         Print a summary of the data, or of the trackpoints\n"
+    "                                   within the specified range.\n"
+    "sync <file> [elevation|speed]      Find the time shift that best aligns the speed\n"
+    "                                   (default) or elevation profile of the track with\n"
+    "                                   that of the track in the specified FIT or MP4 file\n"
+    "                                   (e.g. the GoPro video itself), and use it as the\n"
+    "                                   timeshift of the SHIZ output.\n"
     "trim <range>                       Remove the trackpoints within the specified range\n"
     "                                   and close the distance and time gaps between them.\n"
     "undo                               Revert the last operation.\n"
     "\n"
-    "The first and last trackpoints within a range can be specified by either their index or by\n"
-    "their timestamp. Additionally, the keywords \"start\" and \"end\" are used to indicate the\n"
-    "first and last trackpoints in the entire activity, respectively.\n"
+    "The first and last trackpoints within a range can be specified by either their index, their\n"
+    "timestamp, or their position as \"<lat>,<lon>\", in which case the nearest trackpoint is used.\n"
+    "Additionally, the keywords \"start\" and \"end\" are used to indicate the first and last\n"
+    "trackpoints in the entire activity, respectively.\n"
     "\n"
-    "The metric can be: elevation, grade, speed.\n"
+    "The metric can be: elevation, grade, speed. The max command also accepts gradeChange, which\n"
+    "limits the grade change between consecutive trackpoints. The grade and gradeChange limits\n"
+    "are enforced by adjusting the elevation values.\n"
+    "The cma, sgf, and sma commands also accept a comma-separated list of metrics, such as\n"
+    "\"elevation,speed,grade\", to smooth them all in a single pass.\n"
     "\n";
 
 typedef struct CliCmd {
@@ -82,6 +144,69 @@ static ActMetric getActMetric(const char *metric)
     return actMetric;
 }
 
+// Parse a comma-separated list of metrics, such as
+// "elevation,speed,grade". The first metric in the
+// list is also stored in actMetric.
+static int getActMetrics(const char *list, CmdArgs *pArgs)
+{
+    char buf[128];
+    char *metric, *savePtr;
+
+    if (strlen(list) >= sizeof (buf)) {
+        return -1;
+    }
+    strcpy(buf, list);
+
+    pArgs->numActMetrics = 0;
+    for (metric = strtok_r(buf, ",", &savePtr); metric != NULL; metric = strtok_r(NULL, ",", &savePtr)) {
+        ActMetric actMetric;
+
+        if (((actMetric = getActMetric(metric)) == invalid) ||
+            (pArgs->numActMetrics == MAX_ACT_METRICS)) {
+            pArgs->numActMetrics = 0;
+            return -1;
+        }
+
+        // Ignore duplicates
+        for (int n = 0; n < pArgs->numActMetrics; n++) {
+            if (pArgs->actMetrics[n] == actMetric) {
+                actMetric = invalid;
+                break;
+            }
+        }
+        if (actMetric != invalid) {
+            pArgs->actMetrics[pArgs->numActMetrics++] = actMetric;
+        }
+    }
+
+    if (pArgs->numActMetrics == 0) {
+        return -1;
+    }
+
+    pArgs->actMetric = pArgs->actMetrics[0];
+
+    return 0;
+}
+
+static int getOutFmt(const char *outFmt, CmdArgs *pArgs)
+{
+    if (strcmp(outFmt, "csv") == 0) {
+        pArgs->outFmt = csv;
+    } else if (strcmp(outFmt, "gpx") == 0) {
+        pArgs->outFmt = gpx;
+    } else if (strcmp(outFmt, "shiz") == 0) {
+        pArgs->outFmt = shiz;
+    } else if (strcmp(outFmt, "tcx") == 0) {
+        pArgs->outFmt = tcx;
+    } else if (strcmp(outFmt, "fit") == 0) {
+        pArgs->outFmt = fit;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
 static int findTrkPtByTime(GpsTrk *pTrk, time_t time)
 {
     TrkPt *p;
@@ -95,10 +220,25 @@ static int findTrkPtByTime(GpsTrk *pTrk, time_t time)
     return -1;
 }
 
+// Parse a position specified as "<lat>,<lon>"
+static int getLatLon(const char *arg, double *pLat, double *pLon)
+{
+    char c;
+
+    if ((sscanf(arg, "%lf,%lf%c", pLat, pLon, &c) != 2) ||
+        (*pLat < -90.0) || (*pLat > 90.0) ||
+        (*pLon < -180.0) || (*pLon > 180.0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
 static int getTrkPt(GpsTrk *pTrk, const char *arg)
 {
     int hr, min, sec;
     int index = -1;
+    double lat, lon;
 
     if (strcmp(arg, "start") == 0) {
         return 0;
@@ -110,6 +250,13 @@ static int getTrkPt(GpsTrk *pTrk, const char *arg)
             (sec >= 0) && (sec <= 59)) {
             index = findTrkPtByTime(pTrk, (hr * 3600 + min * 60 + sec));
         }
+    } else if (strchr(arg, ',') != NULL) {
+        // Use the TrkPt nearest to the specified position
+        GeoHit hit;
+        if ((getLatLon(arg, &lat, &lon) == 0) &&
+            (gridNearest(getGeoGrid(pTrk), lat, lon, &hit) == 0)) {
+            index = hit.p->index;
+        }
     } else {
         sscanf(arg, "%d", &index);
     }
@@ -133,6 +280,21 @@ static int getTrkPtRange(GpsTrk *pTrk, const char *from, const char *to, TrkPtRa
     return 0;
 }
 
+static CmdStat cliCmdClimbs(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    if (pArgs->argc != 1) {
+        printf("Syntax: climbs\n");
+        return ERROR;
+    }
+
+    pArgs->outFile = stdout;
+    if (printClimbs(pTrk, pArgs) != 0) {
+        return ERROR;
+    }
+
+    return OK;
+}
+
 static CmdStat cliCmdCma(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     char *smaMetric = pArgs->argv[1];
@@ -143,7 +305,7 @@ static CmdStat cliCmdCma(GpsTrk *pTrk, CmdArgs *pArgs)
         return ERROR;
     }
 
-    if ((pArgs->actMetric = getActMetric(smaMetric)) == invalid) {
+    if (getActMetrics(smaMetric, pArgs) != 0) {
         return invArgMsg(smaMetric, NULL);
     }
 
@@ -169,13 +331,235 @@ static CmdStat cliCmdCma(GpsTrk *pTrk, CmdArgs *pArgs)
     // the specified window.
     compCMA(pTrk, pArgs);
 
-    if (pArgs->actMetric == elevation) {
-        // Recompute the metrics
-        compMetrics(pTrk, pArgs);
+    // Recompute the metrics of the modified TrkPt's
+    for (int n = 0; n < pArgs->numActMetrics; n++) {
+        setDirtyRange(pTrk, pArgs->actMetrics[n], pArgs->range.from, pArgs->range.to);
     }
+    updDirtyMetrics(pTrk, pArgs);
 
-    // Recompute min/avg/max values
-    computeMinMaxValues(pTrk);
+    return OK;
+}
+
+static CmdStat cliCmdCompact(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    CompactTrk *pCt;
+    PackedTrk *pPt;
+    int s;
+
+    if (pArgs->argc > 3) {
+        printf("Syntax: compact [<file> [<format>]]\n");
+        return ERROR;
+    }
+
+    if (pArgs->argc == 1) {
+        pArgs->outFile = stdout;
+        if (printCompactReport(pTrk, pArgs) != 0) {
+            return ERROR;
+        }
+        return OK;
+    }
+
+    pArgs->outFmt = csv;
+    if ((pArgs->argc == 3) && (getOutFmt(pArgs->argv[2], pArgs) != 0)) {
+        return invArgMsg(pArgs->argv[2], NULL);
+    }
+
+    // Write out the track as read back from its packed
+    // representation.
+    if ((pCt = compactTrk(pTrk)) == NULL) {
+        return ERROR;
+    }
+    pPt = packTrk(pCt);
+    freeCompactTrk(pCt);
+    if (pPt == NULL) {
+        return ERROR;
+    }
+
+    if ((pArgs->outFile = fopen(pArgs->argv[1], "w")) == NULL) {
+        freePackedTrk(pPt);
+        return errMsg("Can't open output file");
+    }
+
+    if (pArgs->outFmt == csv) {
+        pArgs->tsFmt = hms;
+    }
+
+    s = printPackedTrk(pPt, pTrk, pArgs);
+    freePackedTrk(pPt);
+
+    if ((fclose(pArgs->outFile) != 0) || (s != 0)) {
+        pArgs->outFile = NULL;
+        return errMsg("Failed to write output file");
+    }
+    pArgs->outFile = NULL;
+
+    return OK;
+}
+
+static CmdStat cliCmdCompare(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    Bool transplant = false;
+
+    if ((pArgs->argc != 2) && (pArgs->argc != 3)) {
+        printf("Syntax: compare <file> [elevation]\n");
+        return ERROR;
+    }
+
+    if (pArgs->argc == 3) {
+        if (strcmp(pArgs->argv[2], "elevation") != 0) {
+            return invArgMsg(pArgs->argv[2], NULL);
+        }
+        transplant = true;
+
+        // Save current TrkPt's so that this operation
+        // can be 'undo'
+        saveTrkPts(pTrk);
+    }
+
+    pArgs->outFile = stdout;
+    if (compareTrks(pTrk, pArgs, pArgs->argv[1], transplant) != 0) {
+        return errMsg("Failed to compare the tracks");
+    }
+
+    if (transplant) {
+        // Recompute the metrics of the modified TrkPt's
+        setDirtyRange(pTrk, elevation, 0, pTrk->numTrkPts - 1);
+        updDirtyMetrics(pTrk, pArgs);
+    }
+
+    return OK;
+}
+
+static CmdStat cliCmdCurve(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    char *metric = pArgs->argv[1];
+    CurveMetric curveMetric;
+    int sdMask;
+    MeanMaxCurve *pCurve;
+    FILE *fp = stdout;
+
+    if ((pArgs->argc != 2) && (pArgs->argc != 3)) {
+        printf("Syntax: curve <metric> [<file>]\n");
+        return ERROR;
+    }
+
+    if (strcmp(metric, "cadence") == 0) {
+        curveMetric = cmCadence;
+        sdMask = SD_CADENCE;
+    } else if (strcmp(metric, "heartRate") == 0) {
+        curveMetric = cmHeartRate;
+        sdMask = SD_HR;
+    } else if (strcmp(metric, "power") == 0) {
+        curveMetric = cmPower;
+        sdMask = SD_POWER;
+    } else if (strcmp(metric, "speed") == 0) {
+        curveMetric = cmSpeed;
+        sdMask = SD_NONE;
+    } else {
+        return invArgMsg(metric, NULL);
+    }
+
+    if ((pTrk->inMask & sdMask) != sdMask) {
+        return errMsg("No data for the specified metric");
+    }
+
+    if ((pCurve = compMeanMaxCurve(pTrk, pArgs, curveMetric)) == NULL) {
+        return ERROR;
+    }
+
+    if ((pArgs->argc == 3) && ((fp = fopen(pArgs->argv[2], "w")) == NULL)) {
+        freeMeanMaxCurve(pCurve);
+        return errMsg("Can't open output file");
+    }
+
+    // The file gets the value for every duration
+    printMeanMaxCurve(pCurve, fp, (fp != stdout));
+
+    freeMeanMaxCurve(pCurve);
+
+    if ((fp != stdout) && (fclose(fp) != 0)) {
+        return errMsg("Failed to write output file");
+    }
+
+    return OK;
+}
+
+static CmdStat cliCmdElevation(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    char *source = pArgs->argv[1];
+    char *demDir = pArgs->argv[2];
+
+    if ((pArgs->argc < 3) || (strcmp(source, "dem") != 0)) {
+        printf("Syntax: elevation dem <dir> [<from> <to>]\n");
+        return ERROR;
+    }
+
+    if (pArgs->argc == 5) {
+        if (getTrkPtRange(pTrk, pArgs->argv[3], pArgs->argv[4], &pArgs->range) < 0) {
+            return -1;
+        }
+    } else {
+        pArgs->range.from = 0;
+        pArgs->range.to = pTrk->numTrkPts - 1;
+    }
+
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
+
+    // Get the elevation values from the DEM tiles
+    if (demElevation(pTrk, pArgs, demDir) != 0) {
+        return errMsg("Failed to get the DEM elevation data");
+    }
+
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, elevation, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
+
+    return OK;
+}
+
+static CmdStat cliCmdEma(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    char *smaMetric = pArgs->argv[1];
+    char *smaWindow = pArgs->argv[2];
+
+    if (pArgs->argc < 3) {
+        printf("Syntax: ema <metric> <window> [<from> <to>]\n");
+        return ERROR;
+    }
+
+    if ((pArgs->actMetric = getActMetric(smaMetric)) == invalid) {
+        return invArgMsg(smaMetric, NULL);
+    }
+
+    if ((sscanf(smaWindow, "%d", &pArgs->smaWindow) != 1) ||
+        (pArgs->smaWindow < 2)) {
+        return invArgMsg(smaWindow, NULL);
+    }
+
+    if (pArgs->argc == 5) {
+        if (getTrkPtRange(pTrk, pArgs->argv[3], pArgs->argv[4], &pArgs->range) < 0) {
+            return -1;
+        }
+    } else {
+        pArgs->range.from = 0;
+        pArgs->range.to = pTrk->numTrkPts - 1;
+    }
+
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
+
+    // Compute the EMA of the specified metric over
+    // the specified window.
+    if (compEMA(pTrk, pArgs) != 0) {
+        return errMsg("Failed to run the ema filter");
+    }
+
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, pArgs->actMetric, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
 
     return OK;
 }
@@ -185,6 +569,51 @@ static CmdStat cliCmdExit(GpsTrk *pTrk, CmdArgs *pArgs)
     return EXIT;
 }
 
+static CmdStat cliCmdHampel(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    char *smaMetric = pArgs->argv[1];
+    char *smaWindow = pArgs->argv[2];
+
+    if (pArgs->argc < 3) {
+        printf("Syntax: hampel <metric> <window> [<from> <to>]\n");
+        return ERROR;
+    }
+
+    if ((pArgs->actMetric = getActMetric(smaMetric)) == invalid) {
+        return invArgMsg(smaMetric, NULL);
+    }
+
+    if ((sscanf(smaWindow, "%d", &pArgs->smaWindow) != 1) ||
+        (pArgs->smaWindow < 3) || ((pArgs->smaWindow % 2) == 0)) {
+        return invArgMsg(smaWindow, NULL);
+    }
+
+    if (pArgs->argc == 5) {
+        if (getTrkPtRange(pTrk, pArgs->argv[3], pArgs->argv[4], &pArgs->range) < 0) {
+            return -1;
+        }
+    } else {
+        pArgs->range.from = 0;
+        pArgs->range.to = pTrk->numTrkPts - 1;
+    }
+
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
+
+    // Replace the outliers of the specified metric
+    // with the median of the specified window.
+    if (compHampel(pTrk, pArgs) != 0) {
+        return errMsg("Failed to run the hampel filter");
+    }
+
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, pArgs->actMetric, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
+
+    return OK;
+}
+
 static CmdStat cliCmdHelp(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     printf("%s", cliHelp);
@@ -207,6 +636,51 @@ static CmdStat cliCmdHistory(GpsTrk *pTrk, CmdArgs *pArgs)
     return OK;
 }
 
+static CmdStat cliCmdLowpass(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    char *smaMetric = pArgs->argv[1];
+    char *smaWindow = pArgs->argv[2];
+
+    if (pArgs->argc < 3) {
+        printf("Syntax: lowpass <metric> <period> [<from> <to>]\n");
+        return ERROR;
+    }
+
+    if ((pArgs->actMetric = getActMetric(smaMetric)) == invalid) {
+        return invArgMsg(smaMetric, NULL);
+    }
+
+    if ((sscanf(smaWindow, "%d", &pArgs->smaWindow) != 1) ||
+        (pArgs->smaWindow < 3)) {
+        return invArgMsg(smaWindow, NULL);
+    }
+
+    if (pArgs->argc == 5) {
+        if (getTrkPtRange(pTrk, pArgs->argv[3], pArgs->argv[4], &pArgs->range) < 0) {
+            return -1;
+        }
+    } else {
+        pArgs->range.from = 0;
+        pArgs->range.to = pTrk->numTrkPts - 1;
+    }
+
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
+
+    // Smooth the specified metric, removing the
+    // variations shorter than the cutoff period.
+    if (compLowpass(pTrk, pArgs) != 0) {
+        return errMsg("Failed to run the lowpass filter");
+    }
+
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, pArgs->actMetric, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
+
+    return OK;
+}
+
 static CmdStat cliCmdMax(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     char *metric = pArgs->argv[1];
@@ -235,6 +709,24 @@ static CmdStat cliCmdMax(GpsTrk *pTrk, CmdArgs *pArgs)
         pArgs->range.to = pTrk->numTrkPts - 1;
     }
 
+    if ((pArgs->actMetric == grade) || (pArgs->actMetric == gradeChange)) {
+        // Adjust the elevation values to limit the grade
+        // or the grade change. This saves the TrkPt's for
+        // 'undo' only if the limits can be met.
+        if (((pArgs->actMetric == grade) && (limitGrade(pTrk, pArgs, -HUGE_VAL, maxVal, HUGE_VAL) != 0)) ||
+            ((pArgs->actMetric == gradeChange) && (limitGrade(pTrk, pArgs, -HUGE_VAL, HUGE_VAL, maxVal) != 0))) {
+            // Nothing was changed
+            return ERROR;
+        }
+
+        // The elevation of the TrkPt's after the range
+        // may have been shifted too.
+        setDirtyRange(pTrk, elevation, pArgs->range.from, INT_MAX);
+        updDirtyMetrics(pTrk, pArgs);
+
+        return OK;
+    }
+
     // Save current TrkPt's so that this operation
     // can be 'undo'
     saveTrkPts(pTrk);
@@ -248,26 +740,61 @@ static CmdStat cliCmdMax(GpsTrk *pTrk, CmdArgs *pArgs)
             if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
                 if ((pArgs->actMetric == elevation) && (tp->elevation > maxVal)) {
                     tp->elevation = maxVal;
-                } else if ((pArgs->actMetric == grade) && (tp->grade > maxVal)) {
-                    tp->grade = maxVal;
                 } else if ((pArgs->actMetric == speed) && (tp->speed > maxVal)) {
                     tp->speed = maxVal;
-                } else if (pArgs->actMetric == gradeChange) {
-                    TrkPt *p0 = TAILQ_PREV(tp, TrkPtList, tqEntry);
-                    if (p0 != NULL) {
-                        if ((tp->deltaG = fabs(tp->grade - p0->grade)) > maxVal) {
-                            printf("TrkPt #%d: grade=%.3lf->%.3lf change=%.3lf exceeds the maxVal=%.3lf\n",
-                                    tp->index, p0->grade, tp->grade, tp->deltaG, maxVal);
-                            // TBD
-                        }
-                    }
                 }
             }
         }
     }
 
-    // Recompute min/avg/max values
-    computeMinMaxValues(pTrk);
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, pArgs->actMetric, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
+
+    return OK;
+}
+
+static CmdStat cliCmdMedian(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    char *smaMetric = pArgs->argv[1];
+    char *smaWindow = pArgs->argv[2];
+
+    if (pArgs->argc < 3) {
+        printf("Syntax: median <metric> <window> [<from> <to>]\n");
+        return ERROR;
+    }
+
+    if ((pArgs->actMetric = getActMetric(smaMetric)) == invalid) {
+        return invArgMsg(smaMetric, NULL);
+    }
+
+    if ((sscanf(smaWindow, "%d", &pArgs->smaWindow) != 1) ||
+        (pArgs->smaWindow < 3) || ((pArgs->smaWindow % 2) == 0)) {
+        return invArgMsg(smaWindow, NULL);
+    }
+
+    if (pArgs->argc == 5) {
+        if (getTrkPtRange(pTrk, pArgs->argv[3], pArgs->argv[4], &pArgs->range) < 0) {
+            return -1;
+        }
+    } else {
+        pArgs->range.from = 0;
+        pArgs->range.to = pTrk->numTrkPts - 1;
+    }
+
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
+
+    // Compute the sliding median of the specified
+    // metric over the specified window.
+    if (compMedian(pTrk, pArgs) != 0) {
+        return errMsg("Failed to run the median filter");
+    }
+
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, pArgs->actMetric, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
 
     return OK;
 }
@@ -300,6 +827,23 @@ static CmdStat cliCmdMin(GpsTrk *pTrk, CmdArgs *pArgs)
         pArgs->range.to = pTrk->numTrkPts - 1;
     }
 
+    if (pArgs->actMetric == grade) {
+        // Adjust the elevation values to limit the grade.
+        // This saves the TrkPt's for 'undo' only if the
+        // limit can be met.
+        if (limitGrade(pTrk, pArgs, minVal, HUGE_VAL, HUGE_VAL) != 0) {
+            // Nothing was changed
+            return ERROR;
+        }
+
+        // The elevation of the TrkPt's after the range
+        // may have been shifted too.
+        setDirtyRange(pTrk, elevation, pArgs->range.from, INT_MAX);
+        updDirtyMetrics(pTrk, pArgs);
+
+        return OK;
+    }
+
     // Save current TrkPt's so that this operation
     // can be 'undo'
     saveTrkPts(pTrk);
@@ -313,8 +857,6 @@ static CmdStat cliCmdMin(GpsTrk *pTrk, CmdArgs *pArgs)
             if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
                 if ((pArgs->actMetric == elevation) && (tp->elevation < minVal)) {
                     tp->elevation = minVal;
-                } else if ((pArgs->actMetric == grade) && (tp->grade < minVal)) {
-                    tp->grade = minVal;
                 } else if ((pArgs->actMetric == speed) && (tp->speed < minVal)) {
                     tp->speed = minVal;
                 }
@@ -322,50 +864,105 @@ static CmdStat cliCmdMin(GpsTrk *pTrk, CmdArgs *pArgs)
         }
     }
 
-    // Recompute min/avg/max values
-    computeMinMaxValues(pTrk);
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, pArgs->actMetric, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
 
     return OK;
 }
 
-static CmdStat cliCmdSave(GpsTrk *pTrk, CmdArgs *pArgs)
+static CmdStat cliCmdResample(GpsTrk *pTrk, CmdArgs *pArgs)
 {
-    if (pArgs->argc < 2) {
-        printf("Syntax: save <file> [<format>]\n");
+    char *column = pArgs->argv[1];
+    char *step = pArgs->argv[2];
+    Bool byDist = false;
+    double stepVal = 0.0;
+
+    if (pArgs->argc != 3) {
+        printf("Syntax: resample {time|dist} <step>\n");
         return ERROR;
     }
 
-    // Open the output file for writing
-    if ((pArgs->outFile = fopen(pArgs->argv[1], "w")) == NULL) {
-        return errMsg("Can't open output file");
+    if (strcmp(column, "dist") == 0) {
+        byDist = true;
+    } else if (strcmp(column, "time") != 0) {
+        return invArgMsg(column, NULL);
     }
 
-    if (pArgs->argc == 3) {
+    if ((sscanf(step, "%le", &stepVal) != 1) || (stepVal <= 0.0)) {
+        return invArgMsg(step, NULL);
+    }
+
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
+
+    if (resampleTrkPts(pTrk, pArgs, byDist, stepVal) != 0) {
+        return errMsg("Failed to resample the track");
+    }
+
+    // Recompute the metrics
+    compMetrics(pTrk, pArgs);
+
+    return OK;
+}
+
+static CmdStat cliCmdSave(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    CompType compType = noComp;
+    int compLevel = 0;
+    int s;
+
+    if (pArgs->argc < 2) {
+        printf("Syntax: save <file> [<format> [<compression> [<level>]]]\n");
+        return ERROR;
+    }
+
+    if (pArgs->argc >= 3) {
         char *outFmt = pArgs->argv[2];
-        if (strcmp(outFmt, "csv") == 0) {
-            pArgs->outFmt = csv;
-        } else if (strcmp(outFmt, "gpx") == 0) {
-            pArgs->outFmt = gpx;
-        } else if (strcmp(outFmt, "shiz") == 0) {
-            pArgs->outFmt = shiz;
-        } else if (strcmp(outFmt, "tcx") == 0) {
-            pArgs->outFmt = tcx;
-        } else {
+        if (getOutFmt(outFmt, pArgs) != 0) {
             return invArgMsg(outFmt, NULL);
         }
     } else {
         pArgs->outFmt = csv;
     }
 
+    if (pArgs->argc >= 4) {
+        char *comp = pArgs->argv[3];
+        if (strcmp(comp, "gzip") == 0) {
+            compType = gzip;
+        } else if (strcmp(comp, "zstd") == 0) {
+            compType = zstd;
+        } else {
+            return invArgMsg(comp, NULL);
+        }
+    }
+
+    if (pArgs->argc >= 5) {
+        char *level = pArgs->argv[4];
+        if (sscanf(level, "%d", &compLevel) != 1) {
+            return invArgMsg(level, NULL);
+        }
+    }
+
+    // Open the output file for writing
+    if ((pArgs->outFile = zioOpenWrite(pArgs->argv[1], compType, compLevel)) == NULL) {
+        return errMsg("Can't open output file");
+    }
+
     if (pArgs->outFmt == csv) {
         // Use HH:MM:SS time format so that it is easy
         // to correlate the TrkPt's with the MP4 video.
         pArgs->tsFmt = hms;
     }
 
-    printOutput(pTrk, pArgs);
+    s = printOutput(pTrk, pArgs);
 
-    fclose(pArgs->outFile);
+    // Wait for the data to be compressed and written out
+    if ((fclose(pArgs->outFile) != 0) || (s != 0)) {
+        pArgs->outFile = NULL;
+        return errMsg("Failed to write output file");
+    }
     pArgs->outFile = NULL;
 
     return OK;
@@ -405,13 +1002,9 @@ static CmdStat cliCmdScale(GpsTrk *pTrk, CmdArgs *pArgs)
     // Scale the specified metric by the specified factor
     scaleMetric(pTrk, pArgs);
 
-    if (pArgs->actMetric == elevation) {
-        // Recompute the metrics
-        compMetrics(pTrk, pArgs);
-    }
-
-    // Recompute min/avg/max values
-    computeMinMaxValues(pTrk);
+    // Recompute the metrics of the modified TrkPt's
+    setDirtyRange(pTrk, pArgs->actMetric, pArgs->range.from, pArgs->range.to);
+    updDirtyMetrics(pTrk, pArgs);
 
     return OK;
 }
@@ -426,7 +1019,7 @@ static CmdStat cliCmdSgf(GpsTrk *pTrk, CmdArgs *pArgs)
         return ERROR;
     }
 
-    if ((pArgs->actMetric = getActMetric(smaMetric)) == invalid) {
+    if (getActMetrics(smaMetric, pArgs) != 0) {
         return invArgMsg(smaMetric, NULL);
     }
 
@@ -452,13 +1045,11 @@ static CmdStat cliCmdSgf(GpsTrk *pTrk, CmdArgs *pArgs)
     // the specified window.
     compSGF(pTrk, pArgs);
 
-    if (pArgs->actMetric == elevation) {
-        // Recompute the metrics
-        compMetrics(pTrk, pArgs);
+    // Recompute the metrics of the modified TrkPt's
+    for (int n = 0; n < pArgs->numActMetrics; n++) {
+        setDirtyRange(pTrk, pArgs->actMetrics[n], pArgs->range.from, pArgs->range.to);
     }
-
-    // Recompute min/avg/max values
-    computeMinMaxValues(pTrk);
+    updDirtyMetrics(pTrk, pArgs);
 
     return OK;
 }
@@ -490,6 +1081,85 @@ static CmdStat cliCmdShow(GpsTrk *pTrk, CmdArgs *pArgs)
     return OK;
 }
 
+static CmdStat cliCmdSimplify(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    SimplifyTol tol;
+    TrkPt **remList;
+    TrkPt *p;
+    char *answer;
+    int numTrkPts = 0;
+    int numRem;
+
+    if ((pArgs->argc != 4) && (pArgs->argc != 6)) {
+        printf("Syntax: simplify <dist> <elev> <grade> [<from> <to>]\n");
+        return ERROR;
+    }
+
+    if ((sscanf(pArgs->argv[1], "%le", &tol.dist) != 1) || (tol.dist <= 0.0)) {
+        return invArgMsg(pArgs->argv[1], NULL);
+    }
+
+    if ((sscanf(pArgs->argv[2], "%le", &tol.elev) != 1) || (tol.elev <= 0.0)) {
+        return invArgMsg(pArgs->argv[2], NULL);
+    }
+
+    if ((sscanf(pArgs->argv[3], "%le", &tol.grade) != 1) || (tol.grade <= 0.0)) {
+        return invArgMsg(pArgs->argv[3], NULL);
+    }
+
+    if (pArgs->argc == 6) {
+        if (getTrkPtRange(pTrk, pArgs->argv[4], pArgs->argv[5], &pArgs->range) < 0) {
+            return -1;
+        }
+    } else {
+        pArgs->range.from = 0;
+        pArgs->range.to = pTrk->numTrkPts - 1;
+    }
+
+    if ((numRem = simplifyTrkPts(pTrk, pArgs, &tol, &remList)) < 0) {
+        return errMsg("Failed to simplify the track");
+    }
+
+    // Let the user decide whether it's worth it
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        numTrkPts++;
+    }
+    printf("The track would go from %d to %d trackpoints.\n", numTrkPts, (numTrkPts - numRem));
+    if (numRem == 0) {
+        return OK;
+    }
+    answer = readline("Proceed? [y/n] ");
+    if ((answer == NULL) || (tolower(answer[0]) != 'y')) {
+        free(answer);
+        free(remList);
+        return OK;
+    }
+    free(answer);
+
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
+
+    for (int n = 0; n < numRem; n++) {
+        remTrkPt(pTrk, remList[n]);
+    }
+    free(remList);
+
+    // Recompute the index of all the TrkPt's
+    numTrkPts = 0;
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        p->index = numTrkPts++;
+    }
+
+    // Update the total number of TrkPt's
+    pTrk->numTrkPts = numTrkPts;
+
+    // Recompute the metrics
+    compMetrics(pTrk, pArgs);
+
+    return OK;
+}
+
 static CmdStat cliCmdSma(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     char *smaMetric = pArgs->argv[1];
@@ -500,7 +1170,7 @@ static CmdStat cliCmdSma(GpsTrk *pTrk, CmdArgs *pArgs)
         return ERROR;
     }
 
-    if ((pArgs->actMetric = getActMetric(smaMetric)) == invalid) {
+    if (getActMetrics(smaMetric, pArgs) != 0) {
         return invArgMsg(smaMetric, NULL);
     }
 
@@ -526,19 +1196,28 @@ static CmdStat cliCmdSma(GpsTrk *pTrk, CmdArgs *pArgs)
     // the specified window.
     compSMA(pTrk, pArgs);
 
-    if (pArgs->actMetric == elevation) {
-        // Recompute the metrics
-        compMetrics(pTrk, pArgs);
+    // Recompute the metrics of the modified TrkPt's
+    for (int n = 0; n < pArgs->numActMetrics; n++) {
+        setDirtyRange(pTrk, pArgs->actMetrics[n], pArgs->range.from, pArgs->range.to);
     }
-
-    // Recompute min/avg/max values
-    computeMinMaxValues(pTrk);
+    updDirtyMetrics(pTrk, pArgs);
 
     return OK;
 }
 
 static CmdStat cliCmdSummary(GpsTrk *pTrk, CmdArgs *pArgs)
 {
+    if (pArgs->argc == 3) {
+        if (getTrkPtRange(pTrk, pArgs->argv[1], pArgs->argv[2], &pArgs->range) < 0) {
+            return ERROR;
+        }
+        pArgs->outFile = stdout;
+        if (printRangeSummary(pTrk, pArgs, &pArgs->range) != 0) {
+            return errMsg("No trackpoints in the specified range");
+        }
+        return OK;
+    }
+
     if ((pArgs->argc == 2) && (strcmp(pArgs->argv[1], "detail") == 0)) {
         pArgs->detail = true;
     }
@@ -549,6 +1228,33 @@ static CmdStat cliCmdSummary(GpsTrk *pTrk, CmdArgs *pArgs)
     return OK;
 }
 
+static CmdStat cliCmdSync(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    SyncMetric metric = smSpeed;
+
+    if ((pArgs->argc != 2) && (pArgs->argc != 3)) {
+        printf("Syntax: sync <file> [elevation|speed]\n");
+        return ERROR;
+    }
+
+    if (pArgs->argc == 3) {
+        if (strcmp(pArgs->argv[2], "elevation") == 0) {
+            metric = smElevation;
+        } else if (strcmp(pArgs->argv[2], "speed") == 0) {
+            metric = smSpeed;
+        } else {
+            return invArgMsg(pArgs->argv[2], NULL);
+        }
+    }
+
+    pArgs->outFile = stdout;
+    if (syncTrks(pTrk, pArgs, pArgs->argv[1], metric) != 0) {
+        return errMsg("Failed to sync the tracks");
+    }
+
+    return OK;
+}
+
 static CmdStat cliCmdTrim(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     if ((pArgs->argc != 3) ||
@@ -660,20 +1366,100 @@ static CmdStat cliCmdUndo(GpsTrk *pTrk, CmdArgs *pArgs)
     return OK;
 }
 
+static CmdStat cliCmdNear(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    const GeoGrid *pGrid;
+    double lat, lon;
+    double radius = 0.0;
+
+    if ((pArgs->argc < 2) || (pArgs->argc > 3)) {
+        printf("Syntax: near <lat,lon> [<radius>]\n");
+        return ERROR;
+    }
+
+    if (getLatLon(pArgs->argv[1], &lat, &lon) != 0) {
+        return invArgMsg(pArgs->argv[1], NULL);
+    }
+
+    if ((pArgs->argc == 3) &&
+        ((sscanf(pArgs->argv[2], "%le", &radius) != 1) || (radius <= 0.0))) {
+        return invArgMsg(pArgs->argv[2], NULL);
+    }
+
+    if ((pGrid = getGeoGrid(pTrk)) == NULL) {
+        return errMsg("Failed to build the spatial index");
+    }
+
+    if (pArgs->argc == 2) {
+        GeoHit hit;
+
+        if (gridNearest(pGrid, lat, lon, &hit) != 0) {
+            return errMsg("No trackpoints");
+        }
+        printf("TrkPt #%u at %s: dist=%.1lf m time=%.3lf distance=%.3lf km\n",
+                hit.p->index, fmtTrkPtIdx(hit.p), hit.dist, hit.p->timestamp, (hit.p->distance / 1000.0));
+    } else {
+        GeoHit *hits;
+        int numHits;
+        int numPasses = 0;
+
+        if ((numHits = gridWithin(pGrid, lat, lon, radius, &hits)) < 0) {
+            return ERROR;
+        }
+
+        // Consecutive TrkPt's within the radius make up a
+        // single pass; report the closest TrkPt of each pass.
+        for (int i = 0; i < numHits; ) {
+            int first = i, best = i;
+
+            while (((i + 1) < numHits) && (hits[i + 1].pos == (hits[i].pos + 1))) {
+                i++;
+                if (hits[i].dist < hits[best].dist)
+                    best = i;
+            }
+            printf("Pass #%d: TrkPt #%u to #%u, closest TrkPt #%u at %s: dist=%.1lf m time=%.3lf distance=%.3lf km\n",
+                    ++numPasses, hits[first].p->index, hits[i].p->index,
+                    hits[best].p->index, fmtTrkPtIdx(hits[best].p), hits[best].dist,
+                    hits[best].p->timestamp, (hits[best].p->distance / 1000.0));
+            i++;
+        }
+        if (numPasses == 0) {
+            printf("No trackpoints within %.1lf m\n", radius);
+        }
+
+        free(hits);
+    }
+
+    return OK;
+}
+
 // CLI command table
 static CliCmd cliCmdTbl [] = {
+        { "climbs",     cliCmdClimbs },
         { "cma",        cliCmdCma },
+        { "compact",    cliCmdCompact },
+        { "compare",    cliCmdCompare },
+        { "curve",      cliCmdCurve },
+        { "elevation",  cliCmdElevation },
+        { "ema",        cliCmdEma },
         { "exit",       cliCmdExit },
+        { "hampel",     cliCmdHampel },
         { "help",       cliCmdHelp },
         { "history",    cliCmdHistory },
+        { "lowpass",    cliCmdLowpass },
         { "max",        cliCmdMax },
+        { "median",     cliCmdMedian },
         { "min",        cliCmdMin },
+        { "near",       cliCmdNear },
+        { "resample",   cliCmdResample },
         { "save",       cliCmdSave },
         { "scale",      cliCmdScale },
         { "sgf",        cliCmdSgf },
         { "show",       cliCmdShow },
+        { "simplify",   cliCmdSimplify },
         { "sma",        cliCmdSma },
         { "summary",    cliCmdSummary },
+        { "sync",       cliCmdSync },
         { "trim",       cliCmdTrim },
         { "undo",       cliCmdUndo },
         { NULL,         NULL },
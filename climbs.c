@@ -0,0 +1,235 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "climbs.h"
+
+// The track is split into alternating uphill and downhill legs
+// at the turning points of the elevation profile, ignoring any
+// reversal smaller than CLIMB_HYST_ELEV meters. The legs that
+// are long and steep enough are reported as climbs/descents.
+// The stats of each leg are computed from the prefix sums of
+// the rise and run of the TrkPt's, so the whole thing is O(N).
+#define CLIMB_HYST_ELEV     10.0    // in meters
+#define CLIMB_MIN_LENGTH    500.0   // in meters
+#define CLIMB_MIN_GRADE     3.0     // in %
+#define CLIMB_GRADE_DIST    100.0   // in meters
+
+// The category of a climb is based on its score, which is
+// its length (in meters) times its average grade (in %),
+// the same way Strava does it.
+static const struct {
+    double minScore;
+    const char *cat;
+} climbCatTbl[] = {
+    { 80000.0, "HC" },
+    { 64000.0, "1" },
+    { 32000.0, "2" },
+    { 16000.0, "3" },
+    {  8000.0, "4" },
+    {     0.0, "-" },
+};
+
+typedef struct ClimbCtx {
+    int numPts;
+    const TrkPt **pts;
+    double *run;    // prefix sum of the run
+    double *rise;   // prefix sum of the rise
+    ClimbList *pList;
+} ClimbCtx;
+
+static const char *climbCat(double length, double avgGrade)
+{
+    double score = length * fabs(avgGrade);
+    int n;
+
+    for (n = 0; climbCatTbl[n].minScore > score; n++)
+        ;
+
+    return climbCatTbl[n].cat;
+}
+
+// Steepest grade, over a distance of at least CLIMB_GRADE_DIST
+// meters, between the TrkPt's a..b. For a descent this is the
+// most negative grade.
+static double steepestGrade(const ClimbCtx *pCtx, int a, int b, Bool descent)
+{
+    const double *run = pCtx->run;
+    const double *rise = pCtx->rise;
+    double maxGrade = 100.0 * (rise[b] - rise[a]) / (run[b] - run[a]);
+    int i = a;
+
+    for (int j = a + 1; j <= b; j++) {
+        double grade;
+
+        // Shortest stretch ending at TrkPt #j that is at
+        // least CLIMB_GRADE_DIST meters long.
+        while ((i < j) && ((run[j] - run[i + 1]) >= CLIMB_GRADE_DIST)) {
+            i++;
+        }
+        if ((run[j] - run[i]) < CLIMB_GRADE_DIST) {
+            continue;
+        }
+
+        grade = 100.0 * (rise[j] - rise[i]) / (run[j] - run[i]);
+        if ((!descent && (grade > maxGrade)) || (descent && (grade < maxGrade))) {
+            maxGrade = grade;
+        }
+    }
+
+    return maxGrade;
+}
+
+static void addLeg(ClimbCtx *pCtx, int a, int b)
+{
+    double length = pCtx->run[b] - pCtx->run[a];
+    double gain = pCtx->rise[b] - pCtx->rise[a];
+    Climb *pClimb;
+
+    if ((length < CLIMB_MIN_LENGTH) ||
+        ((100.0 * fabs(gain) / length) < CLIMB_MIN_GRADE)) {
+        return;
+    }
+
+    pClimb = &pCtx->pList->climbs[pCtx->pList->numClimbs++];
+    pClimb->descent = (gain < 0.0);
+    pClimb->from = pCtx->pts[a]->index;
+    pClimb->to = pCtx->pts[b]->index;
+    pClimb->startDist = pCtx->pts[a]->distance;
+    pClimb->length = length;
+    pClimb->gain = gain;
+    pClimb->avgGrade = 100.0 * gain / length;
+    pClimb->maxGrade = steepestGrade(pCtx, a, b, pClimb->descent);
+    pClimb->cat = climbCat(length, pClimb->avgGrade);
+}
+
+static void findLegs(ClimbCtx *pCtx)
+{
+    const double *h = pCtx->rise;
+    int dir = 0;    // 1=up -1=down 0=unknown
+    int lo = 0, hi = 0;
+    int start = 0, ext = 0;
+
+    for (int i = 1; i < pCtx->numPts; i++) {
+        if (dir == 0) {
+            // Wait until the elevation changes enough
+            // to tell which way we are going.
+            if (h[i] > h[hi])
+                hi = i;
+            if (h[i] < h[lo])
+                lo = i;
+            if ((h[hi] - h[lo]) >= CLIMB_HYST_ELEV) {
+                dir = (hi > lo) ? 1 : -1;
+                start = (hi > lo) ? lo : hi;
+                ext = i;
+            }
+        } else if (dir > 0) {
+            if (h[i] >= h[ext]) {
+                ext = i;
+            } else if ((h[ext] - h[i]) >= CLIMB_HYST_ELEV) {
+                addLeg(pCtx, start, ext);
+                start = ext;
+                ext = i;
+                dir = -1;
+            }
+        } else {
+            if (h[i] <= h[ext]) {
+                ext = i;
+            } else if ((h[i] - h[ext]) >= CLIMB_HYST_ELEV) {
+                addLeg(pCtx, start, ext);
+                start = ext;
+                ext = i;
+                dir = 1;
+            }
+        }
+    }
+
+    if (dir != 0) {
+        addLeg(pCtx, start, ext);
+    }
+}
+
+const ClimbList *getClimbs(GpsTrk *pTrk, const CmdArgs *pArgs)
+{
+    ClimbCtx ctx = {0};
+    const TrkPt *p;
+    int n;
+
+    if (pTrk->climbs != NULL) {
+        return pTrk->climbs;
+    }
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        ctx.numPts++;
+    }
+
+    // There can't be more legs than TrkPt's
+    ctx.pts = malloc((ctx.numPts + 1) * sizeof (TrkPt *));
+    ctx.run = malloc((ctx.numPts + 1) * sizeof (double));
+    ctx.rise = malloc((ctx.numPts + 1) * sizeof (double));
+    ctx.pList = malloc(sizeof (ClimbList) + ((ctx.numPts + 1) * sizeof (Climb)));
+    if ((ctx.pts == NULL) || (ctx.run == NULL) || (ctx.rise == NULL) || (ctx.pList == NULL)) {
+        fprintf(stderr, "Failed to alloc ClimbCtx buffers !!!\n");
+        free(ctx.pList);
+        ctx.pList = NULL;
+        goto done;
+    }
+    ctx.pList->numClimbs = 0;
+
+    n = 0;
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        ctx.pts[n] = p;
+        ctx.run[n] = (n == 0) ? 0.0 : (ctx.run[n - 1] + p->run);
+        ctx.rise[n] = (n == 0) ? 0.0 : (ctx.rise[n - 1] + p->rise);
+        n++;
+    }
+
+    findLegs(&ctx);
+
+    pTrk->climbs = ctx.pList;
+
+done:
+    free(ctx.pts);
+    free(ctx.run);
+    free(ctx.rise);
+
+    return ctx.pList;
+}
+
+int printClimbs(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    const ClimbList *pList;
+
+    if ((pList = getClimbs(pTrk, pArgs)) == NULL) {
+        return -1;
+    }
+
+    if (pList->numClimbs == 0) {
+        fprintf(pArgs->outFile, "No climbs or descents found.\n");
+        return 0;
+    }
+
+    fprintf(pArgs->outFile, "<type>,<cat>,<from>,<to>,<start>,<length>,<gain>,<avgGrade>,<maxGrade>\n");
+    for (int n = 0; n < pList->numClimbs; n++) {
+        const Climb *pClimb = &pList->climbs[n];
+
+        fprintf(pArgs->outFile, "%s,%s,%d,%d,%.3lf,%.3lf,%.1lf,%.2lf,%.2lf\n",
+                pClimb->descent ? "descent" : "climb",
+                pClimb->cat,
+                pClimb->from,
+                pClimb->to,
+                mToKm(pClimb->startDist),   // km
+                mToKm(pClimb->length),      // km
+                pClimb->gain,               // m
+                pClimb->avgGrade,           // %
+                pClimb->maxGrade);          // %
+    }
+
+    return 0;
+}
+
+void freeClimbs(GpsTrk *pTrk)
+{
+    free(pTrk->climbs);
+    pTrk->climbs = NULL;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Climb or descent
+typedef struct Climb {
+    Bool descent;
+    int from;           // index of the first TrkPt
+    int to;             // index of the last TrkPt
+    double startDist;   // distance from the start (in meters)
+    double length;      // horizontal length (in meters)
+    double gain;        // elevation gain (in meters); negative for a descent
+    double avgGrade;    // average grade (in %)
+    double maxGrade;    // steepest grade (in %) over CLIMB_GRADE_DIST meters
+    const char *cat;    // category
+} Climb;
+
+// List of climbs and descents, cached in the GpsTrk until
+// the TrkPt's are modified.
+typedef struct ClimbList {
+    int numClimbs;
+    Climb climbs[];
+} ClimbList;
+
+// Find the climbs and descents in the track, unless they
+// have already been found. Returns NULL on error.
+extern const ClimbList *getClimbs(GpsTrk *pTrk, const CmdArgs *pArgs);
+
+// Print the climbs and descents in the track
+extern int printClimbs(GpsTrk *pTrk, CmdArgs *pArgs);
+
+// Discard the cached climbs and descents
+extern void freeClimbs(GpsTrk *pTrk);
+
+#ifdef __cplusplus
+};
+#endif
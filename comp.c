@@ -2,81 +2,98 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "aggr.h"
+#include "climbs.h"
 #include "comp.h"
 #include "const.h"
+#include "grid.h"
+#include "pool.h"
 #include "sgfilter.h"
 #include "trkpt.h"
 
-// Check the TrkPt's for missing/duplicate/bogus values
-int checkTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs)
+// Check the TrkPt 'p2' for missing/duplicate/bogus values,
+// given the previous (valid) TrkPt 'p1'. Returns -1 if the
+// data is unusable, 1 if the TrkPt needs to be discarded,
+// and 0 otherwise.
+int checkTrkPt(GpsTrk *pTrk, const CmdArgs *pArgs, const TrkPt *p1, const TrkPt *p2)
 {
-    TrkPt *p1 = TAILQ_FIRST(&pTrk->trkPtList);  // previous TrkPt
-    TrkPt *p2 = TAILQ_NEXT(p1, tqEntry);    // current TrkPt
     Bool discTrkPt = false;
 
-    while (p2 != NULL) {
-        // Discard any duplicate points...
-        discTrkPt = false;
+    // Without distance data, there isn't much we can do!
+    if (p2->distance == nilDist) {
+        fprintf(stderr, "ERROR: TrkPt #%d (%s) is missing its distance data !\n", p2->index, fmtTrkPtIdx(p2));
+        return -1;
+    }
 
-        // Without distance data, there isn't much we can do!
-        if (p2->distance == nilDist) {
-            fprintf(stderr, "ERROR: TrkPt #%d (%s) is missing its distance data !\n", p2->index, fmtTrkPtIdx(p2));
-            return -1;
-        }
+    // Without elevation data, there isn't much we can do!
+    if (p2->elevation == nilElev) {
+        fprintf(stderr, "ERROR: TrkPt #%d (%s) is missing its elevation data !\n", p2->index, fmtTrkPtIdx(p2));
+        return -1;
+    }
 
-        // Without elevation data, there isn't much we can do!
-        if (p2->elevation == nilElev) {
-            fprintf(stderr, "ERROR: TrkPt #%d (%s) is missing its elevation data !\n", p2->index, fmtTrkPtIdx(p2));
-            return -1;
-        }
+    // Without speed data, there isn't much we can do!
+    if (p2->speed == nilSpeed) {
+        fprintf(stderr, "ERROR: TrkPt #%d (%s) is missing its speed data !\n", p2->index, fmtTrkPtIdx(p2));
+        return -1;
+    }
 
-        // Without speed data, there isn't much we can do!
-        if (p2->speed == nilSpeed) {
-            fprintf(stderr, "ERROR: TrkPt #%d (%s) is missing its speed data !\n", p2->index, fmtTrkPtIdx(p2));
-            return -1;
+    // Some GPX tracks may have duplicate TrkPt's. This
+    // can happen when the file has multiple laps, and
+    // the last point in lap N is the same as the first
+    // point in lap N+1.
+    if ((p2->latitude == p1->latitude) &&
+        (p2->longitude == p1->longitude) &&
+        (p2->elevation == p1->elevation)) {
+        if (!pArgs->quiet) {
+            fprintf(stderr, "INFO: Discarding duplicate TrkPt #%d (%s) !\n", p2->index, fmtTrkPtIdx(p2));
         }
+        pTrk->numDupTrkPts++;
+        discTrkPt = true;
+    }
 
-        // Some GPX tracks may have duplicate TrkPt's. This
-        // can happen when the file has multiple laps, and
-        // the last point in lap N is the same as the first
-        // point in lap N+1.
-        if ((p2->latitude == p1->latitude) &&
-            (p2->longitude == p1->longitude) &&
-            (p2->elevation == p1->elevation)) {
-            if (!pArgs->quiet) {
-                fprintf(stderr, "INFO: Discarding duplicate TrkPt #%d (%s) !\n", p2->index, fmtTrkPtIdx(p2));
-            }
-            pTrk->numDupTrkPts++;
-            discTrkPt = true;
+    // Timestamps should increase monotonically
+    if (p2->timestamp <= p1->timestamp) {
+        if (!pArgs->quiet) {
+            fprintf(stderr, "INFO: TrkPt #%d (%s) has a non-increasing timestamp value: %.3lf !\n",
+                    p2->index, fmtTrkPtIdx(p2), p2->timestamp);
         }
 
-        // Timestamps should increase monotonically
-        if (p2->timestamp <= p1->timestamp) {
-            if (!pArgs->quiet) {
-                fprintf(stderr, "INFO: TrkPt #%d (%s) has a non-increasing timestamp value: %.3lf !\n",
-                        p2->index, fmtTrkPtIdx(p2), p2->timestamp);
-            }
+        // Discard as a dummy
+        pTrk->numDiscTrkPts++;
+        discTrkPt = true;
+    }
 
-            // Discard as a dummy
-            pTrk->numDiscTrkPts++;
-            discTrkPt = true;
+    // Distance should increase monotonically
+    if ((p2->speed != 0.0) && (p2->distance <= p1->distance)) {
+        if (!pArgs->quiet) {
+            fprintf(stderr, "INFO: TrkPt #%d (%s) has a non-increasing distance value: distance=%.3lf speed=%.2lf !\n",
+                    p2->index, fmtTrkPtIdx(p2), p2->distance, p2->speed);
         }
 
-        // Distance should increase monotonically
-        if ((p2->speed != 0.0) && (p2->distance <= p1->distance)) {
-            if (!pArgs->quiet) {
-                fprintf(stderr, "INFO: TrkPt #%d (%s) has a non-increasing distance value: distance=%.3lf speed=%.2lf !\n",
-                        p2->index, fmtTrkPtIdx(p2), p2->distance, p2->speed);
-            }
+        // Discard as a dummy
+        pTrk->numDiscTrkPts++;
+        discTrkPt = true;
+    }
+
+    return (!pArgs->verbatim && discTrkPt) ? 1 : 0;
+}
+
+// Check the TrkPt's for missing/duplicate/bogus values
+int checkTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs)
+{
+    TrkPt *p1 = TAILQ_FIRST(&pTrk->trkPtList);  // previous TrkPt
+    TrkPt *p2 = TAILQ_NEXT(p1, tqEntry);    // current TrkPt
+    int s;
 
-            // Discard as a dummy
-            pTrk->numDiscTrkPts++;
-            discTrkPt = true;
+    while (p2 != NULL) {
+        if ((s = checkTrkPt(pTrk, pArgs, p1, p2)) < 0) {
+            return -1;
         }
 
         // Discard?
-        if (!pArgs->verbatim && discTrkPt) {
+        if (s != 0) {
             // Remove this TrkPt from the list keeping
             // p1 the same.
             p2 = remTrkPt(pTrk, p2);
@@ -95,7 +112,7 @@ int checkTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs)
 //
 //   https://en.wikipedia.org/wiki/Haversine_formula
 //
-static double compHaversine(const TrkPt *p1, const TrkPt *p2)
+double compHaversine(const TrkPt *p1, const TrkPt *p2)
 {
     const double two = (double) 2.0;
     double phi1 = p1->latitude * degToRad;  // p1's latitude in radians
@@ -128,18 +145,8 @@ static double compBearing(const TrkPt *p1, const TrkPt *p2)
     return fmod((theta / degToRad + 360.0), 360.0); // in degrees decimal (0-359.99)
 }
 
-int computeMinMaxValues(GpsTrk *pTrk)
+void initMinMaxValues(GpsTrk *pTrk)
 {
-    TrkPt *p1;  // previous TrkPt
-    TrkPt *p2;  // current TrkPt
-
-    if ((p1 = TAILQ_FIRST(&pTrk->trkPtList)) == NULL) {
-        // Empty track!
-        return 0;
-    }
-
-    p2 = TAILQ_NEXT(p1, tqEntry);
-
     // Initialize the min/max values
     pTrk->minSpeed = +999.9;
     pTrk->maxSpeed = -999.9;
@@ -160,61 +167,80 @@ int computeMinMaxValues(GpsTrk *pTrk)
     pTrk->elevGain = 0.0;
     pTrk->elevLoss = 0.0;
     pTrk->grade = 0.0;
+}
 
-    while (p2 != NULL) {
-        if (p2->speed > pTrk->maxSpeed) {
-             pTrk->maxSpeed = p2->speed;
-             pTrk->maxSpeedTrkPt = p2;
-        } else if ((p2->speed != nilSpeed) && (p2->speed < pTrk->minSpeed)) {
-            pTrk->minSpeed = p2->speed;
-            pTrk->minSpeedTrkPt = p2;
-        }
+void updMinMaxValues(GpsTrk *pTrk, const TrkPt *p1, TrkPt *p2)
+{
+    if (p2->speed > pTrk->maxSpeed) {
+         pTrk->maxSpeed = p2->speed;
+         pTrk->maxSpeedTrkPt = p2;
+    } else if ((p2->speed != nilSpeed) && (p2->speed < pTrk->minSpeed)) {
+        pTrk->minSpeed = p2->speed;
+        pTrk->minSpeedTrkPt = p2;
+    }
 
-        if (p2->elevation > pTrk->maxElev) {
-             pTrk->maxElev = p2->elevation;
-             pTrk->maxElevTrkPt = p2;
-        } else if (p2->elevation < pTrk->minElev) {
-            pTrk->minElev = p2->elevation;
-            pTrk->minElevTrkPt = p2;
-        }
+    if (p2->elevation > pTrk->maxElev) {
+         pTrk->maxElev = p2->elevation;
+         pTrk->maxElevTrkPt = p2;
+    } else if (p2->elevation < pTrk->minElev) {
+        pTrk->minElev = p2->elevation;
+        pTrk->minElevTrkPt = p2;
+    }
 
-        if (p2->grade > pTrk->maxGrade) {
-             pTrk->maxGrade = p2->grade;
-             pTrk->maxGradeTrkPt = p2;
-        } else if (p2->grade < pTrk->minGrade) {
-            pTrk->minGrade = p2->grade;
-            pTrk->minGradeTrkPt = p2;
-        }
+    if (p2->grade > pTrk->maxGrade) {
+         pTrk->maxGrade = p2->grade;
+         pTrk->maxGradeTrkPt = p2;
+    } else if (p2->grade < pTrk->minGrade) {
+        pTrk->minGrade = p2->grade;
+        pTrk->minGradeTrkPt = p2;
+    }
 
-        // Update the max dist value
-        if (p2->dist > pTrk->maxDeltaD) {
-            pTrk->maxDeltaD = p2->dist;
-            pTrk->maxDeltaDTrkPt = p2;
-        }
+    // Update the max dist value
+    if (p2->dist > pTrk->maxDeltaD) {
+        pTrk->maxDeltaD = p2->dist;
+        pTrk->maxDeltaDTrkPt = p2;
+    }
 
-        // Update the max absolute grade change
-        p2->deltaG = fabs(p2->grade - p1->grade);
-        if (p2->deltaG > pTrk->maxDeltaG) {
-            pTrk->maxDeltaG = p2->deltaG;
-            pTrk->maxDeltaGTrkPt = p2;
-        }
+    // Update the max absolute grade change
+    p2->deltaG = fabs(p2->grade - p1->grade);
+    if (p2->deltaG > pTrk->maxDeltaG) {
+        pTrk->maxDeltaG = p2->deltaG;
+        pTrk->maxDeltaGTrkPt = p2;
+    }
 
-        // Update the max time interval
-        if (p2->deltaT > pTrk->maxDeltaT) {
-            pTrk->maxDeltaT = p2->deltaT;
-            pTrk->maxDeltaTTrkPt = p2;
-        }
+    // Update the max time interval
+    if (p2->deltaT > pTrk->maxDeltaT) {
+        pTrk->maxDeltaT = p2->deltaT;
+        pTrk->maxDeltaTTrkPt = p2;
+    }
 
-        // Update the rolling values of the elevation gain
-        // and grade, to compute the averages for the
-        // activity.
-        if (p2->rise >= 0.0) {
-            pTrk->elevGain += p2->rise;
-        } else {
-            pTrk->elevLoss += fabs(p2->rise);
-        }
-        pTrk->grade += p2->grade;
+    // Update the rolling values of the elevation gain
+    // and grade, to compute the averages for the
+    // activity.
+    if (p2->rise >= 0.0) {
+        pTrk->elevGain += p2->rise;
+    } else {
+        pTrk->elevLoss += fabs(p2->rise);
+    }
+    pTrk->grade += p2->grade;
+}
 
+int computeMinMaxValues(GpsTrk *pTrk)
+{
+    TrkPt *p1;  // previous TrkPt
+    TrkPt *p2;  // current TrkPt
+
+    if ((p1 = TAILQ_FIRST(&pTrk->trkPtList)) == NULL) {
+        // Empty track!
+        return 0;
+    }
+
+    p2 = TAILQ_NEXT(p1, tqEntry);
+
+    initMinMaxValues(pTrk);
+
+    while (p2 != NULL) {
+        updMinMaxValues(pTrk, p1, p2);
         p2 = nxtTrkPt(&p1, p2);
     }
 
@@ -273,6 +299,112 @@ int computeMinMaxValues(GpsTrk *pTrk)
  *
  */
 
+// Compute the metrics of TrkPt 'p2' relative to the previous
+// TrkPt 'p1'. Only the TrkPt itself is updated.
+static void compTrkPtDeltas(const CmdArgs *pArgs, const TrkPt *p1, TrkPt *p2)
+{
+    double absRise; // always positive!
+
+    // Compute the elevation difference (can be negative)
+    p2->rise = p2->elevation - p1->elevation;
+
+    // The "rise" is always positive!
+    absRise = fabs(p2->rise);
+
+    // Compute the incremental distance between points
+    p2->dist = p2->distance - p1->distance;
+
+    // Compute the time interval between the two points.
+    // Typically fixed at 1-sec, but some GPS devices (e.g.
+    // Garmin Edge) may use a "smart" recording mode that
+    // can have several seconds between points, while
+    // other devices (e.g. GoPro Hero) may record multiple
+    // points each second.
+    p2->deltaT = (p2->timestamp - p1->timestamp);
+
+    if (p2->dist != 0.0) {
+        // We are moving!
+        if (p2->dist > absRise) {
+            // Compute the horizontal distance "run" using
+            // Pythagoras's Theorem.
+            p2->run = sqrt((p2->dist * p2->dist) - (absRise * absRise));
+        } else {
+            // Compute the horizontal distance "run" using
+            // the Haversine formula.
+            p2->run = compHaversine(p1, p2);
+        }
+
+        // Compute the grade as "rise over run". Notice
+        // that the grade value may get updated later.
+        // Guard against points with run=0, which can
+        // happen when using the "--verbose" option...
+        if (p2->run != 0.0) {
+            p2->grade = (p2->rise * 100.0) / p2->run;   // in [%]
+        } else {
+            if (!pArgs->quiet) {
+                fprintf(stderr, "WARNING: TrkPt #%d (%s) has a null run value !\n",
+                        p2->index, fmtTrkPtIdx(p2));
+                printTrkPt(p2);
+            }
+            p2->grade = p1->grade;  // carry over the previous grade value
+        }
+
+        // Sanity check the grade value
+        if ((p2->grade < -99.9) || (p2->grade > 99.9)) {
+            if (!pArgs->quiet) {
+                fprintf(stderr, "WARNING: TrkPt #%d (%s) has a bogus grade value !\n",
+                        p2->index, fmtTrkPtIdx(p2));
+                printTrkPt(p2);
+            }
+            if (p1->grade != nilGrade) {
+                p2->grade = p1->grade;  // carry over the previous grade value
+            } else {
+                p2->grade = 0.0;    // anything better to do here?
+            }
+        }
+
+        // Compute the bearing
+        p2->bearing = compBearing(p1, p2);
+
+        // Compute the absolute grade change
+        p2->deltaG = fabs(p2->grade - p1->grade);
+    } else {
+        // We are stopped
+        p2->grade = 0.0;
+    }
+}
+
+int compTrkPtMetrics(GpsTrk *pTrk, const CmdArgs *pArgs, TrkPt *p1, TrkPt *p2)
+{
+    if (p1 == NULL) {
+        // This is the first trackpoint in the track,
+        // which is used as the baseline...
+        p2->distance = 0.0;
+        p2->grade = 0.0;
+
+        // Set the activity's start time
+        pTrk->startTime = p2->timestamp;
+        pTrk->time = 0.0;
+
+        return 0;
+    }
+
+    compTrkPtDeltas(pArgs, p1, p2);
+
+    // Update the total time for the activity
+    pTrk->time += p2->deltaT;
+
+    if (p2->dist != 0.0) {
+        // Update the total distance for the activity
+        pTrk->distance = p2->distance;
+    }
+
+    // Update the activity's end time
+    pTrk->endTime = p2->timestamp;
+
+    return 0;
+}
+
 int compMetrics(GpsTrk *pTrk, const CmdArgs *pArgs)
 {
     TrkPt *p1;  // previous TrkPt
@@ -290,99 +422,330 @@ int compMetrics(GpsTrk *pTrk, const CmdArgs *pArgs)
 
     // At this point p1 points to the first trackpoint in the
     // track, which is used as the baseline...
-    p1->distance = 0.0;
-    p1->grade = 0.0;
-
-    // Set the activity's start time
-    pTrk->startTime = p1->timestamp;
+    compTrkPtMetrics(pTrk, pArgs, NULL, p1);
 
     while (p2 != NULL) {
-        double absRise; // always positive!
+        compTrkPtMetrics(pTrk, pArgs, p1, p2);
+        p2 = nxtTrkPt(&p1, p2);
+    }
 
-        // Compute the elevation difference (can be negative)
-        p2->rise = p2->elevation - p1->elevation;
+    // Compute the activity's min/max values
+    computeMinMaxValues(pTrk);
 
-        // The "rise" is always positive!
-        absRise = fabs(p2->rise);
+    // Nothing is stale now
+    pTrk->dirty = false;
 
-        // Compute the incremental distance between points
-        p2->dist = p2->distance - p1->distance;
+    return 0;
+}
 
-        // Compute the time interval between the two points.
-        // Typically fixed at 1-sec, but some GPS devices (e.g.
-        // Garmin Edge) may use a "smart" recording mode that
-        // can have several seconds between points, while
-        // other devices (e.g. GoPro Hero) may record multiple
-        // points each second.
-        p2->deltaT = (p2->timestamp - p1->timestamp);
+// Mark the TrkPt's in the specified range as modified by an
+// edit operation on the specified metric. The ranges of the
+// edits made before the next call to updDirtyMetrics() are
+// merged together.
+void setDirtyRange(GpsTrk *pTrk, ActMetric actMetric, int from, int to)
+{
+    if (!pTrk->dirty) {
+        pTrk->dirty = true;
+        pTrk->dirtyElev = false;
+        pTrk->dirtyGrade = false;
+        pTrk->dirtyRange.from = from;
+        pTrk->dirtyRange.to = to;
+    } else {
+        if (from < pTrk->dirtyRange.from)
+            pTrk->dirtyRange.from = from;
+        if (to > pTrk->dirtyRange.to)
+            pTrk->dirtyRange.to = to;
+    }
 
-        // Update the total time for the activity
-        pTrk->time += p2->deltaT;
+    if (actMetric == elevation) {
+        pTrk->dirtyElev = true;
+    } else if (actMetric == grade) {
+        pTrk->dirtyGrade = true;
+    }
+}
 
-        if (p2->dist != 0.0) {
-            // We are moving!
-            if (p2->dist > absRise) {
-                // Compute the horizontal distance "run" using
-                // Pythagoras's Theorem.
-                p2->run = sqrt((p2->dist * p2->dist) - (absRise * absRise));
-            } else {
-                // Compute the horizontal distance "run" using
-                // the Haversine formula.
-                p2->run = compHaversine(p1, p2);
-            }
+// Returns true if the TrkPt 'p' held one of the min/max
+// values, and its new value is not as extreme as before.
+static Bool lostMinMaxValue(const GpsTrk *pTrk, const TrkPt *p)
+{
+    return (((p == pTrk->maxElevTrkPt) && (p->elevation < pTrk->maxElev)) ||
+            ((p == pTrk->minElevTrkPt) && (p->elevation > pTrk->minElev)) ||
+            ((p == pTrk->maxGradeTrkPt) && (p->grade < pTrk->maxGrade)) ||
+            ((p == pTrk->minGradeTrkPt) && (p->grade > pTrk->minGrade)) ||
+            ((p == pTrk->maxSpeedTrkPt) && (p->speed < pTrk->maxSpeed)) ||
+            ((p == pTrk->minSpeedTrkPt) && (p->speed > pTrk->minSpeed)) ||
+            ((p == pTrk->maxDeltaGTrkPt) && (p->deltaG < pTrk->maxDeltaG)));
+}
 
-            // Compute the grade as "rise over run". Notice
-            // that the grade value may get updated later.
-            // Guard against points with run=0, which can
-            // happen when using the "--verbose" option...
-            if (p2->run != 0.0) {
-                p2->grade = (p2->rise * 100.0) / p2->run;   // in [%]
-            } else {
-                if (!pArgs->quiet) {
-                    fprintf(stderr, "WARNING: TrkPt #%d (%s) has a null run value !\n",
-                            p2->index, fmtTrkPtIdx(p2));
-                    printTrkPt(p2);
-                }
-                p2->grade = p1->grade;  // carry over the previous grade value
+// Recompute the metrics of the TrkPt's in the dirty range,
+// plus the one that follows it, as its metrics depend on the
+// last TrkPt in the range, and the grade change of the one
+// after that. The aggregate values are updated
+// by backing out the old contribution of each TrkPt and then
+// adding the new one, so the cost is proportional to the size
+// of the range. Only when a TrkPt that held a min/max value
+// loses it is it necessary to rescan the whole track.
+int updDirtyMetrics(GpsTrk *pTrk, const CmdArgs *pArgs)
+{
+    TrkPt *p1;  // previous TrkPt
+    TrkPt *p2;  // current TrkPt
+    Bool rescan = false;
+
+    if (!pTrk->dirty) {
+        return 0;
+    }
+
+    pTrk->dirty = false;
+
+    // Find the first TrkPt in the range
+    TAILQ_FOREACH(p2, &pTrk->trkPtList, tqEntry) {
+        if (p2->index >= pTrk->dirtyRange.from)
+            break;
+    }
+
+    if (p2 == NULL) {
+        return 0;
+    }
+
+    p1 = TAILQ_PREV(p2, TrkPtList, tqEntry);
+
+    // The first TrkPt in the track is the baseline, and it
+    // doesn't contribute to the aggregate values.
+    if (p1 == NULL) {
+        p2 = nxtTrkPt(&p1, p2);
+    }
+
+    while (p2 != NULL) {
+        Bool last = (p2->index > pTrk->dirtyRange.to);
+
+        // Back out the old values
+        if (p2->rise >= 0.0) {
+            pTrk->elevGain -= p2->rise;
+        } else {
+            pTrk->elevLoss -= fabs(p2->rise);
+        }
+        pTrk->grade -= p2->grade;
+
+        if (pTrk->dirtyElev) {
+            double grade = p2->grade;
+
+            // The rise, run, grade, etc. need to be
+            // recomputed.
+            compTrkPtDeltas(pArgs, p1, p2);
+
+            // Unless the grade values were modified
+            // along with the elevation values.
+            if (pTrk->dirtyGrade && !last) {
+                p2->grade = grade;
             }
+        }
+        p2->deltaG = fabs(p2->grade - p1->grade);
 
-            // Sanity check the grade value
-            if ((p2->grade < -99.9) || (p2->grade > 99.9)) {
-                if (!pArgs->quiet) {
-                    fprintf(stderr, "WARNING: TrkPt #%d (%s) has a bogus grade value !\n",
-                            p2->index, fmtTrkPtIdx(p2));
-                    printTrkPt(p2);
-                }
-                if (p1->grade != nilGrade) {
-                    p2->grade = p1->grade;  // carry over the previous grade value
-                } else {
-                    p2->grade = 0.0;    // anything better to do here?
+        if (lostMinMaxValue(pTrk, p2)) {
+            rescan = true;
+        }
+
+        // Add in the new values
+        updMinMaxValues(pTrk, p1, p2);
+
+        if (last) {
+            // The grade change of the TrkPt that follows is
+            // relative to this one's grade, which may have
+            // changed.
+            TrkPt *p3 = TAILQ_NEXT(p2, tqEntry);
+
+            if (p3 != NULL) {
+                p3->deltaG = fabs(p3->grade - p2->grade);
+                if (lostMinMaxValue(pTrk, p3)) {
+                    rescan = true;
+                } else if (p3->deltaG > pTrk->maxDeltaG) {
+                    pTrk->maxDeltaG = p3->deltaG;
+                    pTrk->maxDeltaGTrkPt = p3;
                 }
             }
+            break;
+        }
+
+        p2 = nxtTrkPt(&p1, p2);
+    }
 
-            // Compute the bearing
-            p2->bearing = compBearing(p1, p2);
+    if (rescan) {
+        // Can't tell which is the new min/max value
+        // without looking at all the TrkPt's
+        computeMinMaxValues(pTrk);
+    }
 
-            // Compute the absolute grade change
-            p2->deltaG = fabs(p2->grade - p1->grade);
+    return 0;
+}
 
-            // Update the total distance for the activity
-            pTrk->distance = p2->distance;
+static double clampVal(double val, double minVal, double maxVal)
+{
+    return (val < minVal) ? minVal : ((val > maxVal) ? maxVal : val);
+}
+
+// Adjust the elevation values of the TrkPt's in the specified
+// range, so that the grade stays within [minGrade, maxGrade]
+// and the absolute grade change between consecutive TrkPt's
+// doesn't exceed maxDeltaG (all in %), including the changes
+// at both ends of the range.
+//
+// Some grades can't change: the one of the TrkPt before the
+// range (entry), the one of the TrkPt after it (exit), whose
+// rise is kept by shifting all the TrkPt's after the range,
+// and those of the TrkPt's where we are stopped, which are
+// always 0. Propagating these fixed values by maxDeltaG per
+// TrkPt gives the lower and upper bounds that each grade must
+// stay within for the limits to be met everywhere.
+//
+// The grade sequence is then run through a slew-rate limiter
+// within those bounds, once forward and once backward, and the
+// two results are averaged to avoid shifting the grade profile
+// in either direction. Each pass meets all the constraints,
+// and since they define a convex set, so does their average.
+// The elevations are then rebuilt from the new grades.
+int limitGrade(GpsTrk *pTrk, const CmdArgs *pArgs, double minGrade, double maxGrade, double maxDeltaG)
+{
+    TrkPt **pts, **adj;
+    TrkPt *pBase, *pExit, *p;
+    double *lo, *hi, *gf, *gb;
+    double g, offset, elevation;
+    int numPts = 0;
+    int s = 0;
+
+    if ((pts = malloc(pTrk->numTrkPts * sizeof (TrkPt *))) == NULL) {
+        fprintf(stderr, "Failed to alloc TrkPt array !!!\n");
+        return -1;
+    }
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((p->index >= pArgs->range.from) && (p->index <= pArgs->range.to) &&
+            (numPts < pTrk->numTrkPts)) {
+            pts[numPts++] = p;
+        }
+    }
+
+    if (numPts == 0) {
+        free(pts);
+        saveTrkPts(pTrk);
+        return 0;
+    }
+
+    // The grade of the first TrkPt in the range can only be
+    // changed if there is a TrkPt before it; otherwise it's
+    // the baseline of the track.
+    pExit = TAILQ_NEXT(pts[numPts - 1], tqEntry);
+    if ((pBase = TAILQ_PREV(pts[0], TrkPtList, tqEntry)) == NULL) {
+        pBase = pts[0];
+        adj = &pts[1];
+        numPts--;
+    } else {
+        adj = &pts[0];
+    }
+
+    if (numPts == 0) {
+        free(pts);
+        saveTrkPts(pTrk);
+        return 0;
+    }
+
+    lo = malloc(numPts * sizeof (double));
+    hi = malloc(numPts * sizeof (double));
+    gf = malloc(numPts * sizeof (double));
+    gb = malloc(numPts * sizeof (double));
+    if ((lo == NULL) || (hi == NULL) || (gf == NULL) || (gb == NULL)) {
+        fprintf(stderr, "Failed to alloc grade arrays !!!\n");
+        s = -1;
+        goto done;
+    }
+
+    // Get the bounds of each grade, going forward from the
+    // entry grade, and then backward from the exit grade.
+    for (int i = 0; i < numPts; i++) {
+        double prevLo = (i == 0) ? clampVal(pBase->grade, minGrade, maxGrade) : lo[i - 1];
+        double prevHi = (i == 0) ? clampVal(pBase->grade, minGrade, maxGrade) : hi[i - 1];
+
+        if (adj[i]->dist == 0.0) {
+            lo[i] = hi[i] = 0.0;
         } else {
-            // We are stopped
-            p2->grade = 0.0;
+            lo[i] = minGrade;
+            hi[i] = maxGrade;
+        }
+        lo[i] = fmax(lo[i], prevLo - maxDeltaG);
+        hi[i] = fmin(hi[i], prevHi + maxDeltaG);
+    }
+    for (int i = (numPts - 1); i >= 0; i--) {
+        if (i < (numPts - 1)) {
+            lo[i] = fmax(lo[i], lo[i + 1] - maxDeltaG);
+            hi[i] = fmin(hi[i], hi[i + 1] + maxDeltaG);
+        } else if (pExit != NULL) {
+            double exit = clampVal(pExit->grade, minGrade, maxGrade);
+            lo[i] = fmax(lo[i], exit - maxDeltaG);
+            hi[i] = fmin(hi[i], exit + maxDeltaG);
+        }
+        if (lo[i] > (hi[i] + 1.0e-9)) {
+            fprintf(stderr, "The grade change can't be limited to %.2lf%% around TrkPt #%d !\n",
+                    maxDeltaG, adj[i]->index);
+            s = -1;
+            goto done;
         }
+    }
 
-        // Update the activity's end time
-        pTrk->endTime = p2->timestamp;
+    // Forward pass
+    g = clampVal(pBase->grade, minGrade, maxGrade);
+    for (int i = 0; i < numPts; i++) {
+        g = gf[i] = clampVal(adj[i]->grade, fmax(lo[i], g - maxDeltaG), fmin(hi[i], g + maxDeltaG));
+    }
 
-        p2 = nxtTrkPt(&p1, p2);
+    // Backward pass
+    g = (pExit != NULL) ? clampVal(pExit->grade, minGrade, maxGrade) : adj[numPts - 1]->grade;
+    for (int i = (numPts - 1); i >= 0; i--) {
+        if ((i == (numPts - 1)) && (pExit == NULL)) {
+            g = gb[i] = clampVal(g, lo[i], hi[i]);
+        } else {
+            g = gb[i] = clampVal(adj[i]->grade, fmax(lo[i], g - maxDeltaG), fmin(hi[i], g + maxDeltaG));
+        }
     }
 
-    // Compute the activity's min/max values
-    computeMinMaxValues(pTrk);
+    // Save current TrkPt's so that this operation
+    // can be 'undo'
+    saveTrkPts(pTrk);
 
-    return 0;
+    // Rebuild the elevations. Given the grade 'g' and the
+    // distance 'dist', the rise is such that rise/run=g and
+    // run^2 + rise^2 = dist^2.
+    elevation = pBase->elevation;
+    offset = 0.0;
+    for (int i = 0; i < numPts; i++) {
+        TrkPt *p2 = adj[i];
+        double rise = p2->rise;     // keep the rise while stopped
+
+        if (p2->dist != 0.0) {
+            g = ((gf[i] + gb[i]) / 2.0) / 100.0;
+            rise = (g * p2->dist) / sqrt(1.0 + (g * g));
+        }
+
+        elevation += rise;
+        offset = elevation - p2->elevation;
+        if (fabs(offset) >= 0.001) {
+            pTrk->numElevAdj++;
+        }
+        p2->elevation = elevation;
+    }
+
+    // Shift the elevation of the TrkPt's after the range
+    if (offset != 0.0) {
+        for (p = pExit; p != NULL; p = TAILQ_NEXT(p, tqEntry)) {
+            p->elevation += offset;
+        }
+    }
+
+done:
+    free(pts);
+    free(lo);
+    free(hi);
+    free(gf);
+    free(gb);
+
+    return s;
 }
 
 static double metricGetValue(const TrkPt *p, ActMetric smaMetric)
@@ -407,66 +770,656 @@ static void metricSetValue(TrkPt *p, ActMetric smaMetric, double value)
     }
 }
 
-// Compute the Centered Moving Average of the specified metric
+// Values of the metrics being filtered, laid out in columns,
+// for the TrkPt's in the range plus up to 'halo' TrkPt's on
+// either side of it. This way a filter can work on several
+// metrics while traversing the list of TrkPt's just twice:
+// once to gather the values, and once to scatter them back.
+typedef struct MetricCols {
+    int numMetrics;
+    ActMetric metric[MAX_ACT_METRICS];
+    int numPts;                     // total number of TrkPt's
+    int first;                      // first TrkPt in the range
+    int last;                       // last TrkPt in the range
+    TrkPt **pts;
+    double *col[MAX_ACT_METRICS];   // one column per metric
+    double *buf;
+} MetricCols;
+
+static void freeMetricCols(MetricCols *pMc)
+{
+    free(pMc->pts);
+    free(pMc->buf);
+}
+
+static int gatherMetricCols(GpsTrk *pTrk, const CmdArgs *pArgs, int halo, MetricCols *pMc)
+{
+    int maxPts = pTrk->numTrkPts + (2 * halo);
+    TrkPt *p;
+    int n;
+
+    memset(pMc, 0, sizeof (*pMc));
+
+    // Use the list of metrics, if any, or else the
+    // single metric.
+    if (pArgs->numActMetrics != 0) {
+        pMc->numMetrics = pArgs->numActMetrics;
+        memcpy(pMc->metric, pArgs->actMetrics, sizeof (pMc->metric));
+    } else {
+        pMc->numMetrics = 1;
+        pMc->metric[0] = pArgs->actMetric;
+    }
+
+    pMc->pts = malloc(maxPts * sizeof (TrkPt *));
+    pMc->buf = malloc(pMc->numMetrics * maxPts * sizeof (double));
+    if ((pMc->pts == NULL) || (pMc->buf == NULL)) {
+        fprintf(stderr, "Failed to alloc MetricCols object !!!\n");
+        freeMetricCols(pMc);
+        return -1;
+    }
+    for (int m = 0; m < pMc->numMetrics; m++) {
+        pMc->col[m] = &pMc->buf[m * maxPts];
+    }
+
+    // Find the first TrkPt in the range
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((p->index >= pArgs->range.from) && (p->index <= pArgs->range.to))
+            break;
+    }
+
+    if (p == NULL) {
+        // Empty range
+        pMc->first = 0;
+        pMc->last = -1;
+        return 0;
+    }
+
+    // Back up over the halo
+    for (n = 0; (n < halo) && (TAILQ_PREV(p, TrkPtList, tqEntry) != NULL); n++) {
+        p = TAILQ_PREV(p, TrkPtList, tqEntry);
+    }
+    pMc->first = n;
+    pMc->last = -1;
+
+    // Gather the values of all the metrics
+    for (n = 0; (p != NULL) && (n < maxPts); p = TAILQ_NEXT(p, tqEntry)) {
+        if (p->index > pArgs->range.to) {
+            // Past the range: just the halo left
+            if ((n - pMc->last - 1) == halo)
+                break;
+        } else if (n >= pMc->first) {
+            pMc->last = n;
+        }
+        pMc->pts[n] = p;
+        for (int m = 0; m < pMc->numMetrics; m++) {
+            pMc->col[m][n] = metricGetValue(p, pMc->metric[m]);
+        }
+        n++;
+    }
+    pMc->numPts = n;
+
+    return 0;
+}
+
+// Store the values back into the TrkPt's in the range
+static void scatterMetricCols(MetricCols *pMc)
+{
+    for (int n = pMc->first; n <= pMc->last; n++) {
+        for (int m = 0; m < pMc->numMetrics; m++) {
+            metricSetValue(pMc->pts[n], pMc->metric[m], pMc->col[m][n]);
+        }
+    }
+}
+
+// Number of TrkPt's in each of the blocks the range is split
+// into for filtering. Each block reads the values around it
+// (its halo) from the shared columns, and writes its output
+// to a separate column, so the blocks are independent of
+// each other, and can be filtered in parallel.
+#define FILTER_BLOCK_SIZE   8192
+
+struct FilterJob;
+
+// Filter the values x[from..to] into y[from..to]
+typedef int (*FilterFunc)(const struct FilterJob *pJob, const double *x, double *y, int from, int to);
+
+typedef struct FilterJob {
+    const MetricCols *pMc;
+    FilterFunc func;
+    int window;                     // filter window size
+    int numBlocks;                  // number of blocks per metric
+    double *out[MAX_ACT_METRICS];   // filtered values
+    double *buf;
+    int *status;                    // status of each work item
+} FilterJob;
+
+static void filterWorker(void *arg, int item)
+{
+    FilterJob *pJob = arg;
+    const MetricCols *pMc = pJob->pMc;
+    int m = item / pJob->numBlocks;
+    int from = pMc->first + ((item % pJob->numBlocks) * FILTER_BLOCK_SIZE);
+    int to = ((from + FILTER_BLOCK_SIZE - 1) < pMc->last) ? (from + FILTER_BLOCK_SIZE - 1) : pMc->last;
+
+    pJob->status[item] = pJob->func(pJob, pMc->col[m], pJob->out[m], from, to);
+}
+
+// Run the filter over the range of each metric, splitting the
+// work into (metric, block) items that are handed out to a
+// pool of threads. The filtered values replace the original
+// ones in the columns.
+static int runFilterJob(MetricCols *pMc, FilterFunc func, int window)
+{
+    int numPts = pMc->last - pMc->first + 1;
+    int numItems;
+    int s = 0;
+    FilterJob job = {
+        .pMc = pMc,
+        .func = func,
+        .window = window,
+        .numBlocks = (numPts + FILTER_BLOCK_SIZE - 1) / FILTER_BLOCK_SIZE
+    };
+
+    if (numPts <= 0) {
+        return 0;
+    }
+
+    numItems = pMc->numMetrics * job.numBlocks;
+    job.buf = malloc(pMc->numMetrics * pMc->numPts * sizeof (double));
+    job.status = malloc(numItems * sizeof (int));
+    if ((job.buf == NULL) || (job.status == NULL)) {
+        fprintf(stderr, "Failed to alloc FilterJob buffers !!!\n");
+        free(job.buf);
+        free(job.status);
+        return -1;
+    }
+    for (int m = 0; m < pMc->numMetrics; m++) {
+        job.out[m] = &job.buf[m * pMc->numPts];
+    }
+
+    poolRun(numItems, filterWorker, &job);
+
+    for (int n = 0; n < numItems; n++) {
+        if (job.status[n] != 0) {
+            s = job.status[n];
+        }
+    }
+
+    if (s == 0) {
+        for (int m = 0; m < pMc->numMetrics; m++) {
+            memcpy(&pMc->col[m][pMc->first], &job.out[m][pMc->first], numPts * sizeof (double));
+        }
+    }
+
+    free(job.buf);
+    free(job.status);
+
+    return s;
+}
+
+static int cmaFilter(const FilterJob *pJob, const double *x, double *y, int from, int to)
+{
+    int n = (pJob->window - 1) / 2;    // number of points to the L/R of the given point
+    int numPts = pJob->pMc->numPts;
+
+    for (int i = from; i <= to; i++) {
+        int j1 = ((i - n) > 0) ? (i - n) : 0;
+        int j2 = ((i + n) < numPts) ? (i + n) : (numPts - 1);
+
+        y[i] = 0.0;
+        for (int j = j1; j <= j2; j++) {
+            y[i] += x[j];
+        }
+        y[i] = y[i] / (double) (j2 - j1 + 1);
+    }
+
+    return 0;
+}
+
+// Compute the Centered Moving Average of the specified metric(s)
 int compCMA(GpsTrk *pTrk, const CmdArgs *pArgs)
 {
-    ActMetric actMetric = pArgs->actMetric;
     int n = (pArgs->smaWindow - 1) / 2;    // number of points to the L/R of the given point
+    MetricCols mc;
+    int s;
+
+    if (gatherMetricCols(pTrk, pArgs, n, &mc) != 0) {
+        return -1;
+    }
+
+    if ((s = runFilterJob(&mc, cmaFilter, pArgs->smaWindow)) == 0) {
+        scatterMetricCols(&mc);
+    }
+
+    freeMetricCols(&mc);
+
+    return s;
+}
+
+// Compute the Exponential Moving Average of the specified
+// metric, with a smoothing factor equivalent to an SMA of
+// the specified window size.
+int compEMA(GpsTrk *pTrk, const CmdArgs *pArgs)
+{
+    ActMetric actMetric = pArgs->actMetric;
+    double alpha = 2.0 / (pArgs->smaWindow + 1);
+    Bool first = true;
+    double ema = 0.0;
     TrkPt *p;
 
     TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
         int index = p->index;
 
         if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
-            int i, numPts;
-            TrkPt *tp;
-
-            p->adjVal = 0.0;
-            numPts = 0;
+            double value = metricGetValue(p, actMetric);
 
-            // Points before the given point
-            for (i = 0, tp = TAILQ_PREV(p, TrkPtList, tqEntry); (i < n) && (tp != NULL); i++, tp = TAILQ_PREV(tp, TrkPtList, tqEntry)) {
-                p->adjVal += metricGetValue(tp, actMetric);
-                numPts++;
+            // Start from the first value, rather than
+            // ramping up from zero.
+            if (first) {
+                ema = value;
+                first = false;
+            } else {
+                ema += alpha * (value - ema);
             }
+            metricSetValue(p, actMetric, ema);
+        }
+    }
+
+    return 0;
+}
+
+// Biquad (2nd order IIR) filter section, in Direct Form II
+// Transposed.
+typedef struct Biquad {
+    double b0, b1, b2;  // feed-forward coefficients
+    double a1, a2;      // feedback coefficients (a0=1)
+    double z1, z2;      // state
+} Biquad;
+
+// Low-pass biquad, from the "Audio EQ Cookbook" by Robert
+// Bristow-Johnson. 'fc' is the cutoff frequency, in cycles
+// per sample.
+static void biquadLowpass(Biquad *pBq, double fc, double q)
+{
+    double w0 = 2.0 * M_PI * fc;
+    double cosW0 = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+
+    pBq->b0 = ((1.0 - cosW0) / 2.0) / a0;
+    pBq->b1 = (1.0 - cosW0) / a0;
+    pBq->b2 = pBq->b0;
+    pBq->a1 = (-2.0 * cosW0) / a0;
+    pBq->a2 = (1.0 - alpha) / a0;
+}
 
-            // The given point
-            p->adjVal += metricGetValue(p, actMetric);
+// Set the state as if the input had been stuck at 'x' forever,
+// so that the filter doesn't have to ramp up from zero. The
+// DC gain of a low-pass section is 1, so the output is 'x' too.
+static void biquadReset(Biquad *pBq, double x)
+{
+    pBq->z2 = (pBq->b2 - pBq->a2) * x;
+    pBq->z1 = (pBq->b1 - pBq->a1) * x + pBq->z2;
+}
+
+static void biquadRun(Biquad *pBq, double *x, int n, int step)
+{
+    for (int i = 0; i < n; i++, x += step) {
+        double in = *x;
+        double out = (pBq->b0 * in) + pBq->z1;
+        pBq->z1 = (pBq->b1 * in) - (pBq->a1 * out) + pBq->z2;
+        pBq->z2 = (pBq->b2 * in) - (pBq->a2 * out);
+        *x = out;
+    }
+}
+
+// The 4th order Butterworth filter is built as a cascade of
+// two biquads with these Q values.
+static const double butterQ[] = { 0.54119610, 1.30656296 };
+#define NUM_BIQUADS (sizeof (butterQ) / sizeof (butterQ[0]))
+
+// Smooth the specified metric using a zero-phase low-pass
+// Butterworth filter, whose cutoff period is 'smaWindow'
+// TrkPt's. The data is filtered forward and then backward,
+// which cancels out the phase shift of the filter (and the
+// lag it would cause), like MATLAB's filtfilt(). The cost is
+// O(N) regardless of the cutoff.
+int compLowpass(GpsTrk *pTrk, const CmdArgs *pArgs)
+{
+    ActMetric actMetric = pArgs->actMetric;
+    double fc = 1.0 / (double) pArgs->smaWindow;
+    Biquad bq[NUM_BIQUADS];
+    double *buf, *x;
+    int numPts = 0;
+    int padLen;
+    TrkPt *p;
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((p->index >= pArgs->range.from) && (p->index <= pArgs->range.to)) {
             numPts++;
+        }
+    }
 
-            // Points after the given point
-            for (i = 0, tp = TAILQ_NEXT(p, tqEntry); (i < n) && (tp != NULL); i++, tp = TAILQ_NEXT(tp, tqEntry)) {
-                p->adjVal += metricGetValue(tp, actMetric);
-                numPts++;
-            }
+    if (numPts < 2) {
+        return 0;
+    }
+
+    // To reduce the transients at the edges, the data is padded
+    // at both ends with a point reflection of itself, as long
+    // as 3 cutoff periods.
+    padLen = 3 * pArgs->smaWindow;
+    if (padLen > (numPts - 1))
+        padLen = numPts - 1;
 
-            p->adjVal = p->adjVal / (double) numPts++;
+    if ((buf = malloc((numPts + (2 * padLen)) * sizeof (double))) == NULL) {
+        fprintf(stderr, "Failed to alloc low-pass filter buffer !!!\n");
+        return -1;
+    }
+    x = &buf[padLen];
+
+    numPts = 0;
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((p->index >= pArgs->range.from) && (p->index <= pArgs->range.to)) {
+            x[numPts++] = metricGetValue(p, actMetric);
         }
     }
 
+    for (int i = 1; i <= padLen; i++) {
+        x[-i] = (2.0 * x[0]) - x[i];
+        x[numPts - 1 + i] = (2.0 * x[numPts - 1]) - x[numPts - 1 - i];
+    }
+
+    for (int n = 0; n < NUM_BIQUADS; n++) {
+        biquadLowpass(&bq[n], fc, butterQ[n]);
+    }
+
+    // Forward pass
+    for (int n = 0; n < NUM_BIQUADS; n++) {
+        biquadReset(&bq[n], buf[0]);
+        biquadRun(&bq[n], buf, numPts + (2 * padLen), +1);
+    }
+
+    // Backward pass
+    for (int n = 0; n < NUM_BIQUADS; n++) {
+        biquadReset(&bq[n], buf[numPts + (2 * padLen) - 1]);
+        biquadRun(&bq[n], &buf[numPts + (2 * padLen) - 1], numPts + (2 * padLen), -1);
+    }
+
+    numPts = 0;
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((p->index >= pArgs->range.from) && (p->index <= pArgs->range.to)) {
+            metricSetValue(p, actMetric, x[numPts++]);
+        }
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+// Sliding-window order statistics. The values are ranked up
+// front, and a Fenwick tree keeps the count of the values of
+// each rank currently in the window, so that adding/removing
+// a value, and finding the k-th smallest one, take O(log N).
+typedef struct OrdStat {
+    int size;           // number of values
+    int log2Size;       // largest power of 2 <= size
+    const double *val;  // values
+    double *sortedVal;  // values sorted by rank
+    int *rank;          // rank of each value (1..size)
+    int *tree;          // Fenwick tree of counts
+} OrdStat;
+
+static const double *ordStatVal;
+
+static int ordStatCmp(const void *a, const void *b)
+{
+    int i1 = *(const int *) a;
+    int i2 = *(const int *) b;
+
+    if (ordStatVal[i1] != ordStatVal[i2])
+        return (ordStatVal[i1] < ordStatVal[i2]) ? -1 : 1;
+
+    return (i1 - i2);
+}
+
+static void ordStatFree(OrdStat *pOs)
+{
+    free(pOs->sortedVal);
+    free(pOs->rank);
+    free(pOs->tree);
+}
+
+static int ordStatInit(OrdStat *pOs, const double *val, int size)
+{
+    int *order;
+
+    pOs->size = size;
+    pOs->val = val;
+    pOs->sortedVal = malloc(size * sizeof (double));
+    pOs->rank = malloc(size * sizeof (int));
+    pOs->tree = calloc(size + 1, sizeof (int));
+    order = malloc(size * sizeof (int));
+    if ((pOs->sortedVal == NULL) || (pOs->rank == NULL) || (pOs->tree == NULL) || (order == NULL)) {
+        fprintf(stderr, "Failed to alloc OrdStat object !!!\n");
+        ordStatFree(pOs);
+        free(order);
+        return -1;
+    }
+
+    for (int i = 0; i < size; i++) {
+        order[i] = i;
+    }
+    ordStatVal = val;
+    qsort(order, size, sizeof (int), ordStatCmp);
+    for (int r = 0; r < size; r++) {
+        pOs->rank[order[r]] = r + 1;
+        pOs->sortedVal[r] = val[order[r]];
+    }
+    free(order);
+
+    for (pOs->log2Size = 1; (pOs->log2Size * 2) <= size; pOs->log2Size *= 2)
+        ;
+
+    return 0;
+}
+
+// Add (inc=+1) or remove (inc=-1) the i-th value to/from the window
+static void ordStatUpd(OrdStat *pOs, int i, int inc)
+{
+    for (int r = pOs->rank[i]; r <= pOs->size; r += (r & -r)) {
+        pOs->tree[r] += inc;
+    }
+}
+
+// Get the k-th smallest value in the window (k=1..N)
+static double ordStatKth(const OrdStat *pOs, int k)
+{
+    int r = 0;
+
+    for (int step = pOs->log2Size; step != 0; step /= 2) {
+        if (((r + step) <= pOs->size) && (pOs->tree[r + step] < k)) {
+            r += step;
+            k -= pOs->tree[r];
+        }
+    }
+
+    return pOs->sortedVal[r];   // rank r+1
+}
+
+// Get the median of the 'n' values in the window
+static double ordStatMedian(const OrdStat *pOs, int n)
+{
+    if (n & 1) {
+        return ordStatKth(pOs, (n + 1) / 2);
+    }
+
+    return (ordStatKth(pOs, n / 2) + ordStatKth(pOs, (n / 2) + 1)) / 2.0;
+}
+
+// Get the k-th smallest absolute deviation from the median
+// 'med' of the 'n' values in the window. The deviations of
+// the 's' values at or below the median, and of the ones
+// above it, form two sorted sequences, so the k-th smallest
+// deviation can be found with a binary search over them.
+static double ordStatKthDev(const OrdStat *pOs, int n, int s, double med, int k)
+{
+    int t = n - s;
+    int lo = (k > t) ? (k - t) : 0;
+    int hi = (k < s) ? k : s;
+    double dev = 0.0;
+
+    // Number of deviations taken from the lower side
+    while (lo < hi) {
+        int i = (lo + hi) / 2;
+        double a = med - ordStatKth(pOs, s - i);        // lower side, (i+1)-th deviation
+        double b = ordStatKth(pOs, s + (k - i)) - med;  // upper side, (k-i)-th deviation
+        if (a < b)
+            lo = i + 1;
+        else
+            hi = i;
+    }
+
+    if (lo > 0)
+        dev = med - ordStatKth(pOs, s + 1 - lo);
+    if ((k - lo) > 0)
+        dev = fmax(dev, ordStatKth(pOs, s + (k - lo)) - med);
+
+    return dev;
+}
+
+// Get the Median Absolute Deviation of the 'n' values in the
+// window, given their median 'med'.
+static double ordStatMad(const OrdStat *pOs, int n, double med)
+{
+    int s = (n + 1) / 2;    // number of values at or below the median
+
+    if (n & 1) {
+        return ordStatKthDev(pOs, n, s, med, (n + 1) / 2);
+    }
+
+    return (ordStatKthDev(pOs, n, s, med, n / 2) + ordStatKthDev(pOs, n, s, med, (n / 2) + 1)) / 2.0;
+}
+
+// Number of scaled MAD's a value has to deviate from the
+// median to be considered an outlier by the Hampel filter.
+#define HAMPEL_NUM_SIGMAS   3.0
+
+// The MAD is scaled to make it a consistent estimator of the
+// standard deviation of normally distributed data.
+#define HAMPEL_MAD_SCALE    1.4826
+
+// Run a sliding median filter (or a Hampel filter, when
+// 'hampel' is true) over the specified metric.
+static int compMedianFilter(GpsTrk *pTrk, const CmdArgs *pArgs, Bool hampel)
+{
+    ActMetric actMetric = pArgs->actMetric;
+    int n = (pArgs->smaWindow - 1) / 2;    // number of points to the L/R of the given point
+    double *x, *y;
+    int numPts = 0;
+    OrdStat os;
+    TrkPt *p;
+
+    x = malloc(pTrk->numTrkPts * sizeof (double));
+    y = malloc(pTrk->numTrkPts * sizeof (double));
+    if ((x == NULL) || (y == NULL)) {
+        fprintf(stderr, "Failed to alloc median filter buffers !!!\n");
+        free(x);
+        free(y);
+        return -1;
+    }
+
     TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
         int index = p->index;
 
-        if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
-            metricSetValue(p, actMetric, p->adjVal);
+        if ((index >= pArgs->range.from) && (index <= pArgs->range.to) &&
+            (numPts < pTrk->numTrkPts)) {
+            x[numPts++] = metricGetValue(p, actMetric);
         }
     }
 
+    if (numPts == 0) {
+        free(x);
+        free(y);
+        return 0;
+    }
+
+    if (ordStatInit(&os, x, numPts) != 0) {
+        free(x);
+        free(y);
+        return -1;
+    }
+
+    // Slide the window [i-n, i+n] along the values; it
+    // shrinks at both ends.
+    for (int i = 0; (i < n) && (i < numPts); i++) {
+        ordStatUpd(&os, i, +1);
+    }
+    for (int i = 0; i < numPts; i++) {
+        int first = (i > n) ? (i - n) : 0;
+        int last = ((i + n) < numPts) ? (i + n) : (numPts - 1);
+        int num = last - first + 1;
+        double med;
+
+        if ((i + n) < numPts)
+            ordStatUpd(&os, i + n, +1);
+        if ((i - n - 1) >= 0)
+            ordStatUpd(&os, i - n - 1, -1);
+
+        med = ordStatMedian(&os, num);
+
+        if (hampel) {
+            double sigma = HAMPEL_MAD_SCALE * ordStatMad(&os, num, med);
+            y[i] = (fabs(x[i] - med) > (HAMPEL_NUM_SIGMAS * sigma)) ? med : x[i];
+        } else {
+            y[i] = med;
+        }
+    }
+
+    numPts = 0;
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        int index = p->index;
+
+        if ((index >= pArgs->range.from) && (index <= pArgs->range.to) &&
+            (numPts < os.size)) {
+            metricSetValue(p, actMetric, y[numPts++]);
+        }
+    }
+
+    ordStatFree(&os);
+    free(x);
+    free(y);
+
     return 0;
 }
 
-// Compute the SavitzkyGolay of the specified metric
-int compSGF(GpsTrk *pTrk, const CmdArgs *pArgs)
+// Remove the outliers of the specified metric using a Hampel
+// filter.
+int compHampel(GpsTrk *pTrk, const CmdArgs *pArgs)
 {
-    ActMetric actMetric = pArgs->actMetric;
-    int nl = (pArgs->smaWindow - 1) / 2;    // number of points to the L/R of the given point
+    return compMedianFilter(pTrk, pArgs, true);
+}
+
+// Compute the sliding median of the specified metric
+int compMedian(GpsTrk *pTrk, const CmdArgs *pArgs)
+{
+    return compMedianFilter(pTrk, pArgs, false);
+}
+
+// The SGF of the TrkPt's at the edges of the range only uses
+// the TrkPt's within the range, so the halo of each block is
+// clipped at the edges of the range.
+static int sgfFilter(const FilterJob *pJob, const double *x, double *y, int from, int to)
+{
+    int nl = (pJob->window - 1) / 2;    // number of points to the L/R of the given point
     int nr = nl;
     int ld = DEFAULT_LD;
     int m = DEFAULT_M;
-    long mm = pArgs->range.to - pArgs->range.from + 1;
+    int lo = ((from - nl) > pJob->pMc->first) ? (from - nl) : pJob->pMc->first;
+    int hi = ((to + nr) < pJob->pMc->last) ? (to + nr) : pJob->pMc->last;
+    long mm = hi - lo + 1;
     double *yr, *yf;
-    int i, s;
-    TrkPt *p;
+    int s;
 
     yr = dvector(1, mm);
 #if CONVOLVE_WITH_NR_CONVLV
@@ -475,23 +1428,13 @@ int compSGF(GpsTrk *pTrk, const CmdArgs *pArgs)
     yf = dvector(1, mm);
 #endif
 
-    i = 1;
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        int index = p->index;
-
-        if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
-            yr[i++] = metricGetValue(p, actMetric);
-        }
+    for (int i = lo; i <= hi; i++) {
+        yr[i - lo + 1] = x[i];
     }
 
-    s = sgfilter(yr, yf, mm, nl, nr, ld, m);
-
-    i = 1;
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        int index = p->index;
-
-        if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
-            metricSetValue(p, actMetric, yf[i++]);
+    if ((s = sgfilter(yr, yf, mm, nl, nr, ld, m)) == 0) {
+        for (int i = from; i <= to; i++) {
+            y[i] = yf[i - lo + 1];
         }
     }
 
@@ -505,41 +1448,62 @@ int compSGF(GpsTrk *pTrk, const CmdArgs *pArgs)
     return s;
 }
 
-// Compute the Simple Moving Average of the specified metric
-int compSMA(GpsTrk *pTrk, const CmdArgs *pArgs)
+// Compute the SavitzkyGolay filter of the specified metric(s)
+int compSGF(GpsTrk *pTrk, const CmdArgs *pArgs)
 {
-    ActMetric actMetric = pArgs->actMetric;
-    int smaWindow = pArgs->smaWindow;
-    TrkPt *p;
+    MetricCols mc;
+    int s;
 
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        int index = p->index;
+    if (gatherMetricCols(pTrk, pArgs, 0, &mc) != 0) {
+        return -1;
+    }
 
-        if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
-            if (index >= smaWindow) {
-                TrkPt *tp = p;
+    if ((s = runFilterJob(&mc, sgfFilter, pArgs->smaWindow)) == 0) {
+        scatterMetricCols(&mc);
+    }
 
-                p->adjVal = 0.0;
+    freeMetricCols(&mc);
 
-                for (int n = 0; n < smaWindow; n++) {
-                    p->adjVal += metricGetValue(tp, actMetric);
-                    tp = TAILQ_PREV(tp, TrkPtList, tqEntry);
-                }
+    return s;
+}
 
-                p->adjVal = p->adjVal / smaWindow;
+static int smaFilter(const FilterJob *pJob, const double *x, double *y, int from, int to)
+{
+    int smaWindow = pJob->window;
+
+    for (int i = from; i <= to; i++) {
+        y[i] = x[i];
+        if (i >= (smaWindow - 1)) {
+            y[i] = 0.0;
+            for (int n = 0; n < smaWindow; n++) {
+                y[i] += x[i - n];
             }
+            y[i] = y[i] / smaWindow;
         }
     }
 
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        int index = p->index;
+    return 0;
+}
 
-        if ((index >= pArgs->range.from) && (index <= pArgs->range.to)) {
-            metricSetValue(p, actMetric, p->adjVal);
-        }
+// Compute the Simple Moving Average of the specified metric(s).
+// The TrkPt's that don't have a full window of TrkPt's behind
+// them are left alone.
+int compSMA(GpsTrk *pTrk, const CmdArgs *pArgs)
+{
+    MetricCols mc;
+    int s;
+
+    if (gatherMetricCols(pTrk, pArgs, (pArgs->smaWindow - 1), &mc) != 0) {
+        return -1;
     }
 
-    return 0;
+    if ((s = runFilterJob(&mc, smaFilter, pArgs->smaWindow)) == 0) {
+        scatterMetricCols(&mc);
+    }
+
+    freeMetricCols(&mc);
+
+    return s;
 }
 
 // Scale the specified metric by the specified factor
@@ -565,6 +1529,11 @@ int saveTrkPts(GpsTrk *pTrk)
 {
     TrkPt *p;
 
+    // The TrkPt's are about to be modified
+    freeClimbs(pTrk);
+    freeTrkAggr(pTrk);
+    freeGeoGrid(pTrk);
+
     // Delete all TrkPt's from the saved list
     while ((p = TAILQ_FIRST(&pTrk->savedTrkPtList)) != NULL) {
         TAILQ_REMOVE(&pTrk->savedTrkPtList, p, tqEntry);
@@ -584,6 +1553,10 @@ int restoreTrkPts(GpsTrk *pTrk)
 {
     TrkPt *p;
 
+    freeClimbs(pTrk);
+    freeTrkAggr(pTrk);
+    freeGeoGrid(pTrk);
+
     if ((p = TAILQ_FIRST(&pTrk->trkPtList)) != NULL) {
         // Delete all TrkPt's from the working list
         do {
@@ -6,24 +6,65 @@
 extern "C" {
 #endif
 
+// Check a single TrkPt against the previous one
+extern int checkTrkPt(GpsTrk *pTrk, const CmdArgs *pArgs, const TrkPt *p1, const TrkPt *p2);
+
 // Check the TrkPt's for duplicates and bogus values
 extern int checkTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs);
 
-// Compute the Centered Moving Average of the specified metric
+// Compute the Centered Moving Average of the specified metric(s)
 extern int compCMA(GpsTrk *pTrk, const CmdArgs *pArgs);
 
+// Compute the great-circle distance (in meters) between two TrkPt's
+extern double compHaversine(const TrkPt *p1, const TrkPt *p2);
+
 // Compute the basic metrics
 extern int compMetrics(GpsTrk *pTrk, const CmdArgs *pArgs);
 
-// Compute the SavitzkyGolay of the specified metric
+// Compute the basic metrics of a single TrkPt given the
+// previous one (NULL for the first TrkPt in the track)
+extern int compTrkPtMetrics(GpsTrk *pTrk, const CmdArgs *pArgs, TrkPt *p1, TrkPt *p2);
+
+// Compute the Exponential Moving Average of the specified metric
+extern int compEMA(GpsTrk *pTrk, const CmdArgs *pArgs);
+
+// Smooth the specified metric using a zero-phase low-pass filter
+extern int compLowpass(GpsTrk *pTrk, const CmdArgs *pArgs);
+
+// Remove the outliers of the specified metric using a Hampel filter
+extern int compHampel(GpsTrk *pTrk, const CmdArgs *pArgs);
+
+// Compute the sliding median of the specified metric
+extern int compMedian(GpsTrk *pTrk, const CmdArgs *pArgs);
+
+// Compute the SavitzkyGolay filter of the specified metric(s)
 extern int compSGF(GpsTrk *pTrk, const CmdArgs *pArgs);
 
-// Compute the Simple Moving Average of the specified metric
+// Compute the Simple Moving Average of the specified metric(s)
 extern int compSMA(GpsTrk *pTrk, const CmdArgs *pArgs);
 
+// Mark the TrkPt's in the specified range as modified
+extern void setDirtyRange(GpsTrk *pTrk, ActMetric actMetric, int from, int to);
+
+// Recompute the metrics of the modified TrkPt's, and
+// update the min/avg/max values accordingly
+extern int updDirtyMetrics(GpsTrk *pTrk, const CmdArgs *pArgs);
+
+// Adjust the elevation values so that the grade and the grade
+// change stay within the specified limits. The TrkPt's are
+// saved, so that the operation can be 'undo', only once the
+// limits are known to be feasible; on error nothing is changed.
+extern int limitGrade(GpsTrk *pTrk, const CmdArgs *pArgs, double minGrade, double maxGrade, double maxDeltaG);
+
 // Compute the min/avg/max values
 extern int computeMinMaxValues(GpsTrk *pTrk);
 
+// Reset the min/avg/max values
+extern void initMinMaxValues(GpsTrk *pTrk);
+
+// Update the min/avg/max values with a single TrkPt
+extern void updMinMaxValues(GpsTrk *pTrk, const TrkPt *p1, TrkPt *p2);
+
 // Scale the specified metric by the specified factor
 extern int scaleMetric(GpsTrk *pTrk, const CmdArgs *pArgs);
 
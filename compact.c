@@ -0,0 +1,376 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "compact.h"
+#include "const.h"
+#include "packed.h"
+#include "trkpt.h"
+
+// Bytes used by each TrkPt in the compact representation
+#define COMPACT_PT_SIZE ((13 * sizeof (int32_t)) + sizeof (uint16_t) + (3 * sizeof (uint8_t)))
+
+// Same conversions as for the FIT files, so that the lat/lon
+// values parsed from them are stored without any loss.
+static int32_t toSemiCircles(double deg)
+{
+    return (int32_t) lround((deg / (double) 180.0) * (double) 0x7FFFFFFF);
+}
+
+static double fromSemiCircles(int32_t sc)
+{
+    return ((double) sc / (double) 0x7FFFFFFF) * (double) 180.0;
+}
+
+// Clamp the value to the range of the integer type
+static long clampInt(long val, long minVal, long maxVal)
+{
+    return (val < minVal) ? minVal : ((val > maxVal) ? maxVal : val);
+}
+
+// Carve out a column of 'n' elements of the specified size
+// from the buffer.
+static void *carveCol(char **pBuf, int n, size_t size)
+{
+    void *col = *pBuf;
+    *pBuf += (n * size);
+    return col;
+}
+
+CompactTrk *newCompactTrk(int numPts, int numSegs)
+{
+    CompactTrk *pCt;
+    char *buf;
+
+    if ((pCt = calloc(1, sizeof (CompactTrk))) == NULL) {
+        fprintf(stderr, "Failed to alloc CompactTrk object !!!\n");
+        return NULL;
+    }
+
+    pCt->numPts = numPts;
+    pCt->numSegs = numSegs;
+
+    // The columns are carved out of a single buffer, in
+    // order of decreasing element size, so that they are
+    // all properly aligned.
+    pCt->buf = malloc((numPts * COMPACT_PT_SIZE) + 1);
+    pCt->segs = malloc((numSegs * sizeof (CompactSeg)) + 1);
+    if ((pCt->buf == NULL) || (pCt->segs == NULL)) {
+        fprintf(stderr, "Failed to alloc CompactTrk columns !!!\n");
+        freeCompactTrk(pCt);
+        return NULL;
+    }
+    buf = pCt->buf;
+    pCt->index = carveCol(&buf, numPts, sizeof (int32_t));
+    pCt->lineNum = carveCol(&buf, numPts, sizeof (int32_t));
+    pCt->time = carveCol(&buf, numPts, sizeof (uint32_t));
+    pCt->latitude = carveCol(&buf, numPts, sizeof (int32_t));
+    pCt->longitude = carveCol(&buf, numPts, sizeof (int32_t));
+    pCt->distance = carveCol(&buf, numPts, sizeof (int32_t));
+    pCt->elevation = carveCol(&buf, numPts, sizeof (float));
+    pCt->speed = carveCol(&buf, numPts, sizeof (float));
+    pCt->dist = carveCol(&buf, numPts, sizeof (float));
+    pCt->rise = carveCol(&buf, numPts, sizeof (float));
+    pCt->run = carveCol(&buf, numPts, sizeof (float));
+    pCt->bearing = carveCol(&buf, numPts, sizeof (float));
+    pCt->grade = carveCol(&buf, numPts, sizeof (float));
+    pCt->power = carveCol(&buf, numPts, sizeof (uint16_t));
+    pCt->ambTemp = carveCol(&buf, numPts, sizeof (int8_t));
+    pCt->cadence = carveCol(&buf, numPts, sizeof (uint8_t));
+    pCt->heartRate = carveCol(&buf, numPts, sizeof (uint8_t));
+
+    return pCt;
+}
+
+CompactTrk *compactTrk(const GpsTrk *pTrk)
+{
+    CompactTrk *pCt;
+    const TrkPt *p;
+    const char *inFile = NULL;
+    int numPts = 0, numSegs = 0;
+    int n;
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((numPts == 0) || (p->inFile != inFile)) {
+            numSegs++;
+            inFile = p->inFile;
+        }
+        numPts++;
+    }
+
+    // The timestamps are stored in ms relative to the first
+    // one, so the track can't span more than ~49 days.
+    if ((numPts != 0) &&
+        ((TAILQ_LAST(&pTrk->trkPtList, TrkPtList)->timestamp - floor(TAILQ_FIRST(&pTrk->trkPtList)->timestamp)) >= (UINT32_MAX / 1000.0))) {
+        fprintf(stderr, "The track is too long for the compact layout !!!\n");
+        return NULL;
+    }
+
+    if ((pCt = newCompactTrk(numPts, numSegs)) == NULL) {
+        return NULL;
+    }
+
+    if ((p = TAILQ_FIRST(&pTrk->trkPtList)) != NULL) {
+        pCt->baseTime = floor(p->timestamp);
+    }
+
+    n = 0;
+    pCt->numSegs = 0;
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((n == 0) || (p->inFile != pCt->segs[pCt->numSegs - 1].inFile)) {
+            pCt->segs[pCt->numSegs].first = n;
+            pCt->segs[pCt->numSegs].inFile = p->inFile;
+            pCt->numSegs++;
+        }
+
+        pCt->index[n] = p->index;
+        pCt->lineNum[n] = p->lineNum;
+        pCt->time[n] = (uint32_t) clampInt(lround((p->timestamp - pCt->baseTime) * 1000.0), 0, UINT32_MAX);
+        pCt->latitude[n] = toSemiCircles(p->latitude);
+        pCt->longitude[n] = toSemiCircles(p->longitude);
+        pCt->distance[n] = (int32_t) clampInt(lround(p->distance * 100.0), INT32_MIN, INT32_MAX);
+        pCt->elevation[n] = (float) p->elevation;
+        pCt->speed[n] = (float) p->speed;
+        pCt->dist[n] = (float) p->dist;
+        pCt->rise[n] = (float) p->rise;
+        pCt->run[n] = (float) p->run;
+        pCt->bearing[n] = (float) p->bearing;
+        pCt->grade[n] = (float) p->grade;
+        pCt->power[n] = (uint16_t) clampInt(p->power, 0, UINT16_MAX);
+        pCt->ambTemp[n] = (int8_t) clampInt(p->ambTemp, INT8_MIN, INT8_MAX);
+        pCt->cadence[n] = (uint8_t) clampInt(p->cadence, 0, UINT8_MAX);
+        pCt->heartRate[n] = (uint8_t) clampInt(p->heartRate, 0, UINT8_MAX);
+        n++;
+    }
+
+    return pCt;
+}
+
+void compactGetTrkPt(const CompactTrk *pCt, int n, TrkPt *p)
+{
+    p->index = pCt->index[n];
+    p->lineNum = pCt->lineNum[n];
+    p->timestamp = pCt->baseTime + (pCt->time[n] / 1000.0);
+    p->latitude = fromSemiCircles(pCt->latitude[n]);
+    p->longitude = fromSemiCircles(pCt->longitude[n]);
+    p->distance = pCt->distance[n] / 100.0;
+    p->elevation = pCt->elevation[n];
+    p->speed = pCt->speed[n];
+    p->dist = pCt->dist[n];
+    p->rise = pCt->rise[n];
+    p->run = pCt->run[n];
+    p->bearing = pCt->bearing[n];
+    p->grade = pCt->grade[n];
+    p->power = pCt->power[n];
+    p->ambTemp = pCt->ambTemp[n];
+    p->cadence = pCt->cadence[n];
+    p->heartRate = pCt->heartRate[n];
+}
+
+int expandCompactTrk(const CompactTrk *pCt, struct TrkPtList *pList)
+{
+    TrkPt *p1 = NULL;
+    int seg = 0;
+
+    for (int n = 0; n < pCt->numPts; n++) {
+        TrkPt *p2;
+
+        if (((seg + 1) < pCt->numSegs) && (n == pCt->segs[seg + 1].first)) {
+            seg++;
+        }
+
+        if ((p2 = newTrkPt(pCt->index[n], pCt->segs[seg].inFile, pCt->lineNum[n])) == NULL) {
+            return -1;
+        }
+
+        compactGetTrkPt(pCt, n, p2);
+
+        if (p1 != NULL) {
+            p2->deltaT = p2->timestamp - p1->timestamp;
+            p2->deltaG = fabs(p2->grade - p1->grade);
+        }
+
+        TAILQ_INSERT_TAIL(pList, p2, tqEntry);
+        p1 = p2;
+    }
+
+    return 0;
+}
+
+size_t compactTrkSize(const CompactTrk *pCt)
+{
+    return (sizeof (CompactTrk) + (pCt->numPts * COMPACT_PT_SIZE) + (pCt->numSegs * sizeof (CompactSeg)));
+}
+
+void freeCompactTrk(CompactTrk *pCt)
+{
+    if (pCt != NULL) {
+        free(pCt->buf);
+        free(pCt->segs);
+        free(pCt);
+    }
+}
+
+// Precision of the float32 columns, relative to the value
+#define COMPACT_FLOAT_TOL   FLT_EPSILON
+
+// Round-trip error of a field. The error of each value must
+// be within absTol + relTol * |value|: i.e. half the step of
+// the fixed-point columns, or the precision of the float32
+// ones.
+typedef struct FieldErr {
+    const char *name;
+    const char *units;
+    double absTol;
+    double relTol;
+    double maxErr;
+    double sumSqErr;
+    int numOver;            // number of values out of tolerance
+} FieldErr;
+
+static void addErr(FieldErr *pErr, double orig, double val, double mag)
+{
+    double err = fabs(val - orig);
+
+    if (err > pErr->maxErr)
+        pErr->maxErr = err;
+    pErr->sumSqErr += (err * err);
+    if (err > (pErr->absTol + (pErr->relTol * mag)))
+        pErr->numOver++;
+}
+
+int printCompactReport(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    struct TrkPtList list = TAILQ_HEAD_INITIALIZER(list);
+    FieldErr errTbl[] = {
+        { "timestamp", "s",     0.0005, DBL_EPSILON },          // 1 ms
+        { "latitude", "m",      0.005, 0.0 },                   // 1 semicircle ~ 1 cm
+        { "longitude", "m",     0.005, 0.0 },
+        { "elevation", "m",     1.0e-9, COMPACT_FLOAT_TOL },
+        { "distance", "m",      0.005, DBL_EPSILON },           // 1 cm
+        { "speed", "m/s",       1.0e-9, COMPACT_FLOAT_TOL },
+        { "dist", "m",          1.0e-9, COMPACT_FLOAT_TOL },
+        { "rise", "m",          1.0e-9, COMPACT_FLOAT_TOL },
+        { "run", "m",           1.0e-9, COMPACT_FLOAT_TOL },
+        { "bearing", "deg",     1.0e-9, COMPACT_FLOAT_TOL },
+        { "grade", "%",         1.0e-9, COMPACT_FLOAT_TOL },
+        { "deltaG", "%",        1.0e-9, COMPACT_FLOAT_TOL },    // relative to both grades
+        { "deltaT", "s",        0.001, DBL_EPSILON },           // relative to the timestamp
+        { "ambTemp", "C",       0.0, 0.0 },
+        { "cadence", "rpm",     0.0, 0.0 },
+        { "heartRate", "bpm",   0.0, 0.0 },
+        { "power", "W",         0.0, 0.0 },
+    };
+    int numErrs = sizeof (errTbl) / sizeof (errTbl[0]);
+    CompactTrk *pCt;
+    const TrkPt *p, *q, *prev = NULL;
+    size_t origSize, compSize, packSize = 0;
+    int numMismatch = 0;
+    int numPackMismatch = 0;
+    int numOver = 0;
+    PackedTrk *pPt;
+
+    if ((pCt = compactTrk(pTrk)) == NULL) {
+        return -1;
+    }
+
+    if (expandCompactTrk(pCt, &list) != 0) {
+        freeCompactTrk(pCt);
+        return -1;
+    }
+
+    // Compare each TrkPt with its round-trip copy
+    for (p = TAILQ_FIRST(&pTrk->trkPtList), q = TAILQ_FIRST(&list); (p != NULL) && (q != NULL);
+         p = TAILQ_NEXT(p, tqEntry), q = TAILQ_NEXT(q, tqEntry)) {
+        double mPerDegLat = degToRad * earthMeanRadius;
+        double mPerDegLon = mPerDegLat * cos(p->latitude * degToRad);
+
+        addErr(&errTbl[0], p->timestamp, q->timestamp, fabs(p->timestamp));
+        addErr(&errTbl[1], p->latitude * mPerDegLat, q->latitude * mPerDegLat, 0.0);
+        addErr(&errTbl[2], p->longitude * mPerDegLon, q->longitude * mPerDegLon, 0.0);
+        addErr(&errTbl[3], p->elevation, q->elevation, fabs(p->elevation));
+        addErr(&errTbl[4], p->distance, q->distance, fabs(p->distance));
+        addErr(&errTbl[5], p->speed, q->speed, fabs(p->speed));
+        addErr(&errTbl[6], p->dist, q->dist, fabs(p->dist));
+        addErr(&errTbl[7], p->rise, q->rise, fabs(p->rise));
+        addErr(&errTbl[8], p->run, q->run, fabs(p->run));
+        addErr(&errTbl[9], p->bearing, q->bearing, fabs(p->bearing));
+        addErr(&errTbl[10], p->grade, q->grade, fabs(p->grade));
+        if (prev != NULL) {
+            // The deltaG and deltaT are recomputed from the
+            // grade and the timestamp of both TrkPt's.
+            addErr(&errTbl[11], p->deltaG, q->deltaG, (fabs(p->grade) + fabs(prev->grade)));
+            addErr(&errTbl[12], p->deltaT, q->deltaT, (fabs(p->timestamp) + fabs(prev->timestamp)));
+        }
+        addErr(&errTbl[13], p->ambTemp, q->ambTemp, 0.0);
+        addErr(&errTbl[14], p->cadence, q->cadence, 0.0);
+        addErr(&errTbl[15], p->heartRate, q->heartRate, 0.0);
+        addErr(&errTbl[16], p->power, q->power, 0.0);
+
+        if ((p->index != q->index) || (p->lineNum != q->lineNum) || (p->inFile != q->inFile)) {
+            numMismatch++;
+        }
+        prev = p;
+    }
+
+    // The packed track must decompress to the exact same
+    // values as the compact one.
+    if ((pPt = packTrk(pCt)) != NULL) {
+        PackedIter iter;
+        TrkPt trkPt;
+
+        packSize = packedTrkSize(pPt);
+        if (packedIterInit(pPt, &iter) == 0) {
+            for (q = TAILQ_FIRST(&list); (q != NULL) && packedIterNext(&iter, &trkPt); q = TAILQ_NEXT(q, tqEntry)) {
+                if ((trkPt.index != q->index) || (trkPt.lineNum != q->lineNum) || (trkPt.inFile != q->inFile) ||
+                    (trkPt.timestamp != q->timestamp) || (trkPt.latitude != q->latitude) || (trkPt.longitude != q->longitude) ||
+                    (trkPt.elevation != q->elevation) || (trkPt.distance != q->distance) || (trkPt.speed != q->speed) ||
+                    (trkPt.dist != q->dist) || (trkPt.rise != q->rise) || (trkPt.run != q->run) ||
+                    (trkPt.bearing != q->bearing) || (trkPt.grade != q->grade) || (trkPt.deltaG != q->deltaG) ||
+                    (trkPt.deltaT != q->deltaT) || (trkPt.power != q->power) || (trkPt.ambTemp != q->ambTemp) ||
+                    (trkPt.cadence != q->cadence) || (trkPt.heartRate != q->heartRate)) {
+                    numPackMismatch++;
+                }
+            }
+            packedIterEnd(&iter);
+        }
+        freePackedTrk(pPt);
+    }
+
+    origSize = pCt->numPts * sizeof (TrkPt);
+    compSize = compactTrkSize(pCt);
+
+    fprintf(pArgs->outFile, "      numTrkPts: %d\n", pCt->numPts);
+    fprintf(pArgs->outFile, "        numSegs: %d\n", pCt->numSegs);
+    fprintf(pArgs->outFile, "     TrkPt size: %zu bytes (%zu bytes/TrkPt)\n", origSize, sizeof (TrkPt));
+    fprintf(pArgs->outFile, "   compact size: %zu bytes (%.1lf bytes/TrkPt)\n", compSize, (pCt->numPts != 0) ? ((double) compSize / pCt->numPts) : 0.0);
+    fprintf(pArgs->outFile, "          ratio: %.2lf\n", (compSize != 0) ? ((double) origSize / compSize) : 0.0);
+    fprintf(pArgs->outFile, "    packed size: %zu bytes (%.1lf bytes/TrkPt)\n", packSize, (pCt->numPts != 0) ? ((double) packSize / pCt->numPts) : 0.0);
+    fprintf(pArgs->outFile, "   packed ratio: %.2lf\n", (packSize != 0) ? ((double) origSize / packSize) : 0.0);
+    fprintf(pArgs->outFile, "   idx mismatch: %d\n", numMismatch);
+    fprintf(pArgs->outFile, "pack mismatches: %d\n", numPackMismatch);
+    fprintf(pArgs->outFile, "<field>,<maxErr>,<rmsErr>,<units>,<numOutOfTol>\n");
+    for (int n = 0; n < numErrs; n++) {
+        fprintf(pArgs->outFile, "%s,%.3le,%.3le,%s,%d\n",
+                errTbl[n].name, errTbl[n].maxErr,
+                (pCt->numPts != 0) ? sqrt(errTbl[n].sumSqErr / pCt->numPts) : 0.0,
+                errTbl[n].units, errTbl[n].numOver);
+        numOver += errTbl[n].numOver;
+    }
+
+    // Discard the round-trip copy
+    while ((p = TAILQ_FIRST(&list)) != NULL) {
+        TAILQ_REMOVE(&list, (TrkPt *) p, tqEntry);
+        free((TrkPt *) p);
+    }
+
+    freeCompactTrk(pCt);
+
+    if ((numOver != 0) || (numMismatch != 0) || (numPackMismatch != 0) || (pPt == NULL)) {
+        fprintf(stderr, "The compact round trip is out of tolerance !!!\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Run of consecutive TrkPt's that came from the same input file
+typedef struct CompactSeg {
+    int first;              // position of the first TrkPt in the run
+    const char *inFile;
+} CompactSeg;
+
+// Compact representation of a track, with one column per field.
+// The lat/lon are stored in semicircles (like in FIT files), the
+// timestamp and distance in fixed point, the other metrics in
+// float32, and the sensor data in 8/16-bit integers. The deltaT
+// and deltaG of each TrkPt are recomputed from the timestamps
+// and grades, and the file of each TrkPt comes from a table of
+// segments.
+typedef struct CompactTrk {
+    int numPts;
+    double baseTime;        // in seconds since the Epoch
+    int numSegs;
+    CompactSeg *segs;
+
+    // 32-bit columns
+    int32_t *index;
+    int32_t *lineNum;
+    uint32_t *time;         // in ms since baseTime
+    int32_t *latitude;      // in semicircles
+    int32_t *longitude;     // in semicircles
+    int32_t *distance;      // in cm
+    float *elevation;
+    float *speed;
+    float *dist;
+    float *rise;
+    float *run;
+    float *bearing;
+    float *grade;
+
+    // 16-bit columns
+    uint16_t *power;
+
+    // 8-bit columns
+    int8_t *ambTemp;
+    uint8_t *cadence;
+    uint8_t *heartRate;
+
+    void *buf;
+} CompactTrk;
+
+// Alloc an empty compact track with room for the specified
+// number of TrkPt's and segments. Returns NULL on error.
+extern CompactTrk *newCompactTrk(int numPts, int numSegs);
+
+// Build the compact representation of the track.
+// Returns NULL on error.
+extern CompactTrk *compactTrk(const GpsTrk *pTrk);
+
+// Fill in the TrkPt with the values at position 'n'. The
+// inFile, deltaT, and deltaG are left alone.
+extern void compactGetTrkPt(const CompactTrk *pCt, int n, TrkPt *p);
+
+// Expand the compact representation back into TrkPt's, which
+// are appended to the specified list.
+extern int expandCompactTrk(const CompactTrk *pCt, struct TrkPtList *pList);
+
+// Number of bytes used by the compact representation
+extern size_t compactTrkSize(const CompactTrk *pCt);
+
+extern void freeCompactTrk(CompactTrk *pCt);
+
+// Print the memory used by the compact representation of
+// the track, and the max/RMS error of each field after a
+// round trip through it. Returns -1 if any value is off by
+// more than the precision of its column (e.g. a sensor value
+// out of the range of its 8-bit column), or if the packed
+// track doesn't decompress to the compact values.
+extern int printCompactReport(GpsTrk *pTrk, CmdArgs *pArgs);
+
+#ifdef __cplusplus
+};
+#endif
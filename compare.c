@@ -0,0 +1,830 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "comp.h"
+#include "compare.h"
+#include "const.h"
+#include "grid.h"
+#include "input.h"
+#include "packed.h"
+#include "trkpt.h"
+
+// The two tracks are aligned with Dynamic Time Warping over the
+// positions of their TrkPt's. Only the cells of the cost matrix
+// within a band around a rough path (i.e. the TrkPt's of the
+// reference track nearest to the TrkPt's of the track) are
+// evaluated, and only the step taken at each cell is kept, so
+// both time and memory are O(N * band). See below for the
+// details:
+//
+//   https://en.wikipedia.org/wiki/Dynamic_time_warping
+//
+#define COMPARE_BAND_DIST   300.0   // half-width (m) of the band
+#define COMPARE_MIN_BAND    8       // min half-width (TrkPt's) of the band
+#define COMPARE_MAX_BAND    512     // max half-width (TrkPt's) of the band
+#define COMPARE_MAX_OFFSET  25.0    // max offset (m) between matching TrkPt's
+#define COMPARE_MIN_DIV_LEN 50.0    // min length (m) of a divergent section
+#define COMPARE_ANCHOR_DIST 50.0    // max offset (m) between the start/end TrkPt's
+#define COMPARE_MAX_SCALE   1.1     // max ratio between the lengths of the tracks
+
+// Warping steps
+#define STEP_DIAG   0   // from (i-1, j-1)
+#define STEP_UP     1   // from (i-1, j)
+#define STEP_LEFT   2   // from (i, j-1)
+
+// Track flattened into arrays
+typedef struct CmpTrk {
+    int numPts;
+    TrkPt **pts;        // NULL for the reference track
+    int *index;
+    double *lat;
+    double *lon;
+    double *dist;       // distance from the first TrkPt (in meters)
+    double *elev;
+    double *x;          // projected position (in meters)
+    double *y;
+} CmpTrk;
+
+// Cell of the rough path the band is centered on: the TrkPt
+// 'i' of the track is near the TrkPt 'j' of the reference track.
+typedef struct WarpAnchor {
+    int i;
+    int j;
+} WarpAnchor;
+
+// Band of the cost matrix
+typedef struct WarpBand {
+    int *lo;            // first column of each row
+    int *hi;            // last column of each row
+    size_t *off;        // offset of each row in the step matrix
+    uint8_t *step;      // step taken to reach each cell
+} WarpBand;
+
+static void freeCmpTrk(CmpTrk *pCt)
+{
+    free(pCt->pts);
+    free(pCt->index);
+    free(pCt->lat);
+    free(pCt->lon);
+    free(pCt->dist);
+    free(pCt->elev);
+    free(pCt->x);
+    free(pCt->y);
+    memset(pCt, 0, sizeof (*pCt));
+}
+
+static int allocCmpTrk(CmpTrk *pCt, int numPts, Bool withPts)
+{
+    pCt->numPts = numPts;
+    pCt->pts = withPts ? malloc(numPts * sizeof (TrkPt *)) : NULL;
+    pCt->index = malloc(numPts * sizeof (int));
+    pCt->lat = malloc(numPts * sizeof (double));
+    pCt->lon = malloc(numPts * sizeof (double));
+    pCt->dist = malloc(numPts * sizeof (double));
+    pCt->elev = malloc(numPts * sizeof (double));
+    pCt->x = malloc(numPts * sizeof (double));
+    pCt->y = malloc(numPts * sizeof (double));
+    if ((withPts && (pCt->pts == NULL)) || (pCt->index == NULL) || (pCt->lat == NULL) ||
+        (pCt->lon == NULL) || (pCt->dist == NULL) || (pCt->elev == NULL) ||
+        (pCt->x == NULL) || (pCt->y == NULL)) {
+        fprintf(stderr, "Failed to alloc CmpTrk arrays !!!\n");
+        freeCmpTrk(pCt);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Make the distances relative to the first TrkPt, and project
+// the TrkPt's onto the plane tangent at the specified origin.
+static void projectCmpTrk(CmpTrk *pCt, const TrkPt *pOrg)
+{
+    double mPerDegLat = degToRad * earthMeanRadius;
+    double mPerDegLon = mPerDegLat * cos(pOrg->latitude * degToRad);
+    double dist0 = pCt->dist[0];
+
+    for (int n = 0; n < pCt->numPts; n++) {
+        pCt->dist[n] -= dist0;
+        pCt->x[n] = (pCt->lon[n] - pOrg->longitude) * mPerDegLon;
+        pCt->y[n] = (pCt->lat[n] - pOrg->latitude) * mPerDegLat;
+    }
+}
+
+// Flatten the track
+static int newCmpTrk(CmpTrk *pCt, GpsTrk *pTrk, const TrkPt *pOrg)
+{
+    TrkPt *p;
+    int numPts = 0;
+    int n = 0;
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        numPts++;
+    }
+
+    if (allocCmpTrk(pCt, numPts, true) != 0) {
+        return -1;
+    }
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        pCt->pts[n] = p;
+        pCt->index[n] = p->index;
+        pCt->lat[n] = p->latitude;
+        pCt->lon[n] = p->longitude;
+        pCt->dist[n] = p->distance;
+        pCt->elev[n] = p->elevation;
+        n++;
+    }
+
+    projectCmpTrk(pCt, pOrg);
+
+    return 0;
+}
+
+// Flatten the packed reference track, decompressing it one
+// block at a time.
+static int newRefCmpTrk(CmpTrk *pCt, const PackedTrk *pRef, const TrkPt *pOrg)
+{
+    PackedIter iter;
+    TrkPt trkPt;
+
+    if (allocCmpTrk(pCt, pRef->numPts, false) != 0) {
+        return -1;
+    }
+
+    if (packedIterInit(pRef, &iter) != 0) {
+        freeCmpTrk(pCt);
+        return -1;
+    }
+
+    for (int n = 0; packedIterNext(&iter, &trkPt); n++) {
+        pCt->index[n] = trkPt.index;
+        pCt->lat[n] = trkPt.latitude;
+        pCt->lon[n] = trkPt.longitude;
+        pCt->dist[n] = trkPt.distance;
+        pCt->elev[n] = trkPt.elevation;
+    }
+
+    packedIterEnd(&iter);
+
+    projectCmpTrk(pCt, pOrg);
+
+    return 0;
+}
+
+static double cmpDist(const CmpTrk *pCt, int i)
+{
+    return pCt->dist[i];
+}
+
+static double cmpOffset(const CmpTrk *pA, int i, const CmpTrk *pB, int j)
+{
+    return hypot((pA->x[i] - pB->x[j]), (pA->y[i] - pB->y[j]));
+}
+
+static void freeWarpBand(WarpBand *pBand)
+{
+    free(pBand->lo);
+    free(pBand->hi);
+    free(pBand->off);
+    free(pBand->step);
+}
+
+// Find the TrkPt of the track 'pB' closest to the TrkPt 'i' of
+// the track 'pA', in the first or last pass of 'pB' near it.
+// Returns -1 if 'pB' doesn't get near enough.
+static int findAnchor(const CmpTrk *pA, int i, const CmpTrk *pB, Bool lastPass)
+{
+    GeoGrid *pGrid = newGeoGridLatLon(pB->numPts, pB->lat, pB->lon);
+    GeoHit *hits = NULL;
+    int numHits;
+    int best = -1;
+
+    if ((pGrid != NULL) &&
+        ((numHits = gridWithin(pGrid, pA->lat[i], pA->lon[i], COMPARE_ANCHOR_DIST, &hits)) > 0)) {
+        int k, b;
+
+        if (lastPass) {
+            for (k = b = (numHits - 1); (k > 0) && (hits[k - 1].pos == (hits[k].pos - 1)); k--) {
+                if (hits[k - 1].dist < hits[b].dist)
+                    b = k - 1;
+            }
+        } else {
+            for (k = b = 0; ((k + 1) < numHits) && (hits[k + 1].pos == (hits[k].pos + 1)); k++) {
+                if (hits[k + 1].dist < hits[b].dist)
+                    b = k + 1;
+            }
+        }
+        best = hits[b].pos;
+    }
+
+    free(hits);
+    delGeoGrid(pGrid);
+
+    return best;
+}
+
+// Find the TrkPt's where the two tracks start and stop
+// overlapping. The start (end) of the overlap is at the first
+// (last) TrkPt of one of the tracks, and the closest TrkPt of
+// the other; of the possible pairs, the first one where the
+// lengths of the tracks between the start and the end of the
+// overlap agree is used. On loops the first and last TrkPt's
+// are near each other, so not every pair makes sense.
+static int findOverlap(const CmpTrk *pA, const CmpTrk *pB, int *pI0, int *pJ0, int *pI1, int *pJ1)
+{
+    int n = pA->numPts;
+    int m = pB->numPts;
+    int startI[2] = { 0, findAnchor(pB, 0, pA, false) };
+    int startJ[2] = { findAnchor(pA, 0, pB, false), 0 };
+    int endI[2] = { (n - 1), findAnchor(pB, (m - 1), pA, true) };
+    int endJ[2] = { findAnchor(pA, (n - 1), pB, true), (m - 1) };
+
+    for (int s = 0; s < 2; s++) {
+        for (int e = 0; e < 2; e++) {
+            double lenA, lenB;
+
+            if ((startI[s] < 0) || (startJ[s] < 0) || (endI[e] < 0) || (endJ[e] < 0))
+                continue;
+
+            lenA = cmpDist(pA, endI[e]) - cmpDist(pA, startI[s]);
+            lenB = cmpDist(pB, endJ[e]) - cmpDist(pB, startJ[s]);
+            if ((lenA > 0.0) && (lenB > 0.0) &&
+                ((lenB / lenA) <= COMPARE_MAX_SCALE) && ((lenA / lenB) <= COMPARE_MAX_SCALE)) {
+                *pI0 = startI[s];
+                *pJ0 = startJ[s];
+                *pI1 = endI[e];
+                *pJ1 = endJ[e];
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// Find the anchors of the rough path. For each TrkPt 'i' of
+// the track, from 'i0' to 'i1', the closest TrkPt in each pass
+// of the reference track near it, from 'j0' to 'j1', is a
+// candidate. Of those, the longest chain that moves forward
+// along both tracks is kept, which drops the matches with the
+// wrong pass on loops and out-and-back sections. Returns the
+// number of anchors, or -1 on error.
+static int findWarpAnchors(const CmpTrk *pA, const CmpTrk *pB, int i0, int i1, int j0, int j1, WarpAnchor **pAnchors)
+{
+    GeoGrid *pGrid = newGeoGridLatLon(pB->numPts, pB->lat, pB->lon);
+    WarpAnchor *cands = NULL;
+    int *tail = NULL, *prev = NULL;
+    int numCands = 0, maxCands = 0;
+    int len = 0;
+
+    *pAnchors = NULL;
+    if (pGrid == NULL) {
+        return 0;
+    }
+
+    for (int i = i0; i <= i1; i++) {
+        GeoHit *hits = NULL;
+        int numHits = gridWithin(pGrid, pA->lat[i], pA->lon[i], COMPARE_MAX_OFFSET, &hits);
+        int first = numCands;
+
+        for (int k = 0; k < numHits; k++) {
+            int b = k;
+
+            // Closest TrkPt of this pass
+            while (((k + 1) < numHits) && (hits[k + 1].pos == (hits[k].pos + 1))) {
+                k++;
+                if (hits[k].dist < hits[b].dist)
+                    b = k;
+            }
+            if ((hits[b].pos < j0) || (hits[b].pos > j1))
+                continue;
+
+            if (numCands == maxCands) {
+                WarpAnchor *tmp;
+
+                maxCands = (maxCands != 0) ? (2 * maxCands) : 1024;
+                if ((tmp = realloc(cands, maxCands * sizeof (WarpAnchor))) == NULL) {
+                    fprintf(stderr, "Failed to alloc WarpAnchor array !!!\n");
+                    free(hits);
+                    len = -1;
+                    goto done;
+                }
+                cands = tmp;
+            }
+            cands[numCands].i = i;
+            cands[numCands].j = hits[b].pos;
+            numCands++;
+        }
+        free(hits);
+
+        // Put the candidates of the row in reverse order, so
+        // that at most one of them can be in the chain.
+        for (int a = first, b = (numCands - 1); a < b; a++, b--) {
+            WarpAnchor tmp = cands[a];
+            cands[a] = cands[b];
+            cands[b] = tmp;
+        }
+    }
+
+    if (numCands == 0) {
+        goto done;
+    }
+
+    // Longest non-decreasing subsequence of the 'j' values:
+    // tail[k] is the last candidate of the best chain of
+    // length k+1 found so far.
+    tail = malloc(numCands * sizeof (int));
+    prev = malloc(numCands * sizeof (int));
+    if ((tail == NULL) || (prev == NULL)) {
+        fprintf(stderr, "Failed to alloc WarpAnchor chain !!!\n");
+        len = -1;
+        goto done;
+    }
+    for (int c = 0; c < numCands; c++) {
+        int lo = 0, hi = len;
+
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cands[tail[mid]].j <= cands[c].j) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        prev[c] = (lo > 0) ? tail[lo - 1] : -1;
+        tail[lo] = c;
+        if (lo == len)
+            len++;
+    }
+
+    if ((*pAnchors = malloc(len * sizeof (WarpAnchor))) == NULL) {
+        fprintf(stderr, "Failed to alloc WarpAnchor array !!!\n");
+        len = -1;
+        goto done;
+    }
+    for (int k = (len - 1), c = tail[len - 1]; k >= 0; k--, c = prev[c]) {
+        (*pAnchors)[k] = cands[c];
+    }
+
+done:
+    free(cands);
+    free(tail);
+    free(prev);
+    delGeoGrid(pGrid);
+
+    return len;
+}
+
+// Set the band of the cost matrix around the rough path given
+// by the anchors. Between two anchors the path follows the
+// distance along both tracks, and before the first (after the
+// last) anchor it goes at the same pace as the track. Without
+// anchors, the path is at the same distance along both tracks;
+// the distances are measured from the points where the tracks
+// start overlapping, and scaled to match where they stop
+// overlapping.
+static int newWarpBand(WarpBand *pBand, const CmpTrk *pA, const CmpTrk *pB)
+{
+    int n = pA->numPts;
+    int m = pB->numPts;
+    double totB = cmpDist(pB, m - 1);
+    double dA0, dA1, dB0, dB1, scale = 1.0;
+    int i0, i1, j0, j1;
+    int w = COMPARE_MAX_BAND;
+    int j = 0;
+    Bool overlap = true;
+    WarpAnchor *anchors;
+    int numAnchors;
+    int k = 0;
+
+    if (findOverlap(pA, pB, &i0, &j0, &i1, &j1) != 0) {
+        // Just go by the distance from the start
+        i0 = j0 = i1 = j1 = 0;
+        overlap = false;
+    }
+
+    if ((numAnchors = (overlap ? findWarpAnchors(pA, pB, i0, i1, j0, j1, &anchors) :
+                                 findWarpAnchors(pA, pB, 0, (n - 1), 0, (m - 1), &anchors))) < 0) {
+        return -1;
+    }
+    dA0 = cmpDist(pA, i0);
+    dA1 = cmpDist(pA, i1);
+    dB0 = cmpDist(pB, j0);
+    dB1 = cmpDist(pB, j1);
+    if ((dA1 > dA0) && (dB1 > dB0)) {
+        scale = (dB1 - dB0) / (dA1 - dA0);
+    }
+
+    if ((m > 1) && (totB > 0.0)) {
+        w = (int) lround(COMPARE_BAND_DIST / (totB / (m - 1)));
+        w = (w < COMPARE_MIN_BAND) ? COMPARE_MIN_BAND : (w > COMPARE_MAX_BAND) ? COMPARE_MAX_BAND : w;
+    }
+
+    pBand->lo = malloc(n * sizeof (int));
+    pBand->hi = malloc(n * sizeof (int));
+    pBand->off = malloc((n + 1) * sizeof (size_t));
+    pBand->step = NULL;
+    if ((pBand->lo == NULL) || (pBand->hi == NULL) || (pBand->off == NULL)) {
+        fprintf(stderr, "Failed to alloc WarpBand arrays !!!\n");
+        freeWarpBand(pBand);
+        free(anchors);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        double d = cmpDist(pA, i);
+        double target;
+
+        while (((k + 1) < numAnchors) && (anchors[k + 1].i <= i)) {
+            k++;
+        }
+
+        if (numAnchors != 0) {
+            const WarpAnchor *a1 = &anchors[k];
+            const WarpAnchor *a2 = &anchors[k + 1];
+
+            if ((i < a1->i) || ((k + 1) == numAnchors)) {
+                target = cmpDist(pB, a1->j) + (d - cmpDist(pA, a1->i));
+            } else {
+                double len = cmpDist(pA, a2->i) - cmpDist(pA, a1->i);
+                double f = (len > 0.0) ? ((d - cmpDist(pA, a1->i)) / len) : 0.0;
+                target = cmpDist(pB, a1->j) + f * (cmpDist(pB, a2->j) - cmpDist(pB, a1->j));
+            }
+        } else if (d < dA0) {
+            target = dB0 + (d - dA0);
+        } else if (d > dA1) {
+            target = dB1 + (d - dA1);
+        } else {
+            target = dB0 + (d - dA0) * scale;
+        }
+
+        while ((j < (m - 1)) && (cmpDist(pB, j + 1) <= target)) {
+            j++;
+        }
+        pBand->lo[i] = (j > w) ? (j - w) : 0;
+        pBand->hi[i] = ((j + w) < m) ? (j + w) : (m - 1);
+
+        // The TrkPt's before/after the overlap can only be
+        // matched with the first/last TrkPt of the overlap.
+        if (overlap && (i < i0)) {
+            pBand->lo[i] = pBand->hi[i] = j0;
+        } else if (overlap && (i > i1)) {
+            pBand->lo[i] = pBand->hi[i] = j1;
+        }
+    }
+
+    // The path must go from the first to the last cell of
+    // the matrix, without skipping any rows.
+    pBand->lo[0] = 0;
+    pBand->hi[n - 1] = m - 1;
+    pBand->off[0] = 0;
+    for (int i = 0; i < n; i++) {
+        if ((i > 0) && (pBand->lo[i] > (pBand->hi[i - 1] + 1))) {
+            pBand->lo[i] = pBand->hi[i - 1] + 1;
+        }
+        pBand->off[i + 1] = pBand->off[i] + (pBand->hi[i] - pBand->lo[i] + 1);
+    }
+
+    free(anchors);
+
+    if ((pBand->step = malloc(pBand->off[n])) == NULL) {
+        fprintf(stderr, "Failed to alloc WarpBand matrix !!!\n");
+        freeWarpBand(pBand);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Find the warping path with the lowest total offset. The
+// cells of the path are returned in 'pathI[]' and 'pathJ[]'.
+static int warpPath(const CmpTrk *pA, const CmpTrk *pB, WarpBand *pBand, int *pathI, int *pathJ)
+{
+    int n = pA->numPts;
+    int maxW = 0;
+    double *prev, *cur;
+    int len = 0;
+
+    for (int i = 0; i < n; i++) {
+        int w = pBand->hi[i] - pBand->lo[i] + 1;
+        maxW = (w > maxW) ? w : maxW;
+    }
+
+    prev = malloc(maxW * sizeof (double));
+    cur = malloc(maxW * sizeof (double));
+    if ((prev == NULL) || (cur == NULL)) {
+        fprintf(stderr, "Failed to alloc DTW rows !!!\n");
+        free(prev);
+        free(cur);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int lo = pBand->lo[i];
+        int hi = pBand->hi[i];
+        int pLo = (i > 0) ? pBand->lo[i - 1] : 0;
+        int pHi = (i > 0) ? pBand->hi[i - 1] : -1;
+        uint8_t *step = &pBand->step[pBand->off[i]];
+
+        for (int j = lo; j <= hi; j++) {
+            double best = HUGE_VAL;
+            uint8_t s = STEP_DIAG;
+
+            if ((i == 0) && (j == 0)) {
+                best = 0.0;
+            } else {
+                if (((j - 1) >= pLo) && ((j - 1) <= pHi)) {
+                    best = prev[j - 1 - pLo];
+                }
+                if ((j >= pLo) && (j <= pHi) && (prev[j - pLo] < best)) {
+                    best = prev[j - pLo];
+                    s = STEP_UP;
+                }
+                if ((j > lo) && (cur[j - 1 - lo] < best)) {
+                    best = cur[j - 1 - lo];
+                    s = STEP_LEFT;
+                }
+            }
+
+            cur[j - lo] = best + cmpOffset(pA, i, pB, j);
+            step[j - lo] = s;
+        }
+
+        {
+            double *tmp = prev;
+            prev = cur;
+            cur = tmp;
+        }
+    }
+
+    free(prev);
+    free(cur);
+
+    // Trace the path back from the last cell
+    {
+        int i = n - 1;
+        int j = pB->numPts - 1;
+
+        for (;;) {
+            pathI[len] = i;
+            pathJ[len] = j;
+            len++;
+            if ((i == 0) && (j == 0))
+                break;
+            switch (pBand->step[pBand->off[i] + (j - pBand->lo[i])]) {
+            case STEP_DIAG:
+                i--;
+                j--;
+                break;
+            case STEP_UP:
+                i--;
+                break;
+            default:
+                j--;
+                break;
+            }
+        }
+    }
+
+    // Put it in forward order
+    for (int k = 0; k < (len / 2); k++) {
+        int ti = pathI[k], tj = pathJ[k];
+        pathI[k] = pathI[len - 1 - k];
+        pathJ[k] = pathJ[len - 1 - k];
+        pathI[len - 1 - k] = ti;
+        pathJ[len - 1 - k] = tj;
+    }
+
+    return len;
+}
+
+// Elevation of the reference track at the position of the
+// TrkPt 'i' of the track, which is matched with the TrkPt 'j'
+// of the reference track.
+static double refElevation(const CmpTrk *pA, int i, const CmpTrk *pB, int j)
+{
+    for (int k = (j - 1); k <= j; k++) {
+        double dx, dy, len2, t;
+
+        if ((k < 0) || ((k + 1) >= pB->numPts))
+            continue;
+
+        dx = pB->x[k + 1] - pB->x[k];
+        dy = pB->y[k + 1] - pB->y[k];
+        if ((len2 = (dx * dx + dy * dy)) == 0.0)
+            continue;
+
+        t = ((pA->x[i] - pB->x[k]) * dx + (pA->y[i] - pB->y[k]) * dy) / len2;
+        if ((t >= 0.0) && (t <= 1.0)) {
+            return pB->elev[k] + t * (pB->elev[k + 1] - pB->elev[k]);
+        }
+    }
+
+    return pB->elev[j];
+}
+
+// Replace the elevation values with those of the reference
+// track. Within the divergent sections the original values
+// are kept, shifted to join the copied values at both ends.
+static void transplantElevation(const CmpTrk *pA, const CmpTrk *pB, const int *match, const double *offset)
+{
+    int n = pA->numPts;
+    double *delta;
+
+    if ((delta = malloc(n * sizeof (double))) == NULL) {
+        fprintf(stderr, "Failed to alloc elevation deltas !!!\n");
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        delta[i] = (offset[i] <= COMPARE_MAX_OFFSET) ?
+                   (refElevation(pA, i, pB, match[i]) - pA->elev[i]) : NAN;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (isnan(delta[i])) {
+            int a = i, b = i;
+            double d1, d2;
+
+            while (((b + 1) < n) && isnan(delta[b + 1]))
+                b++;
+            d1 = (a > 0) ? delta[a - 1] : NAN;
+            d2 = ((b + 1) < n) ? delta[b + 1] : NAN;
+            for (int k = a; k <= b; k++) {
+                if (isnan(d1) && isnan(d2)) {
+                    delta[k] = 0.0;
+                } else if (isnan(d1)) {
+                    delta[k] = d2;
+                } else if (isnan(d2)) {
+                    delta[k] = d1;
+                } else {
+                    double len = cmpDist(pA, b + 1) - cmpDist(pA, a - 1);
+                    double f = (len > 0.0) ? ((cmpDist(pA, k) - cmpDist(pA, a - 1)) / len) : 0.5;
+                    delta[k] = d1 + f * (d2 - d1);
+                }
+            }
+            i = b;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        pA->pts[i]->elevation += delta[i];
+    }
+
+    free(delta);
+}
+
+int compareTrks(GpsTrk *pTrk, CmdArgs *pArgs, const char *refFile, Bool transplant)
+{
+    const PackedTrk *pRef;
+    CmpTrk ctA = {0}, ctB = {0};
+    WarpBand band = {0};
+    int *pathI = NULL, *pathJ = NULL;
+    int *match = NULL;
+    double *offset = NULL;
+    int n, m, len;
+    int s = -1;
+
+    if (TAILQ_FIRST(&pTrk->trkPtList) == NULL) {
+        fprintf(stderr, "No track points to compare\n");
+        return -1;
+    }
+
+    if ((pRef = loadRefTrk(pTrk, pArgs, refFile)) == NULL) {
+        return -1;
+    }
+
+    if ((newCmpTrk(&ctA, pTrk, TAILQ_FIRST(&pTrk->trkPtList)) != 0) ||
+        (newRefCmpTrk(&ctB, pRef, TAILQ_FIRST(&pTrk->trkPtList)) != 0)) {
+        goto done;
+    }
+    n = ctA.numPts;
+    m = ctB.numPts;
+
+    pathI = malloc((n + m) * sizeof (int));
+    pathJ = malloc((n + m) * sizeof (int));
+    match = malloc(n * sizeof (int));
+    offset = malloc(n * sizeof (double));
+    if ((pathI == NULL) || (pathJ == NULL) || (match == NULL) || (offset == NULL)) {
+        fprintf(stderr, "Failed to alloc DTW path !!!\n");
+        goto done;
+    }
+
+    if ((newWarpBand(&band, &ctA, &ctB) != 0) ||
+        ((len = warpPath(&ctA, &ctB, &band, pathI, pathJ)) < 0)) {
+        goto done;
+    }
+
+    // Each TrkPt is matched with the closest TrkPt of the
+    // reference track along the path.
+    for (int i = 0; i < n; i++) {
+        offset[i] = HUGE_VAL;
+    }
+    for (int k = 0; k < len; k++) {
+        double d = cmpOffset(&ctA, pathI[k], &ctB, pathJ[k]);
+        if (d < offset[pathI[k]]) {
+            offset[pathI[k]] = d;
+            match[pathI[k]] = pathJ[k];
+        }
+    }
+
+    fprintf(pArgs->outFile, "Reference: %s: %d TrkPt's, %.3lf km\n", refFile, m, mToKm(cmpDist(&ctB, m - 1)));
+    fprintf(pArgs->outFile, "    Track: %d TrkPt's, %.3lf km\n", n, mToKm(cmpDist(&ctA, n - 1)));
+
+    // Position and elevation agreement
+    {
+        double sumOff = 0.0, maxOff = 0.0;
+        double sumDiff = 0.0, sumDiff2 = 0.0, maxDiff = 0.0;
+        int maxOffPt = 0, maxDiffPt = 0;
+        int numMatched = 0;
+
+        for (int i = 0; i < n; i++) {
+            sumOff += offset[i];
+            if (offset[i] > maxOff) {
+                maxOff = offset[i];
+                maxOffPt = i;
+            }
+            if (offset[i] <= COMPARE_MAX_OFFSET) {
+                double diff = ctA.elev[i] - refElevation(&ctA, i, &ctB, match[i]);
+                sumDiff += diff;
+                sumDiff2 += diff * diff;
+                if (fabs(diff) > fabs(maxDiff)) {
+                    maxDiff = diff;
+                    maxDiffPt = i;
+                }
+                numMatched++;
+            }
+        }
+
+        fprintf(pArgs->outFile, "   Offset: mean=%.1lf m max=%.1lf m @ TrkPt #%d\n",
+                (sumOff / n), maxOff, ctA.index[maxOffPt]);
+        if (numMatched != 0) {
+            fprintf(pArgs->outFile, "ElevDelta: mean=%.1lf m rms=%.1lf m max=%.1lf m @ TrkPt #%d\n",
+                    (sumDiff / numMatched), sqrt(sumDiff2 / numMatched), maxDiff, ctA.index[maxDiffPt]);
+        }
+    }
+
+    // Divergent sections: runs of path cells where the two
+    // tracks are too far apart.
+    {
+        int numDivs = 0;
+
+        for (int k = 0; k < len; k++) {
+            int k0 = k;
+            double maxOff = 0.0;
+            int i0, i1, j0, j1;
+
+            if (cmpOffset(&ctA, pathI[k], &ctB, pathJ[k]) <= COMPARE_MAX_OFFSET)
+                continue;
+
+            while (((k + 1) < len) && (cmpOffset(&ctA, pathI[k + 1], &ctB, pathJ[k + 1]) > COMPARE_MAX_OFFSET))
+                k++;
+            for (int kk = k0; kk <= k; kk++) {
+                double d = cmpOffset(&ctA, pathI[kk], &ctB, pathJ[kk]);
+                maxOff = (d > maxOff) ? d : maxOff;
+            }
+
+            i0 = pathI[k0];
+            i1 = pathI[k];
+            j0 = pathJ[k0];
+            j1 = pathJ[k];
+            if (((cmpDist(&ctA, i1) - cmpDist(&ctA, i0)) < COMPARE_MIN_DIV_LEN) &&
+                ((cmpDist(&ctB, j1) - cmpDist(&ctB, j0)) < COMPARE_MIN_DIV_LEN))
+                continue;
+
+            if (numDivs++ == 0) {
+                fprintf(pArgs->outFile, "<from>,<to>,<start>,<length>,<refFrom>,<refTo>,<refStart>,<refLength>,<maxOffset>\n");
+            }
+            fprintf(pArgs->outFile, "%d,%d,%.3lf,%.3lf,%d,%d,%.3lf,%.3lf,%.1lf\n",
+                    ctA.index[i0], ctA.index[i1],
+                    mToKm(cmpDist(&ctA, i0)), mToKm(cmpDist(&ctA, i1) - cmpDist(&ctA, i0)),
+                    ctB.index[j0], ctB.index[j1],
+                    mToKm(cmpDist(&ctB, j0)), mToKm(cmpDist(&ctB, j1) - cmpDist(&ctB, j0)),
+                    maxOff);
+        }
+
+        if (numDivs == 0) {
+            fprintf(pArgs->outFile, "No divergent sections found.\n");
+        }
+    }
+
+    if (transplant) {
+        transplantElevation(&ctA, &ctB, match, offset);
+    }
+
+    s = 0;
+
+done:
+    free(pathI);
+    free(pathJ);
+    free(match);
+    free(offset);
+    freeWarpBand(&band);
+    freeCmpTrk(&ctA);
+    freeCmpTrk(&ctB);
+
+    return s;
+}
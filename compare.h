@@ -0,0 +1,19 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compare the track with the one in the specified reference
+// file: the two tracks are aligned by position using dynamic
+// time warping, and the offset between them, the difference
+// in their elevation values, and the sections where they
+// diverge are reported. If 'transplant' is set the elevation
+// values of the reference track are copied over.
+extern int compareTrks(GpsTrk *pTrk, CmdArgs *pArgs, const char *refFile, Bool transplant);
+
+#ifdef __cplusplus
+};
+#endif
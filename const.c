@@ -1,3 +1,5 @@
+#include <time.h>
+
 // This constant indicates a nil/unspec distance value
 const double nilDist = -9999.99;
 
@@ -15,5 +17,10 @@ const double earthMeanRadius = (double) 6372797.560856;  // in meters
 const double kmToMile = (double) 0.621371;
 const double meterToFoot = (double) 3.28084;
 
+// FIT uses December 31, 1989 UTC as their Epoch. See below
+// for the details:
+//   https://developer.garmin.com/fit/cookbook/datetime/
+const time_t fitEpoch = 631065600;
+
 // Banner line used in CSV files
 const char *csvBannerLine = "<trkPt>,<inFile>,<lineNum>,<time>,<latitude>,<longitude>,<elevation>,<distance>,<speed>,<grade>";
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <time.h>
+
 extern const double nilDist;            // nil/undefined distance value
 extern const double nilElev;            // nil/undefined elevation value
 extern const double nilGrade;           // nil/undefined grade/slope value
@@ -10,5 +12,8 @@ extern const double earthMeanRadius;    // Mean radius of Earth, in meters
 extern double kmToMile;
 extern double meterToFoot;
 
+// FIT Epoch (December 31, 1989 UTC), in s since the UTC Epoch
+extern const time_t fitEpoch;
+
 // Banner line used in CSV files
 extern const char *csvBannerLine;
@@ -0,0 +1,296 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "curve.h"
+#include "pool.h"
+
+// The values of the metric are laid out on a 1-second time
+// grid, using the value of each TrkPt for the seconds since
+// the previous TrkPt. Gaps longer than CURVE_MAX_GAP seconds
+// (e.g. the device was paused) are filled with zeros.
+#define CURVE_MAX_GAP       10
+
+// The start times are split into blocks of CURVE_BLOCK_SIZE
+// seconds, and a block is only scanned when the upper bound
+// of its sums can beat the best sum found so far for the
+// current duration. The bound is the max of the prefix sums
+// at the end of the windows, which is found with a sparse
+// table, minus the min of the prefix sums at their start.
+#define CURVE_BLOCK_SIZE    64
+
+// The durations are split into buckets of CURVE_BUCKET_SIZE
+// durations each, which are processed in parallel.
+#define CURVE_BUCKET_SIZE   256
+
+typedef struct CurveCtx {
+    MeanMaxCurve *pCurve;
+    int numSecs;        // length of the time grid
+    double *sum;        // prefix sums of the grid values
+    double **maxTbl;    // sparse table of max prefix sums
+    int numLevels;
+    double *blkMin;     // min prefix sum in each block
+    int numBlocks;
+} CurveCtx;
+
+static double sampleValue(const TrkPt *p, CurveMetric metric)
+{
+    switch (metric) {
+    case cmCadence:
+        return p->cadence;
+    case cmHeartRate:
+        return p->heartRate;
+    case cmPower:
+        return p->power;
+    default:
+        return p->speed;
+    }
+}
+
+// Max of sum[from..to]
+static double maxSum(const CurveCtx *pCtx, int from, int to)
+{
+    int k = 31 - __builtin_clz(to - from + 1);
+    double m1 = pCtx->maxTbl[k][from];
+    double m2 = pCtx->maxTbl[k][to - (1 << k) + 1];
+
+    return (m1 > m2) ? m1 : m2;
+}
+
+static void bestEffort(const CurveCtx *pCtx, int dur, int *pSeed)
+{
+    const double *sum = pCtx->sum;
+    int lastStart = pCtx->numSecs - dur;
+    double bestSum = -HUGE_VAL;
+    int bestStart = 0;
+
+    // The best start for the previous duration is usually
+    // close to the best one for this duration, so start
+    // from there to get a tight bound early on.
+    if (*pSeed >= 0) {
+        for (int t = *pSeed - 1; t <= *pSeed + 1; t++) {
+            if ((t >= 0) && (t <= lastStart) && ((sum[t + dur] - sum[t]) > bestSum)) {
+                bestSum = sum[t + dur] - sum[t];
+                bestStart = t;
+            }
+        }
+    }
+
+    for (int b = 0; (b * CURVE_BLOCK_SIZE) <= lastStart; b++) {
+        int from = b * CURVE_BLOCK_SIZE;
+        int to = ((from + CURVE_BLOCK_SIZE - 1) < lastStart) ? (from + CURVE_BLOCK_SIZE - 1) : lastStart;
+
+        if ((maxSum(pCtx, from + dur, to + dur) - pCtx->blkMin[b]) <= bestSum) {
+            continue;
+        }
+
+        for (int t = from; t <= to; t++) {
+            if ((sum[t + dur] - sum[t]) > bestSum) {
+                bestSum = sum[t + dur] - sum[t];
+                bestStart = t;
+            }
+        }
+    }
+
+    pCtx->pCurve->value[dur] = bestSum / dur;
+    pCtx->pCurve->start[dur] = bestStart;
+    *pSeed = bestStart;
+}
+
+static void bucketWorker(void *arg, int item)
+{
+    const CurveCtx *pCtx = arg;
+    int from = (item * CURVE_BUCKET_SIZE) + 1;
+    int to = ((from + CURVE_BUCKET_SIZE - 1) < pCtx->numSecs) ? (from + CURVE_BUCKET_SIZE - 1) : pCtx->numSecs;
+    int seed = -1;
+
+    for (int dur = from; dur <= to; dur++) {
+        bestEffort(pCtx, dur, &seed);
+    }
+}
+
+// Lay out the values of the metric on the time grid, and
+// compute their prefix sums.
+static int buildGrid(GpsTrk *pTrk, CurveMetric metric, CurveCtx *pCtx)
+{
+    const TrkPt *p, *p0 = TAILQ_FIRST(&pTrk->trkPtList);
+    const TrkPt *pLast = TAILQ_LAST(&pTrk->trkPtList, TrkPtList);
+    int prevSec = 0;
+
+    pCtx->numSecs = (int) floor(pLast->timestamp - p0->timestamp);
+    if (pCtx->numSecs <= 0) {
+        return 0;
+    }
+
+    if ((pCtx->sum = malloc((pCtx->numSecs + 1) * sizeof (double))) == NULL) {
+        fprintf(stderr, "Failed to alloc time grid !!!\n");
+        return -1;
+    }
+
+    pCtx->sum[0] = 0.0;
+    for (p = TAILQ_NEXT(p0, tqEntry); p != NULL; p = TAILQ_NEXT(p, tqEntry)) {
+        int sec = (int) floor(p->timestamp - p0->timestamp);
+        double value = ((sec - prevSec) > CURVE_MAX_GAP) ? 0.0 : sampleValue(p, metric);
+
+        for (int s = prevSec + 1; s <= sec; s++) {
+            pCtx->sum[s] = pCtx->sum[s - 1] + value;
+        }
+        if (sec > prevSec) {
+            prevSec = sec;
+        }
+    }
+
+    return 0;
+}
+
+static int buildTables(CurveCtx *pCtx)
+{
+    int numSums = pCtx->numSecs + 1;
+
+    pCtx->numLevels = 32 - __builtin_clz(numSums);
+    if ((pCtx->maxTbl = calloc(pCtx->numLevels, sizeof (double *))) == NULL) {
+        return -1;
+    }
+    for (int k = 0; k < pCtx->numLevels; k++) {
+        int len = numSums - (1 << k) + 1;
+
+        if ((pCtx->maxTbl[k] = malloc(len * sizeof (double))) == NULL) {
+            return -1;
+        }
+        for (int i = 0; i < len; i++) {
+            if (k == 0) {
+                pCtx->maxTbl[k][i] = pCtx->sum[i];
+            } else {
+                double m1 = pCtx->maxTbl[k - 1][i];
+                double m2 = pCtx->maxTbl[k - 1][i + (1 << (k - 1))];
+                pCtx->maxTbl[k][i] = (m1 > m2) ? m1 : m2;
+            }
+        }
+    }
+
+    pCtx->numBlocks = (numSums + CURVE_BLOCK_SIZE - 1) / CURVE_BLOCK_SIZE;
+    if ((pCtx->blkMin = malloc(pCtx->numBlocks * sizeof (double))) == NULL) {
+        return -1;
+    }
+    for (int b = 0; b < pCtx->numBlocks; b++) {
+        pCtx->blkMin[b] = HUGE_VAL;
+    }
+    for (int i = 0; i < numSums; i++) {
+        int b = i / CURVE_BLOCK_SIZE;
+        if (pCtx->sum[i] < pCtx->blkMin[b]) {
+            pCtx->blkMin[b] = pCtx->sum[i];
+        }
+    }
+
+    return 0;
+}
+
+static void freeCtx(CurveCtx *pCtx)
+{
+    if (pCtx->maxTbl != NULL) {
+        for (int k = 0; k < pCtx->numLevels; k++) {
+            free(pCtx->maxTbl[k]);
+        }
+        free(pCtx->maxTbl);
+    }
+    free(pCtx->blkMin);
+    free(pCtx->sum);
+}
+
+MeanMaxCurve *compMeanMaxCurve(GpsTrk *pTrk, const CmdArgs *pArgs, CurveMetric metric)
+{
+    CurveCtx ctx = {0};
+    MeanMaxCurve *pCurve;
+
+    if ((pCurve = calloc(1, sizeof (MeanMaxCurve))) == NULL) {
+        fprintf(stderr, "Failed to alloc MeanMaxCurve object !!!\n");
+        return NULL;
+    }
+    pCurve->metric = metric;
+
+    if (TAILQ_FIRST(&pTrk->trkPtList) == NULL) {
+        return pCurve;
+    }
+
+    if (buildGrid(pTrk, metric, &ctx) != 0) {
+        goto error;
+    }
+
+    if ((pCurve->maxDur = ctx.numSecs) == 0) {
+        return pCurve;
+    }
+
+    pCurve->value = malloc((pCurve->maxDur + 1) * sizeof (double));
+    pCurve->start = malloc((pCurve->maxDur + 1) * sizeof (int));
+    if ((pCurve->value == NULL) || (pCurve->start == NULL) ||
+        (buildTables(&ctx) != 0)) {
+        fprintf(stderr, "Failed to alloc MeanMaxCurve tables !!!\n");
+        goto error;
+    }
+    pCurve->value[0] = 0.0;
+    pCurve->start[0] = 0;
+
+    ctx.pCurve = pCurve;
+    poolRun(((ctx.numSecs + CURVE_BUCKET_SIZE - 1) / CURVE_BUCKET_SIZE), bucketWorker, &ctx);
+
+    freeCtx(&ctx);
+
+    return pCurve;
+
+error:
+    freeCtx(&ctx);
+    freeMeanMaxCurve(pCurve);
+    return NULL;
+}
+
+static double curveValue(const MeanMaxCurve *pCurve, int dur)
+{
+    double value = pCurve->value[dur];
+
+    return (pCurve->metric == cmSpeed) ? mpsToKph(value) : value;
+}
+
+static const char *fmtDuration(int dur)
+{
+    static char fmtBuf[32];
+
+    snprintf(fmtBuf, sizeof (fmtBuf), "%02d:%02d:%02d", (dur / 3600), ((dur % 3600) / 60), (dur % 60));
+
+    return fmtBuf;
+}
+
+void printMeanMaxCurve(const MeanMaxCurve *pCurve, FILE *fp, Bool all)
+{
+    static const int stdDurs[] = { 1, 2, 3, 5, 10, 15, 20, 30, 60, 120, 180, 300, 480, 600, 1200, 1800, 2700, 3600, 5400, 7200, 10800, 14400, 0 };
+    static const char *units[] = { "", "rpm", "bpm", "W", "km/h" };
+
+    fprintf(fp, "<duration>,<value> [%s],<start>\n", units[pCurve->metric]);
+
+    if (all) {
+        for (int dur = 1; dur <= pCurve->maxDur; dur++) {
+            fprintf(fp, "%d,%.3lf,%d\n", dur, curveValue(pCurve, dur), pCurve->start[dur]);
+        }
+    } else {
+        int dur = 0;
+
+        for (int n = 0; (stdDurs[n] != 0) && (stdDurs[n] <= pCurve->maxDur); n++) {
+            dur = stdDurs[n];
+            fprintf(fp, "%s,%.3lf,", fmtDuration(dur), curveValue(pCurve, dur));
+            fprintf(fp, "%s\n", fmtDuration(pCurve->start[dur]));
+        }
+        if (pCurve->maxDur != dur) {
+            // The whole ride
+            fprintf(fp, "%s,%.3lf,", fmtDuration(pCurve->maxDur), curveValue(pCurve, pCurve->maxDur));
+            fprintf(fp, "%s\n", fmtDuration(pCurve->start[pCurve->maxDur]));
+        }
+    }
+}
+
+void freeMeanMaxCurve(MeanMaxCurve *pCurve)
+{
+    if (pCurve != NULL) {
+        free(pCurve->value);
+        free(pCurve->start);
+        free(pCurve);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Metrics that support a mean-maximal curve
+typedef enum CurveMetric {
+    cmCadence = 1,
+    cmHeartRate = 2,
+    cmPower = 3,
+    cmSpeed = 4,
+} CurveMetric;
+
+// Mean-maximal curve: for each duration d (in seconds) from 1
+// to maxDur, the best average value of the metric over any
+// d-second stretch of the ride, and its start time.
+typedef struct MeanMaxCurve {
+    CurveMetric metric;
+    int maxDur;
+    double *value;      // value[d], in the same units as the TrkPt
+    int *start;         // start[d], in seconds since the start of the ride
+} MeanMaxCurve;
+
+// Compute the mean-maximal curve of the specified metric.
+// Returns NULL on error.
+extern MeanMaxCurve *compMeanMaxCurve(GpsTrk *pTrk, const CmdArgs *pArgs, CurveMetric metric);
+
+// Print the curve at the standard durations, or at every
+// duration if 'all' is true.
+extern void printMeanMaxCurve(const MeanMaxCurve *pCurve, FILE *fp, Bool all);
+
+extern void freeMeanMaxCurve(MeanMaxCurve *pCurve);
+
+#ifdef __cplusplus
+};
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdio.h>
+#include <time.h>
 #include <sys/queue.h>
 
 #define PROG_VER_MAJOR  1
@@ -28,9 +29,17 @@ typedef enum OutFmt {
     csv = 1,    // Comma-Separated-Values format
     gpx = 2,    // GPS Exchange format
     shiz = 3,   // FulGaz format
-    tcx = 4     // Training Center Exchange format
+    tcx = 4,    // Training Center Exchange format
+    fit = 5     // Garmin binary FIT format
 } OutFmt;
 
+// Compression type
+typedef enum CompType {
+    noComp = 0, // not compressed
+    gzip = 1,   // gzip (deflate) format
+    zstd = 2    // Zstandard format
+} CompType;
+
 // Timestamp format
 typedef enum TsFmt {
     utc = 0,    // YYYY-MM-DD HH:MM:SS
@@ -61,13 +70,20 @@ typedef struct TrkPtRange {
 
 #define MAX_ARGS    8
 
+#define MAX_ACT_METRICS 4
+
 typedef struct CmdArgs {
     const char *inFile;     // input file name
 
     Bool noCli;             // don't start the interactive CLI
+    CompType compType;      // output compression type
+    int compLevel;          // output compression level (0=default)
     FILE *outFile;          // output file
     OutFmt outFmt;          // format of the output data (csv, shiz)
     Bool quiet;             // don't print any warning messages
+    Bool stream;            // pipeline the parse/check/compute/output stages
+    Bool merge;             // merge the input files by timestamp
+    int mergePref;          // prefer the input files with this sensor data (SD_xxx)
     TsFmt tsFmt;            // format of the timestamp value
     Units units;            // type of units to display
     Bool verbatim;          // no data adjustments
@@ -77,6 +93,8 @@ typedef struct CmdArgs {
     char *argv[MAX_ARGS];   // list of arguments
     Bool detail;            // show detailed information
     ActMetric actMetric;    // activity metric to use
+    int numActMetrics;      // number of metrics in the list
+    ActMetric actMetrics[MAX_ACT_METRICS];  // list of activity metrics to use
     int smaWindow;          // SMA window size
     TrkPtRange range;       // TrkPt range
     double scaleFactor;     // scaling factor
@@ -129,6 +147,9 @@ typedef struct TrkPt {
     double adjVal;      // adjusted metric
 } TrkPt;
 
+struct PackedTrk;
+struct TrkPipe;
+
 // GPS Track (sequence of Track Points)
 typedef struct GpsTrk {
     // List of TrkPt's
@@ -140,6 +161,10 @@ typedef struct GpsTrk {
     // Number of TrkPt's in trkPtList
     int numTrkPts;
 
+    // When not NULL, the parsed TrkPt's are fed into this
+    // processing pipeline instead of the trkPtList.
+    struct TrkPipe *pipe;
+
     // Number of TrkPt's that had their elevation values
     // adjusted to match the min/max grade levels.
     int numElevAdj;
@@ -151,6 +176,32 @@ typedef struct GpsTrk {
     // Number of TrkPt's trimmed out (by user request)
     int numTrimTrkPts;
 
+    // Range of TrkPt's modified by an edit operation, whose
+    // metrics need to be recomputed.
+    Bool dirty;
+    Bool dirtyElev;                 // elevation values were modified
+    Bool dirtyGrade;                // grade values were modified
+    TrkPtRange dirtyRange;
+
+    // Climbs and descents found in the track; cached
+    // until the TrkPt's are modified.
+    struct ClimbList *climbs;
+
+    // Range aggregates of the track; cached until the
+    // TrkPt's are modified.
+    struct TrkAggr *aggr;
+
+    // Spatial index of the TrkPt's; cached until the
+    // TrkPt's are modified.
+    struct GeoGrid *grid;
+
+    // Reference track (e.g. for 'compare' or 'sync') in the
+    // packed layout; kept across commands until its file is
+    // modified or another one is used.
+    struct PackedTrk *refTrk;
+    char *refFile;
+    time_t refMTime;
+
     // Number of dummy TrkPt's discarded; e.g. because
     // of a null deltaT or a null deltaD.
     int numDiscTrkPts;
@@ -165,6 +216,10 @@ typedef struct GpsTrk {
     double startTime;
     double endTime;
 
+    // Offset (in seconds) between the video and the track,
+    // as written to the SHIZ header.
+    int timeShift;
+
     // Base distance/time
     double baseDistance;            // distance reference to generate relative distance values
     double baseTime;                // time reference to generate relative timestamp values
@@ -0,0 +1,295 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "const.h"
+#include "dem.h"
+
+// SRTM tiles cover 1x1 degree, and are named after the
+// latitude/longitude of their SW corner: e.g. N43W115.hgt.
+// They hold a grid of NxN big-endian 16-bit elevation values
+// (in meters), stored row by row from North to South. The
+// edges of a tile overlap those of its neighbors.
+#define SRTM1_SIZE  3601    // 1 arc-second
+#define SRTM3_SIZE  1201    // 3 arc-second
+#define SRTM_VOID   -32768  // no data
+
+// Max number of tiles kept mapped in memory
+#define DEM_CACHE_SIZE  16
+
+// DEM tile
+typedef struct DemTile {
+    struct DemTile *prev;   // more recently used
+    struct DemTile *next;   // less recently used
+    int lat;                // latitude of the SW corner
+    int lon;                // longitude of the SW corner
+    int size;               // number of rows/columns
+    const uint8_t *data;    // mapped file (NULL if there is no tile)
+    size_t dataLen;
+} DemTile;
+
+// LRU cache of DEM tiles. Missing tiles are cached too,
+// so that we don't keep looking for them.
+static struct {
+    char *dir;              // directory the tiles came from
+    DemTile *head;          // most recently used
+    DemTile *tail;          // least recently used
+    int numTiles;
+} demCache;
+
+// TrkPt to be looked up, along with the tile it falls in
+typedef struct DemPoint {
+    TrkPt *p;
+    int lat;
+    int lon;
+} DemPoint;
+
+static void demUnlinkTile(DemTile *pTile)
+{
+    if (pTile->prev != NULL)
+        pTile->prev->next = pTile->next;
+    else
+        demCache.head = pTile->next;
+    if (pTile->next != NULL)
+        pTile->next->prev = pTile->prev;
+    else
+        demCache.tail = pTile->prev;
+    pTile->prev = pTile->next = NULL;
+}
+
+static void demLinkTile(DemTile *pTile)
+{
+    pTile->prev = NULL;
+    pTile->next = demCache.head;
+    if (demCache.head != NULL)
+        demCache.head->prev = pTile;
+    else
+        demCache.tail = pTile;
+    demCache.head = pTile;
+}
+
+static void demFreeTile(DemTile *pTile)
+{
+    if (pTile->data != NULL) {
+        munmap((void *) pTile->data, pTile->dataLen);
+    }
+    free(pTile);
+}
+
+static void demFlushCache(void)
+{
+    DemTile *pTile;
+
+    while ((pTile = demCache.head) != NULL) {
+        demUnlinkTile(pTile);
+        demFreeTile(pTile);
+    }
+    demCache.numTiles = 0;
+    free(demCache.dir);
+    demCache.dir = NULL;
+}
+
+// Map the tile file in memory
+static int demMapTile(DemTile *pTile)
+{
+    char path[1024];
+    struct stat st;
+    void *data;
+    int fd;
+
+    snprintf(path, sizeof (path), "%s/%c%02d%c%03d.hgt", demCache.dir,
+             (pTile->lat >= 0) ? 'N' : 'S', abs(pTile->lat),
+             (pTile->lon >= 0) ? 'E' : 'W', abs(pTile->lon));
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == (off_t) (SRTM1_SIZE * SRTM1_SIZE * 2)) {
+        pTile->size = SRTM1_SIZE;
+    } else if (st.st_size == (off_t) (SRTM3_SIZE * SRTM3_SIZE * 2)) {
+        pTile->size = SRTM3_SIZE;
+    } else {
+        fprintf(stderr, "Unsupported DEM tile %s !!!\n", path);
+        close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map DEM tile %s !!!\n", path);
+        return -1;
+    }
+
+    pTile->data = data;
+    pTile->dataLen = st.st_size;
+
+    return 0;
+}
+
+// Get the tile that covers the specified SW corner
+static DemTile *demGetTile(int lat, int lon)
+{
+    DemTile *pTile;
+
+    for (pTile = demCache.head; pTile != NULL; pTile = pTile->next) {
+        if ((pTile->lat == lat) && (pTile->lon == lon)) {
+            // Move it to the head of the LRU list
+            demUnlinkTile(pTile);
+            demLinkTile(pTile);
+            return pTile;
+        }
+    }
+
+    // Evict the least recently used tile
+    if (demCache.numTiles == DEM_CACHE_SIZE) {
+        pTile = demCache.tail;
+        demUnlinkTile(pTile);
+        demFreeTile(pTile);
+        demCache.numTiles--;
+    }
+
+    if ((pTile = calloc(1, sizeof (DemTile))) == NULL) {
+        fprintf(stderr, "Failed to alloc DemTile object !!!\n");
+        return NULL;
+    }
+    pTile->lat = lat;
+    pTile->lon = lon;
+    demMapTile(pTile);
+    demLinkTile(pTile);
+    demCache.numTiles++;
+
+    return pTile;
+}
+
+static inline int demSample(const DemTile *pTile, int row, int col)
+{
+    const uint8_t *s = pTile->data + (((size_t) row * pTile->size + col) * 2);
+    return (int16_t) ((s[0] << 8) | s[1]);
+}
+
+// Bilinear interpolation of the elevation at the specified
+// location. Returns nilElev if there is no data.
+static double demInterpolate(const DemTile *pTile, double lat, double lon)
+{
+    double y = ((double) (pTile->lat + 1) - lat) * (pTile->size - 1);   // rows from the N edge
+    double x = (lon - (double) pTile->lon) * (pTile->size - 1);         // cols from the W edge
+    int row = (int) y;
+    int col = (int) x;
+    double dy, dx;
+    int h00, h01, h10, h11;
+
+    if (row >= (pTile->size - 1))
+        row = pTile->size - 2;
+    if (col >= (pTile->size - 1))
+        col = pTile->size - 2;
+    dy = y - row;
+    dx = x - col;
+
+    h00 = demSample(pTile, row, col);
+    h01 = demSample(pTile, row, col + 1);
+    h10 = demSample(pTile, row + 1, col);
+    h11 = demSample(pTile, row + 1, col + 1);
+
+    if ((h00 == SRTM_VOID) || (h01 == SRTM_VOID) || (h10 == SRTM_VOID) || (h11 == SRTM_VOID)) {
+        // Use the nearest sample, if any
+        int h = demSample(pTile, row + (dy >= 0.5), col + (dx >= 0.5));
+        return (h != SRTM_VOID) ? (double) h : nilElev;
+    }
+
+    return ((h00 * (1.0 - dx) + h01 * dx) * (1.0 - dy) +
+            (h10 * (1.0 - dx) + h11 * dx) * dy);
+}
+
+static int demCmpPoints(const void *a, const void *b)
+{
+    const DemPoint *p1 = a;
+    const DemPoint *p2 = b;
+
+    if (p1->lat != p2->lat)
+        return (p1->lat < p2->lat) ? -1 : 1;
+    if (p1->lon != p2->lon)
+        return (p1->lon < p2->lon) ? -1 : 1;
+
+    return 0;
+}
+
+int demElevation(GpsTrk *pTrk, const CmdArgs *pArgs, const char *demDir)
+{
+    DemPoint *points;
+    int numPoints = 0;
+    int numMissing = 0;
+    TrkPt *p;
+
+    // The tiles cached are only good for the same directory
+    if ((demCache.dir != NULL) && (strcmp(demCache.dir, demDir) != 0)) {
+        demFlushCache();
+    }
+    if ((demCache.dir == NULL) && ((demCache.dir = strdup(demDir)) == NULL)) {
+        return -1;
+    }
+
+    if ((points = malloc(pTrk->numTrkPts * sizeof (DemPoint))) == NULL) {
+        fprintf(stderr, "Failed to alloc DemPoint array !!!\n");
+        return -1;
+    }
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((p->index >= pArgs->range.from) && (p->index <= pArgs->range.to) &&
+            (numPoints < pTrk->numTrkPts)) {
+            DemPoint *dp = &points[numPoints++];
+            dp->p = p;
+            dp->lat = (int) floor(p->latitude);
+            dp->lon = (int) floor(p->longitude);
+        }
+    }
+
+    // Sort the TrkPt's by tile, so that each tile is looked
+    // up only once, and all its TrkPt's are processed while
+    // it's hot in the cache.
+    qsort(points, numPoints, sizeof (DemPoint), demCmpPoints);
+
+    for (int i = 0; i < numPoints; ) {
+        DemTile *pTile = demGetTile(points[i].lat, points[i].lon);
+        int j;
+
+        // Find the end of this tile's batch
+        for (j = i; (j < numPoints) && (points[j].lat == points[i].lat) && (points[j].lon == points[i].lon); j++)
+            ;
+
+        if ((pTile == NULL) || (pTile->data == NULL)) {
+            numMissing += (j - i);
+        } else {
+            for (int k = i; k < j; k++) {
+                double elev = demInterpolate(pTile, points[k].p->latitude, points[k].p->longitude);
+                if (elev != nilElev) {
+                    points[k].p->elevation = elev;
+                } else {
+                    numMissing++;
+                }
+            }
+        }
+
+        i = j;
+    }
+
+    free(points);
+
+    if ((numMissing != 0) && !pArgs->quiet) {
+        fprintf(stderr, "WARNING: No DEM data for %d TrkPt's !\n", numMissing);
+    }
+
+    return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Replace the elevation values of the TrkPt's in the range
+// specified in 'pArgs' with the values interpolated from the
+// SRTM (.hgt) DEM tiles in the specified directory. TrkPt's
+// not covered by any tile keep their elevation value.
+extern int demElevation(GpsTrk *pTrk, const CmdArgs *pArgs, const char *demDir);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,522 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input.h"
+#include "pipe.h"
+#include "trkpt.h"
+
+// GoPro cameras store their telemetry (GPS, IMU, etc.) as a
+// timed metadata track of the MP4 file, in the GoPro Metadata
+// Format (GPMF). The track's sample tables give the location
+// of each GPMF payload within the file, so only the "moov"
+// box and the payloads themselves need to be read; the video
+// data in the "mdat" box is never touched. The file is mapped
+// into memory, which makes it cheap to jump around even when
+// the video is many GB in size.
+//
+// See https://github.com/gopro/gpmf-parser for the details of
+// the GPMF format.
+//
+
+#define GPMF_MAX_SCAL   5   // max number of SCAL values (one per GPS5 element)
+
+// MP4 box
+typedef struct Mp4Box {
+    char type[5];           // four-character code
+    const uint8_t *data;    // box payload
+    uint64_t size;          // payload size
+} Mp4Box;
+
+// Sample tables of the GPMF track
+typedef struct GpmfTrak {
+    uint32_t timeScale;     // time units per second
+    const uint8_t *stts;    // time-to-sample table
+    const uint8_t *stsz;    // sample size table
+    const uint8_t *stsc;    // sample-to-chunk table
+    const uint8_t *stco;    // chunk offset table (32-bit)
+    const uint8_t *co64;    // chunk offset table (64-bit)
+    uint64_t sttsSize, stszSize, stscSize, stcoSize, co64Size;
+} GpmfTrak;
+
+// GPS5 sample
+typedef struct GpsSample {
+    double time;            // in seconds since the start of the video
+    double latitude;        // in degrees decimal
+    double longitude;       // in degrees decimal
+    double elevation;       // in meters
+    double speed;           // 2D speed (in m/s)
+} GpsSample;
+
+// Decoder state
+typedef struct GpmfCtx {
+    GpsSample *samples;     // GPS samples with a valid fix
+    int numSamples;
+    int maxSamples;
+
+    Bool gotUtc;            // found a GPSU value
+    double utcOffset;       // UTC time of the start of the video
+
+    // Current GPMF payload
+    double payloadTime;     // start time of the payload
+    double payloadDur;      // duration of the payload
+} GpmfCtx;
+
+static uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static uint64_t be64(const uint8_t *p)
+{
+    return ((uint64_t) be32(p) << 32) | (uint64_t) be32(p + 4);
+}
+
+// Get the next box in the range [*pp, end), and advance *pp
+// past it. Returns 0 if a box was found, and -1 at the end of
+// the range or if the box is malformed.
+static int nextBox(const uint8_t **pp, const uint8_t *end, Mp4Box *pBox)
+{
+    const uint8_t *p = *pp;
+    uint64_t boxSize, hdrSize = 8;
+
+    if ((end - p) < 8) {
+        return -1;
+    }
+
+    boxSize = be32(p);
+    memcpy(pBox->type, p + 4, 4);
+    pBox->type[4] = '\0';
+
+    if (boxSize == 1) {
+        // 64-bit box size
+        if ((end - p) < 16) {
+            return -1;
+        }
+        boxSize = be64(p + 8);
+        hdrSize = 16;
+    } else if (boxSize == 0) {
+        // The box extends to the end of the file
+        boxSize = end - p;
+    }
+
+    if ((boxSize < hdrSize) || (boxSize > (uint64_t) (end - p))) {
+        return -1;
+    }
+
+    pBox->data = p + hdrSize;
+    pBox->size = boxSize - hdrSize;
+    *pp = p + boxSize;
+
+    return 0;
+}
+
+// Find the first child box of the specified type
+static int findBox(const uint8_t *data, uint64_t size, const char *type, Mp4Box *pBox)
+{
+    const uint8_t *p = data;
+
+    while (nextBox(&p, data + size, pBox) == 0) {
+        if (strcmp(pBox->type, type) == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Find the box at the specified path (e.g. "mdia/minf/stbl")
+static int findBoxPath(const Mp4Box *pParent, const char *path, Mp4Box *pBox)
+{
+    Mp4Box box = *pParent;
+    char type[5];
+
+    while (*path != '\0') {
+        memcpy(type, path, 4);
+        type[4] = '\0';
+        if (findBox(box.data, box.size, type, &box) != 0) {
+            return -1;
+        }
+        path += (path[4] == '/') ? 5 : 4;
+    }
+
+    *pBox = box;
+
+    return 0;
+}
+
+// Check whether the "trak" box holds the GPMF metadata, and
+// if so get its sample tables.
+static int getGpmfTrak(const Mp4Box *pTrak, GpmfTrak *pGpmf)
+{
+    Mp4Box hdlr, mdhd, stbl, stsd, box;
+
+    if ((findBoxPath(pTrak, "mdia/hdlr", &hdlr) != 0) || (hdlr.size < 12) ||
+        (memcmp(hdlr.data + 8, "meta", 4) != 0)) {
+        return -1;
+    }
+
+    if ((findBoxPath(pTrak, "mdia/minf/stbl", &stbl) != 0) ||
+        (findBox(stbl.data, stbl.size, "stsd", &stsd) != 0) || (stsd.size < 16) ||
+        (be32(stsd.data + 4) == 0) || (memcmp(stsd.data + 12, "gpmd", 4) != 0)) {
+        return -1;
+    }
+
+    if (findBoxPath(pTrak, "mdia/mdhd", &mdhd) != 0) {
+        return -1;
+    }
+    if ((mdhd.data[0] == 1) && (mdhd.size >= 24)) {
+        pGpmf->timeScale = be32(mdhd.data + 20);
+    } else if (mdhd.size >= 16) {
+        pGpmf->timeScale = be32(mdhd.data + 12);
+    }
+    if (pGpmf->timeScale == 0) {
+        return -1;
+    }
+
+    if (findBox(stbl.data, stbl.size, "stts", &box) == 0) {
+        pGpmf->stts = box.data;
+        pGpmf->sttsSize = box.size;
+    }
+    if (findBox(stbl.data, stbl.size, "stsz", &box) == 0) {
+        pGpmf->stsz = box.data;
+        pGpmf->stszSize = box.size;
+    }
+    if (findBox(stbl.data, stbl.size, "stsc", &box) == 0) {
+        pGpmf->stsc = box.data;
+        pGpmf->stscSize = box.size;
+    }
+    if (findBox(stbl.data, stbl.size, "stco", &box) == 0) {
+        pGpmf->stco = box.data;
+        pGpmf->stcoSize = box.size;
+    } else if (findBox(stbl.data, stbl.size, "co64", &box) == 0) {
+        pGpmf->co64 = box.data;
+        pGpmf->co64Size = box.size;
+    }
+
+    if ((pGpmf->stts == NULL) || (pGpmf->stsz == NULL) || (pGpmf->stsc == NULL) ||
+        ((pGpmf->stco == NULL) && (pGpmf->co64 == NULL)) ||
+        (pGpmf->sttsSize < 8) || (pGpmf->stszSize < 12) || (pGpmf->stscSize < 8)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Parse a GPSU value ("yymmddhhmmss.sss") into seconds
+// since the Epoch.
+static int parseGpsu(const uint8_t *data, int len, double *pTime)
+{
+    char buf[17];
+    struct tm tm = {0};
+    double sec;
+
+    if (len < 16) {
+        return -1;
+    }
+    memcpy(buf, data, 16);
+    buf[16] = '\0';
+
+    if (sscanf(buf, "%2d%2d%2d%2d%2d%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &sec) != 6) {
+        return -1;
+    }
+    tm.tm_year += 100;
+    tm.tm_mon -= 1;
+
+    *pTime = (double) timegm(&tm) + sec;
+
+    return 0;
+}
+
+static int addGpsSample(GpmfCtx *pCtx, const GpsSample *pSample)
+{
+    if (pCtx->numSamples == pCtx->maxSamples) {
+        int maxSamples = (pCtx->maxSamples != 0) ? (pCtx->maxSamples * 2) : 4096;
+        GpsSample *samples;
+
+        if ((samples = realloc(pCtx->samples, maxSamples * sizeof (GpsSample))) == NULL) {
+            fprintf(stderr, "Failed to alloc GPS samples !!!\n");
+            return -1;
+        }
+        pCtx->samples = samples;
+        pCtx->maxSamples = maxSamples;
+    }
+
+    pCtx->samples[pCtx->numSamples++] = *pSample;
+
+    return 0;
+}
+
+// Walk the KLV (key, length, value) entries of a GPMF payload.
+// The SCAL and GPSF values are sticky within a stream, and
+// apply to the GPSU and GPS5 values that follow them.
+static int parseGpmf(GpmfCtx *pCtx, const uint8_t *p, const uint8_t *end)
+{
+    double scal[GPMF_MAX_SCAL] = {1.0, 1.0, 1.0, 1.0, 1.0};
+    int numScal = 0;
+    uint32_t gpsFix = 3;
+
+    while ((end - p) >= 8) {
+        const uint8_t *key = p;
+        uint8_t type = p[4];
+        uint32_t sampleSize = p[5];
+        uint32_t repeat = be16(p + 6);
+        uint32_t len = sampleSize * repeat;
+        const uint8_t *data = p + 8;
+
+        if ((uint64_t) ((len + 3) & ~3) > (uint64_t) (end - data)) {
+            return -1;
+        }
+        p = data + ((len + 3) & ~3);
+
+        if (type == 0) {
+            // Nested container (e.g. DEVC, STRM)
+            if (parseGpmf(pCtx, data, data + len) != 0) {
+                return -1;
+            }
+        } else if (memcmp(key, "SCAL", 4) == 0) {
+            int elemSize = (type == 'l' || type == 'L') ? 4 : (type == 's' || type == 'S') ? 2 : 0;
+            if (elemSize != 0) {
+                numScal = (len / elemSize < GPMF_MAX_SCAL) ? (len / elemSize) : GPMF_MAX_SCAL;
+                for (int i = 0; i < numScal; i++) {
+                    if (elemSize == 4) {
+                        scal[i] = (type == 'l') ? (int32_t) be32(data + 4 * i) : be32(data + 4 * i);
+                    } else {
+                        scal[i] = (type == 's') ? (int16_t) be16(data + 2 * i) : be16(data + 2 * i);
+                    }
+                    if (scal[i] == 0.0) {
+                        scal[i] = 1.0;
+                    }
+                }
+            }
+        } else if ((memcmp(key, "GPSF", 4) == 0) && (len >= 4)) {
+            gpsFix = be32(data);
+        } else if ((memcmp(key, "GPSU", 4) == 0) && (gpsFix >= 2) && !pCtx->gotUtc) {
+            double utc;
+            if (parseGpsu(data, len, &utc) == 0) {
+                pCtx->utcOffset = utc - pCtx->payloadTime;
+                pCtx->gotUtc = true;
+            }
+        } else if ((memcmp(key, "GPS5", 4) == 0) && (type == 'l') && (sampleSize == 20)) {
+            // Without a 2D/3D fix the location is meaningless
+            if (gpsFix < 2) {
+                continue;
+            }
+
+            // The samples are spread evenly over the payload
+            for (uint32_t i = 0; i < repeat; i++) {
+                const uint8_t *s = data + (i * sampleSize);
+                GpsSample sample;
+
+                sample.time = pCtx->payloadTime + (pCtx->payloadDur * i) / repeat;
+                sample.latitude = (int32_t) be32(s) / scal[0];
+                sample.longitude = (int32_t) be32(s + 4) / ((numScal > 1) ? scal[1] : scal[0]);
+                sample.elevation = (int32_t) be32(s + 8) / ((numScal > 2) ? scal[2] : scal[0]);
+                sample.speed = (int32_t) be32(s + 12) / ((numScal > 3) ? scal[3] : scal[0]);
+                if (addGpsSample(pCtx, &sample) != 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Go through the GPMF payloads in the order given by the
+// sample tables of the track.
+static int parseGpmfTrak(GpmfCtx *pCtx, const GpmfTrak *pGpmf, const uint8_t *file, uint64_t fileSize)
+{
+    uint32_t numSttsEntries = be32(pGpmf->stts + 4);
+    uint32_t numStscEntries = be32(pGpmf->stsc + 4);
+    uint32_t sampleSize = be32(pGpmf->stsz + 4);
+    uint32_t numSamples = be32(pGpmf->stsz + 8);
+    uint32_t numChunks = (pGpmf->stco != NULL) ? be32(pGpmf->stco + 4) : be32(pGpmf->co64 + 4);
+    uint32_t sttsIdx = 0, sttsLeft = 0, sttsDelta = 0;
+    uint32_t stscIdx = 0;
+    uint64_t sampleTime = 0;
+    uint32_t sample = 0;
+
+    if (((8 + (uint64_t) numSttsEntries * 8) > pGpmf->sttsSize) ||
+        ((8 + (uint64_t) numStscEntries * 12) > pGpmf->stscSize) ||
+        ((sampleSize == 0) && ((12 + (uint64_t) numSamples * 4) > pGpmf->stszSize)) ||
+        ((pGpmf->stco != NULL) && ((8 + (uint64_t) numChunks * 4) > pGpmf->stcoSize)) ||
+        ((pGpmf->co64 != NULL) && ((8 + (uint64_t) numChunks * 8) > pGpmf->co64Size))) {
+        fprintf(stderr, "Bogus GPMF sample tables !!!\n");
+        return -1;
+    }
+
+    for (uint32_t chunk = 1; (chunk <= numChunks) && (sample < numSamples); chunk++) {
+        uint64_t offset = (pGpmf->stco != NULL) ? be32(pGpmf->stco + 4 + 4 * chunk) : be64(pGpmf->co64 + 8 * chunk);
+        uint32_t samplesPerChunk;
+
+        // Find the sample-to-chunk entry for this chunk
+        while (((stscIdx + 1) < numStscEntries) &&
+               (be32(pGpmf->stsc + 8 + 12 * (stscIdx + 1)) <= chunk)) {
+            stscIdx++;
+        }
+        samplesPerChunk = (numStscEntries != 0) ? be32(pGpmf->stsc + 8 + 12 * stscIdx + 4) : 0;
+
+        for (uint32_t i = 0; (i < samplesPerChunk) && (sample < numSamples); i++, sample++) {
+            uint32_t size = (sampleSize != 0) ? sampleSize : be32(pGpmf->stsz + 12 + 4 * sample);
+
+            // Get the duration of this sample
+            while ((sttsLeft == 0) && (sttsIdx < numSttsEntries)) {
+                sttsLeft = be32(pGpmf->stts + 8 + 8 * sttsIdx);
+                sttsDelta = be32(pGpmf->stts + 8 + 8 * sttsIdx + 4);
+                sttsIdx++;
+            }
+            if (sttsLeft != 0) {
+                sttsLeft--;
+            }
+
+            if ((offset + size) > fileSize) {
+                fprintf(stderr, "GPMF payload #%u is beyond the end of the file !!!\n", sample);
+                return -1;
+            }
+
+            pCtx->payloadTime = (double) sampleTime / pGpmf->timeScale;
+            pCtx->payloadDur = (double) sttsDelta / pGpmf->timeScale;
+            if (parseGpmf(pCtx, file + offset, file + offset + size) != 0) {
+                fprintf(stderr, "Bogus GPMF payload #%u !!!\n", sample);
+                return -1;
+            }
+
+            offset += size;
+            sampleTime += sttsDelta;
+        }
+    }
+
+    return 0;
+}
+
+// Create the TrkPt's from the GPS samples. The distance is
+// computed by integrating the 2D speed over time.
+static int addGpsTrkPts(GpsTrk *pTrk, const char *inFile, const GpmfCtx *pCtx)
+{
+    double distance = 0.0;
+
+    for (int i = 0; i < pCtx->numSamples; i++) {
+        const GpsSample *s = &pCtx->samples[i];
+        TrkPt *pTrkPt;
+
+        if (i != 0) {
+            const GpsSample *prev = &pCtx->samples[i - 1];
+            distance += 0.5 * (prev->speed + s->speed) * (s->time - prev->time);
+        }
+
+        if ((pTrkPt = newTrkPt(pTrk->numTrkPts++, inFile, i)) == NULL) {
+            fprintf(stderr, "Failed to create TrkPt object !!!\n");
+            return -1;
+        }
+
+        pTrkPt->timestamp = pCtx->utcOffset + s->time;  // in s since UTC Epoch
+        pTrkPt->latitude = s->latitude;
+        pTrkPt->longitude = s->longitude;
+        pTrkPt->elevation = s->elevation;
+        pTrkPt->speed = s->speed;
+        pTrkPt->distance = distance;
+
+        if (pTrk->pipe != NULL) {
+            // Feed the track point into the processing pipeline
+            if (pipePutTrkPt(pTrk->pipe, pTrkPt, SD_NONE) != 0) {
+                return -1;
+            }
+        } else {
+            // Insert track point at the tail of the queue
+            TAILQ_INSERT_TAIL(&pTrk->trkPtList, pTrkPt, tqEntry);
+        }
+    }
+
+    return 0;
+}
+
+// Parse the GPMF telemetry of the GoPro MP4 file and create a
+// list of Track Points (TrkPt's)
+int parseMp4File(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile)
+{
+    GpmfCtx ctx = {0};
+    GpmfTrak gpmf = {0};
+    Mp4Box moov, trak;
+    const uint8_t *file, *p;
+    struct stat st;
+    void *data;
+    int fd;
+    int s = -1;
+
+    if ((fd = open(inFile, O_RDONLY)) < 0) {
+        fprintf(stderr, "Failed to open input file %s\n", inFile);
+        return -1;
+    }
+
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+        fprintf(stderr, "Failed to get the size of input file %s\n", inFile);
+        close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map input file %s !!!\n", inFile);
+        return -1;
+    }
+
+    // Only small, scattered pieces of the file are read
+    madvise(data, st.st_size, MADV_RANDOM);
+    file = data;
+
+    // Find the "moov" box by skipping over the top-level boxes,
+    // which only requires reading their headers.
+    if (findBox(file, st.st_size, "moov", &moov) != 0) {
+        fprintf(stderr, "No \"moov\" box found in %s !!!\n", inFile);
+        goto done;
+    }
+
+    // Find the track that holds the GPMF metadata
+    p = moov.data;
+    while (nextBox(&p, moov.data + moov.size, &trak) == 0) {
+        if ((strcmp(trak.type, "trak") == 0) && (getGpmfTrak(&trak, &gpmf) == 0)) {
+            break;
+        }
+        memset(&gpmf, 0, sizeof (gpmf));
+    }
+    if (gpmf.timeScale == 0) {
+        fprintf(stderr, "No GPMF metadata track found in %s !!!\n", inFile);
+        goto done;
+    }
+
+    if (parseGpmfTrak(&ctx, &gpmf, file, st.st_size) != 0) {
+        goto done;
+    }
+
+    if (ctx.numSamples == 0) {
+        fprintf(stderr, "No GPS samples with a valid fix found in %s !!!\n", inFile);
+        goto done;
+    }
+
+    if (!ctx.gotUtc && !pArgs->quiet) {
+        fprintf(stderr, "WARNING: No GPS time found in %s: the timestamps are relative to the start of the video !\n", inFile);
+    }
+
+    s = addGpsTrkPts(pTrk, inFile, &ctx);
+
+done:
+    free(ctx.samples);
+    munmap(data, st.st_size);
+
+    return s;
+}
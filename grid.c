@@ -0,0 +1,396 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "const.h"
+#include "grid.h"
+
+// The TrkPt's are projected onto a local plane (equirectangular
+// projection centered on the track) and binned into square cells
+// of GRID_CELL_SIZE meters. Only the cells that hold any TrkPt's
+// are kept, in a hash table that maps each cell to its TrkPt's,
+// which are stored contiguously. The whole thing is built with
+// a counting sort, so it takes O(N).
+#define GRID_CELL_SIZE  100.0   // in meters
+
+struct GeoGrid {
+    double lat0;            // origin of the local plane
+    double lon0;
+    double mPerDegLat;      // scale factors of the projection
+    double mPerDegLon;
+    int maxIx;              // range of the cell coordinates
+    int maxIy;
+
+    int numPts;
+    const TrkPt **pts;      // TrkPt's, sorted by cell (if any)
+    int *pos;               // position of each TrkPt in the track
+    double *x;              // projected coordinates (in meters)
+    double *y;
+
+    // Hash table of the cells
+    int hashSize;           // power of 2
+    uint64_t *keys;         // cell key; 0 if the slot is free
+    int *start;             // first TrkPt in the cell
+    int *count;             // number of TrkPt's in the cell
+};
+
+static uint64_t cellKey(int ix, int iy)
+{
+    // Add 1 so that a key is never 0
+    return ((((uint64_t) (uint32_t) ix) << 32) | (uint32_t) iy) + 1;
+}
+
+static int hashSlot(const GeoGrid *pGrid, uint64_t key)
+{
+    uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+    int slot = (int) (h >> 33) & (pGrid->hashSize - 1);
+
+    while ((pGrid->keys[slot] != 0) && (pGrid->keys[slot] != key)) {
+        slot = (slot + 1) & (pGrid->hashSize - 1);
+    }
+
+    return slot;
+}
+
+static void project(const GeoGrid *pGrid, double lat, double lon, double *pX, double *pY)
+{
+    *pX = (lon - pGrid->lon0) * pGrid->mPerDegLon;
+    *pY = (lat - pGrid->lat0) * pGrid->mPerDegLat;
+}
+
+static int cellCoord(double v)
+{
+    return (int) floor(v / GRID_CELL_SIZE);
+}
+
+void delGeoGrid(GeoGrid *pGrid)
+{
+    if (pGrid != NULL) {
+        free(pGrid->pts);
+        free(pGrid->pos);
+        free(pGrid->x);
+        free(pGrid->y);
+        free(pGrid->keys);
+        free(pGrid->start);
+        free(pGrid->count);
+        free(pGrid);
+    }
+}
+
+GeoGrid *newGeoGridLatLon(int numPts, const double *lat, const double *lon)
+{
+    GeoGrid *pGrid;
+    int *cell = NULL;
+    double minLat = HUGE_VAL, maxLat = -HUGE_VAL;
+    double minLon = HUGE_VAL, maxLon = -HUGE_VAL;
+    int n;
+
+    if (numPts <= 0) {
+        return NULL;
+    }
+
+    if ((pGrid = calloc(1, sizeof (GeoGrid))) == NULL) {
+        fprintf(stderr, "Failed to alloc GeoGrid object !!!\n");
+        return NULL;
+    }
+
+    pGrid->numPts = numPts;
+
+    for (pGrid->hashSize = 16; pGrid->hashSize < (2 * pGrid->numPts); pGrid->hashSize *= 2)
+        ;
+
+    cell = malloc(pGrid->numPts * sizeof (int));
+    pGrid->pos = malloc(pGrid->numPts * sizeof (int));
+    pGrid->x = malloc(pGrid->numPts * sizeof (double));
+    pGrid->y = malloc(pGrid->numPts * sizeof (double));
+    pGrid->keys = calloc(pGrid->hashSize, sizeof (uint64_t));
+    pGrid->start = calloc(pGrid->hashSize, sizeof (int));
+    pGrid->count = calloc(pGrid->hashSize, sizeof (int));
+    if ((cell == NULL) || (pGrid->pos == NULL) ||
+        (pGrid->x == NULL) || (pGrid->y == NULL) || (pGrid->keys == NULL) ||
+        (pGrid->start == NULL) || (pGrid->count == NULL)) {
+        fprintf(stderr, "Failed to alloc GeoGrid tables !!!\n");
+        free(cell);
+        delGeoGrid(pGrid);
+        return NULL;
+    }
+
+    // Bounding box
+    for (n = 0; n < pGrid->numPts; n++) {
+        if (lat[n] < minLat)
+            minLat = lat[n];
+        if (lat[n] > maxLat)
+            maxLat = lat[n];
+        if (lon[n] < minLon)
+            minLon = lon[n];
+        if (lon[n] > maxLon)
+            maxLon = lon[n];
+    }
+
+    pGrid->lat0 = minLat;
+    pGrid->lon0 = minLon;
+    pGrid->mPerDegLat = degToRad * earthMeanRadius;
+    pGrid->mPerDegLon = pGrid->mPerDegLat * cos(((minLat + maxLat) / 2.0) * degToRad);
+    {
+        double x, y;
+        project(pGrid, maxLat, maxLon, &x, &y);
+        pGrid->maxIx = cellCoord(x);
+        pGrid->maxIy = cellCoord(y);
+    }
+
+    // Count the TrkPt's in each cell
+    for (n = 0; n < pGrid->numPts; n++) {
+        double x, y;
+        int slot;
+
+        project(pGrid, lat[n], lon[n], &x, &y);
+        slot = hashSlot(pGrid, cellKey(cellCoord(x), cellCoord(y)));
+        pGrid->keys[slot] = cellKey(cellCoord(x), cellCoord(y));
+        pGrid->count[slot]++;
+        cell[n] = slot;
+    }
+
+    // Assign each cell its range of TrkPt's
+    {
+        int first = 0;
+        for (int slot = 0; slot < pGrid->hashSize; slot++) {
+            pGrid->start[slot] = first;
+            first += pGrid->count[slot];
+            pGrid->count[slot] = 0;
+        }
+    }
+
+    // Place the TrkPt's in their cells, in track order
+    for (n = 0; n < pGrid->numPts; n++) {
+        int slot = cell[n];
+        int i = pGrid->start[slot] + pGrid->count[slot]++;
+
+        pGrid->pos[i] = n;
+        project(pGrid, lat[n], lon[n], &pGrid->x[i], &pGrid->y[i]);
+    }
+
+    free(cell);
+
+    return pGrid;
+}
+
+GeoGrid *newGeoGrid(const TrkPt *pFirst, const TrkPt *pLast)
+{
+    GeoGrid *pGrid = NULL;
+    const TrkPt *p;
+    const TrkPt **pts = NULL;
+    double *lat = NULL, *lon = NULL;
+    int numPts = 0;
+    int n;
+
+    if ((pFirst == NULL) || (pLast == NULL)) {
+        return NULL;
+    }
+
+    for (p = pFirst; p != NULL; p = (p != pLast) ? TAILQ_NEXT(p, tqEntry) : NULL) {
+        numPts++;
+    }
+
+    pts = malloc(numPts * sizeof (TrkPt *));
+    lat = malloc(numPts * sizeof (double));
+    lon = malloc(numPts * sizeof (double));
+    if ((pts == NULL) || (lat == NULL) || (lon == NULL)) {
+        fprintf(stderr, "Failed to alloc GeoGrid tables !!!\n");
+        goto done;
+    }
+
+    n = 0;
+    for (p = pFirst; p != NULL; p = (p != pLast) ? TAILQ_NEXT(p, tqEntry) : NULL) {
+        pts[n] = p;
+        lat[n] = p->latitude;
+        lon[n] = p->longitude;
+        n++;
+    }
+
+    if ((pGrid = newGeoGridLatLon(numPts, lat, lon)) == NULL) {
+        goto done;
+    }
+
+    // Now that the TrkPt's are sorted by cell, put their
+    // addresses in the same order.
+    if ((pGrid->pts = malloc(numPts * sizeof (TrkPt *))) == NULL) {
+        fprintf(stderr, "Failed to alloc GeoGrid tables !!!\n");
+        delGeoGrid(pGrid);
+        pGrid = NULL;
+        goto done;
+    }
+    for (int i = 0; i < numPts; i++) {
+        pGrid->pts[i] = pts[pGrid->pos[i]];
+    }
+
+done:
+    free(pts);
+    free(lat);
+    free(lon);
+
+    return pGrid;
+}
+
+const GeoGrid *getGeoGrid(GpsTrk *pTrk)
+{
+    if (pTrk->grid == NULL) {
+        pTrk->grid = newGeoGrid(TAILQ_FIRST(&pTrk->trkPtList), TAILQ_LAST(&pTrk->trkPtList, TrkPtList));
+    }
+
+    return pTrk->grid;
+}
+
+// Check the TrkPt's in the specified cell against the best
+// hit so far.
+static void checkCell(const GeoGrid *pGrid, int ix, int iy, double qx, double qy, GeoHit *pHit)
+{
+    int slot = hashSlot(pGrid, cellKey(ix, iy));
+
+    if (pGrid->keys[slot] == 0) {
+        return;
+    }
+
+    for (int i = pGrid->start[slot]; i < (pGrid->start[slot] + pGrid->count[slot]); i++) {
+        double d = hypot((pGrid->x[i] - qx), (pGrid->y[i] - qy));
+
+        // On a tie, pick the TrkPt that comes first in
+        // the track.
+        if ((pHit->pos < 0) || (d < pHit->dist) ||
+            ((d == pHit->dist) && (pGrid->pos[i] < pHit->pos))) {
+            pHit->p = (pGrid->pts != NULL) ? pGrid->pts[i] : NULL;
+            pHit->pos = pGrid->pos[i];
+            pHit->dist = d;
+        }
+    }
+}
+
+static int maxInt(int a, int b)
+{
+    return (a > b) ? a : b;
+}
+
+static int minInt(int a, int b)
+{
+    return (a < b) ? a : b;
+}
+
+int gridNearest(const GeoGrid *pGrid, double lat, double lon, GeoHit *pHit)
+{
+    double qx, qy;
+    int cx, cy;
+    int k, maxK;
+
+    pHit->p = NULL;
+    pHit->pos = -1;
+    pHit->dist = HUGE_VAL;
+
+    if ((pGrid == NULL) || (pGrid->numPts == 0)) {
+        return -1;
+    }
+
+    project(pGrid, lat, lon, &qx, &qy);
+    cx = cellCoord(qx);
+    cy = cellCoord(qy);
+
+    // Search the rings of cells around the query point, starting
+    // with the first one that overlaps the grid, until the next
+    // ring can't have any TrkPt's closer than the best one found
+    // so far, or the whole grid has been searched.
+    k = maxInt(maxInt(-cx, cx - pGrid->maxIx), maxInt(-cy, cy - pGrid->maxIy));
+    k = maxInt(k, 0);
+    maxK = maxInt(maxInt(cx, pGrid->maxIx - cx), maxInt(cy, pGrid->maxIy - cy));
+
+    for ( ; k <= maxK; k++) {
+        int y0 = maxInt(cy - k, 0), y1 = minInt(cy + k, pGrid->maxIy);
+        int x0 = maxInt(cx - k, 0), x1 = minInt(cx + k, pGrid->maxIx);
+
+        for (int iy = y0; iy <= y1; iy++) {
+            if ((iy == (cy - k)) || (iy == (cy + k))) {
+                // Top/bottom row of the ring
+                for (int ix = x0; ix <= x1; ix++) {
+                    checkCell(pGrid, ix, iy, qx, qy, pHit);
+                }
+            } else {
+                // Left/right ends of the ring
+                if ((cx - k) >= 0)
+                    checkCell(pGrid, (cx - k), iy, qx, qy, pHit);
+                if ((k != 0) && ((cx + k) <= pGrid->maxIx))
+                    checkCell(pGrid, (cx + k), iy, qx, qy, pHit);
+            }
+        }
+
+        if ((pHit->pos >= 0) && (pHit->dist <= (k * GRID_CELL_SIZE))) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int cmpHitPos(const void *a, const void *b)
+{
+    return (((const GeoHit *) a)->pos - ((const GeoHit *) b)->pos);
+}
+
+int gridWithin(const GeoGrid *pGrid, double lat, double lon, double radius, GeoHit **pHits)
+{
+    GeoHit *hits = NULL;
+    int numHits = 0, maxHits = 0;
+    double qx, qy;
+    int x0, x1, y0, y1;
+
+    *pHits = NULL;
+
+    if ((pGrid == NULL) || (pGrid->numPts == 0)) {
+        return 0;
+    }
+
+    project(pGrid, lat, lon, &qx, &qy);
+    x0 = maxInt(cellCoord(qx - radius), 0);
+    x1 = minInt(cellCoord(qx + radius), pGrid->maxIx);
+    y0 = maxInt(cellCoord(qy - radius), 0);
+    y1 = minInt(cellCoord(qy + radius), pGrid->maxIy);
+
+    for (int iy = y0; iy <= y1; iy++) {
+        for (int ix = x0; ix <= x1; ix++) {
+            int slot = hashSlot(pGrid, cellKey(ix, iy));
+
+            if (pGrid->keys[slot] == 0)
+                continue;
+
+            for (int i = pGrid->start[slot]; i < (pGrid->start[slot] + pGrid->count[slot]); i++) {
+                double d = hypot((pGrid->x[i] - qx), (pGrid->y[i] - qy));
+
+                if (d > radius)
+                    continue;
+
+                if (numHits == maxHits) {
+                    GeoHit *newHits;
+                    maxHits = (maxHits == 0) ? 64 : (2 * maxHits);
+                    if ((newHits = realloc(hits, maxHits * sizeof (GeoHit))) == NULL) {
+                        fprintf(stderr, "Failed to alloc GeoHit list !!!\n");
+                        free(hits);
+                        return -1;
+                    }
+                    hits = newHits;
+                }
+                hits[numHits].p = (pGrid->pts != NULL) ? pGrid->pts[i] : NULL;
+                hits[numHits].pos = pGrid->pos[i];
+                hits[numHits].dist = d;
+                numHits++;
+            }
+        }
+    }
+
+    qsort(hits, numHits, sizeof (GeoHit), cmpHitPos);
+    *pHits = hits;
+
+    return numHits;
+}
+
+void freeGeoGrid(GpsTrk *pTrk)
+{
+    delGeoGrid(pTrk->grid);
+    pTrk->grid = NULL;
+}
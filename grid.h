@@ -0,0 +1,50 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Uniform grid index over the lat/lon of the TrkPt's. It is
+// built on the first query, and cached in the GpsTrk until
+// the TrkPt's are modified.
+typedef struct GeoGrid GeoGrid;
+
+// TrkPt found by a query
+typedef struct GeoHit {
+    const TrkPt *p;
+    int pos;            // position of the TrkPt in the track
+    double dist;        // distance to the query point (in meters)
+} GeoHit;
+
+// Get the grid of the whole track, building it if needed
+extern const GeoGrid *getGeoGrid(GpsTrk *pTrk);
+
+// Build a standalone grid over the TrkPt's from 'pFirst' to
+// 'pLast' (inclusive). The position of each TrkPt is relative
+// to 'pFirst'.
+extern GeoGrid *newGeoGrid(const TrkPt *pFirst, const TrkPt *pLast);
+
+// Build a standalone grid over the positions in the 'lat[]'
+// and 'lon[]' arrays, e.g. those of a CompactTrk. The 'p' of
+// the hits is NULL; their 'pos' is the index in the arrays.
+extern GeoGrid *newGeoGridLatLon(int numPts, const double *lat, const double *lon);
+extern void delGeoGrid(GeoGrid *pGrid);
+
+// Find the TrkPt nearest to the specified position.
+// Returns -1 if the track is empty.
+extern int gridNearest(const GeoGrid *pGrid, double lat, double lon, GeoHit *pHit);
+
+// Find all the TrkPt's within the specified distance (in
+// meters) of the specified position. The hits are returned
+// in '*pHits', in track order, and must be freed by the
+// caller. Returns the number of hits, or -1 on error.
+extern int gridWithin(const GeoGrid *pGrid, double lat, double lon, double radius, GeoHit **pHits);
+
+// Discard the cached grid
+extern void freeGeoGrid(GpsTrk *pTrk);
+
+#ifdef __cplusplus
+};
+#endif
@@ -1,11 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <sys/stat.h>
 
+#include "comp.h"
 #include "const.h"
 #include "defs.h"
+#include "input.h"
+#include "pipe.h"
 #include "trkpt.h"
+#include "zio.h"
 
 // FIT SDK files
 //#include "fit/decode.c"
@@ -15,16 +21,12 @@
 #include "fit/fit_convert.c"
 #include "fit/fit_strings.c"
 
-// FIT uses December 31, 1989 UTC as their Epoch. See below
-// for the details:
-//   https://developer.garmin.com/fit/cookbook/datetime/
-static const time_t fitEpoch = 631065600;
-
 // Add a new TrkPt using the data in the RECORD message
 static int addTrkPt(GpsTrk *pTrk, const char *inFile,
                     int mesgIndex, const FIT_RECORD_MESG *record)
 {
     TrkPt *pTrkPt = NULL;
+    int sdMask = SD_NONE;   // sensor data in this record
 
     // Alloc and init new TrkPt object
     if ((pTrkPt = newTrkPt(pTrk->numTrkPts++, inFile, mesgIndex)) == NULL) {
@@ -66,24 +68,31 @@ static int addTrkPt(GpsTrk *pTrk, const char *inFile,
 
     if (record->temperature != FIT_SINT8_INVALID) {
         pTrkPt->ambTemp = record->temperature;
-        pTrk->inMask |= SD_ATEMP;
+        sdMask |= SD_ATEMP;
     }
 
     if (record->cadence != FIT_UINT8_INVALID) {
         pTrkPt->cadence = record->cadence;
-        pTrk->inMask |= SD_CADENCE;
+        sdMask |= SD_CADENCE;
     }
 
     if (record->heart_rate != FIT_UINT8_INVALID) {
         pTrkPt->heartRate = record->heart_rate;
-        pTrk->inMask |= SD_HR;
+        sdMask |= SD_HR;
     }
 
     if (record->power != FIT_UINT16_INVALID) {
         pTrkPt->power = record->power;
-        pTrk->inMask |= SD_POWER;
+        sdMask |= SD_POWER;
+    }
+
+    if (pTrk->pipe != NULL) {
+        // Feed the track point into the processing pipeline
+        return pipePutTrkPt(pTrk->pipe, pTrkPt, sdMask);
     }
 
+    pTrk->inMask |= sdMask;
+
     // Insert track point at the tail of the queue
     TAILQ_INSERT_TAIL(&pTrk->trkPtList, pTrkPt, tqEntry);
 
@@ -101,8 +110,8 @@ int parseFitFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile)
     FIT_MANUFACTURER manufacturer = FIT_MANUFACTURER_INVALID;
     Bool timerRunning = true;
 
-    // Open the FIT file for reading
-    if ((fp = fopen(inFile, "r")) == NULL) {
+    // Open the FIT file for reading (it may be compressed)
+    if ((fp = zioOpenRead(inFile)) == NULL) {
         fprintf(stderr, "Failed to open input file %s\n", inFile);
         return -1;
     }
@@ -385,3 +394,120 @@ int parseFitFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile)
 
     return 0;
 }
+
+int parseInputFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile)
+{
+    const char *fileSuffix;
+
+    if ((fileSuffix = strrchr(inFile, '.')) == NULL) {
+        fprintf(stderr, "Unsupported input file %s\n", inFile);
+        return -1;
+    }
+    if ((strcmp(fileSuffix, ".gz") == 0) || (strcmp(fileSuffix, ".zst") == 0)) {
+        // Compressed file: the actual format is given by
+        // the previous suffix; e.g. "foo.fit.gz"
+        const char *p = fileSuffix;
+        while ((p > inFile) && (*--p != '.'))
+            ;
+        fileSuffix = p;
+    }
+
+    if ((strcmp(fileSuffix, ".fit") == 0) ||
+        (strncmp(fileSuffix, ".fit.", 5) == 0)) {
+        return parseFitFile(pArgs, pTrk, inFile);
+    } else if (strcasecmp(fileSuffix, ".mp4") == 0) {
+        // GoPro video
+        return parseMp4File(pArgs, pTrk, inFile);
+    }
+
+    fprintf(stderr, "Unsupported input file %s\n", inFile);
+
+    return -1;
+}
+
+// Parse the reference file into its own GpsTrk, and then
+// convert it to the compact layout, which takes a fraction
+// of the memory of the TrkPt's.
+void freeRefTrk(GpsTrk *pTrk)
+{
+    freePackedTrk(pTrk->refTrk);
+    free(pTrk->refFile);
+    pTrk->refTrk = NULL;
+    pTrk->refFile = NULL;
+    pTrk->refMTime = 0;
+}
+
+const PackedTrk *loadRefTrk(GpsTrk *pTrk, const CmdArgs *pArgs, const char *refFile)
+{
+    CmdArgs args = *pArgs;
+    GpsTrk ref = {0};
+    CompactTrk *pCt = NULL;
+    TrkPt *pFirst, *p;
+    struct stat st = {0};
+    double baseDist;
+
+    // Ignore the error here, and let the parser report it
+    stat(refFile, &st);
+
+    if ((pTrk->refTrk != NULL) && (strcmp(pTrk->refFile, refFile) == 0) &&
+        (pTrk->refMTime == st.st_mtime)) {
+        return pTrk->refTrk;
+    }
+
+    freeRefTrk(pTrk);
+
+    // The TrkPt's of the reference track point to its file
+    // name, so it must outlive them.
+    if ((pTrk->refFile = strdup(refFile)) == NULL) {
+        fprintf(stderr, "Failed to alloc reference file name !!!\n");
+        return NULL;
+    }
+    pTrk->refMTime = st.st_mtime;
+
+    args.quiet = true;
+    args.stream = false;
+
+    TAILQ_INIT(&ref.trkPtList);
+    TAILQ_INIT(&ref.savedTrkPtList);
+
+    if (parseInputFile(&args, &ref, pTrk->refFile) != 0) {
+        goto done;
+    }
+
+    if ((pFirst = TAILQ_FIRST(&ref.trkPtList)) == NULL) {
+        fprintf(stderr, "No track points found in %s\n", refFile);
+        goto done;
+    }
+
+    // The distance values are relative to the first TrkPt,
+    // which need not be at the start of the activity.
+    if ((baseDist = pFirst->distance) != nilDist) {
+        TAILQ_FOREACH(p, &ref.trkPtList, tqEntry) {
+            if (p->distance != nilDist) {
+                p->distance -= baseDist;
+            }
+        }
+    }
+
+    if ((!args.verbatim && (checkTrkPts(&ref, &args) != 0)) ||
+        (compMetrics(&ref, &args) != 0)) {
+        goto done;
+    }
+
+    if ((pCt = compactTrk(&ref)) != NULL) {
+        pTrk->refTrk = packTrk(pCt);
+        freeCompactTrk(pCt);
+    }
+
+done:
+    p = TAILQ_FIRST(&ref.trkPtList);
+    while (p != NULL) {
+        p = remTrkPt(&ref, p);
+    }
+
+    if (pTrk->refTrk == NULL) {
+        freeRefTrk(pTrk);
+    }
+
+    return pTrk->refTrk;
+}
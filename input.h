@@ -1,6 +1,7 @@
 #pragma once
 
 #include "defs.h"
+#include "packed.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,8 +10,22 @@ extern "C" {
 extern int parseCsvFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile);
 extern int parseFitFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile);
 extern int parseGpxFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile);
+extern int parseMp4File(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile);
 extern int parseTcxFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile);
 
+// Parse the input file using the parser that matches its
+// suffix: e.g. ".fit", ".fit.gz", or ".mp4".
+extern int parseInputFile(CmdArgs *pArgs, GpsTrk *pTrk, const char *inFile);
+
+// Parse a reference file (e.g. for comparing the track with
+// it), compute its metrics, and keep it in the GpsTrk in the
+// packed layout. The file is parsed again only when it has
+// been modified since. Returns NULL on error.
+extern const PackedTrk *loadRefTrk(GpsTrk *pTrk, const CmdArgs *pArgs, const char *refFile);
+
+// Discard the packed reference track
+extern void freeRefTrk(GpsTrk *pTrk);
+
 #ifdef __cplusplus
 };
 #endif
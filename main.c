@@ -12,16 +12,34 @@
 #include "defs.h"
 #include "input.h"
 #include "output.h"
+#include "pipe.h"
+#include "stitch.h"
 #include "trkpt.h"
+#include "zio.h"
 
 static const char *help =
         "SYNTAX:\n"
         "    mkshiz [OPTIONS] <file> [<file2> ...]\n"
         "\n"
         "    When multiple input files are specified, the tool will attempt to\n"
-        "    stitch them together into a single file.\n"
+        "    stitch them together into a single file: the files are put in\n"
+        "    chronological order, the track points that overlap with the\n"
+        "    previous file are discarded, the distance and time values are\n"
+        "    rebased so that each file continues from the previous one, and\n"
+        "    the gaps between the files are bridged.\n"
+        "\n"
+        "    Input files compressed with gzip or zstd (e.g. \"ride.fit.gz\") are\n"
+        "    decompressed on the fly.\n"
+        "\n"
+        "    The GPS telemetry of GoPro videos (e.g. \"GX010123.MP4\") is read\n"
+        "    directly from the MP4 file, without reading the video data.\n"
         "\n"
         "OPTIONS:\n"
+        "    --compress {gzip|zstd}\n"
+        "        Compress the output data using the specified algorithm.\n"
+        "    --compress-level <level>\n"
+        "        Specifies the compression level: e.g. 1-9 for gzip, or 1-19\n"
+        "        for zstd. By default the algorithm's default level is used.\n"
         "    --csv-time-format {hms|sec|utc}\n"
         "        Specifies the format of the timestamp value in the CSV output.\n"
         "        'hms' and 'sec' imply relative timestamps, while 'utc' implies\n"
@@ -30,10 +48,24 @@ static const char *help =
         "        Specifies the type of units to use in the CSV output.\n"
         "    --help\n"
         "        Show this help and exit.\n"
+        "    --merge {first|cadence|hr|power}\n"
+        "        Merge the input files in the order of their timestamps, instead\n"
+        "        of stitching them one after another; e.g. when the same ride\n"
+        "        was recorded by several devices. Where the files overlap, the\n"
+        "        track points are taken from the first file in the command line\n"
+        "        that has the specified sensor data.\n"
         "    --no-cli\n"
         "        Do not start the interactive CLI.\n"
         "    --quiet\n"
         "        Suppress all warning messages.\n"
+        "    --stream\n"
+        "        Check the track points and compute their metrics while the\n"
+        "        input files are still being parsed. Along with --no-cli and\n"
+        "        the csv, gpx, or shiz output formats, the output is written\n"
+        "        as the track points become available, and only a small\n"
+        "        window of them is kept in memory. The shiz format requires\n"
+        "        the output to be a regular file. This option is ignored\n"
+        "        when multiple input files are specified.\n"
         "    --version\n"
         "        Show version information and exit.\n"
         "NOTES:\n"
@@ -70,6 +102,22 @@ static int parseArgs(int argc, char **argv, CmdArgs *pArgs)
         if (strcmp(arg, "--help") == 0) {
             fprintf(stdout, "%s\n", help);
             exit(0);
+        } else if (strcmp(arg, "--compress") == 0) {
+            val = argv[++n];
+            if (strcmp(val, "gzip") == 0) {
+                pArgs->compType = gzip;
+            } else if (strcmp(val, "zstd") == 0) {
+                pArgs->compType = zstd;
+            } else {
+                invalidArgument(arg, val);
+                return -1;
+            }
+        } else if (strcmp(arg, "--compress-level") == 0) {
+            val = argv[++n];
+            if (sscanf(val, "%d", &pArgs->compLevel) != 1) {
+                invalidArgument(arg, val);
+                return -1;
+            }
         } else if (strcmp(arg, "--csv-time-format") == 0) {
             val = argv[++n];
             if (strcmp(val, "hms") == 0) {
@@ -92,6 +140,21 @@ static int parseArgs(int argc, char **argv, CmdArgs *pArgs)
                 invalidArgument(arg, val);
                 return -1;
             }
+        } else if (strcmp(arg, "--merge") == 0) {
+            val = argv[++n];
+            pArgs->merge = true;
+            if (strcmp(val, "first") == 0) {
+                pArgs->mergePref = SD_NONE;
+            } else if (strcmp(val, "cadence") == 0) {
+                pArgs->mergePref = SD_CADENCE;
+            } else if (strcmp(val, "hr") == 0) {
+                pArgs->mergePref = SD_HR;
+            } else if (strcmp(val, "power") == 0) {
+                pArgs->mergePref = SD_POWER;
+            } else {
+                invalidArgument(arg, val);
+                return -1;
+            }
         } else if (strcmp(arg, "--no-cli") == 0) {
                     pArgs->noCli = true;
         } else if (strcmp(arg, "--output-format") == 0) {
@@ -104,12 +167,16 @@ static int parseArgs(int argc, char **argv, CmdArgs *pArgs)
                 pArgs->outFmt = shiz;
             } else if (strcmp(val, "tcx") == 0) {
                 pArgs->outFmt = tcx;
+            } else if (strcmp(val, "fit") == 0) {
+                pArgs->outFmt = fit;
             } else {
                 invalidArgument(arg, val);
                 return -1;
             }
         } else if (strcmp(arg, "--quiet") == 0) {
             pArgs->quiet = true;
+        } else if (strcmp(arg, "--stream") == 0) {
+            pArgs->stream = true;
         } else if (strcmp(arg, "--verbatim") == 0) {
             pArgs->verbatim = true;
         } else if (strcmp(arg, "--version") == 0) {
@@ -133,6 +200,8 @@ int main(int argc, char **argv)
 {
     CmdArgs cmdArgs = {0};
     GpsTrk gpsTrk = {0};
+    TrkSeg *segs = NULL;
+    int numSegs = 0;
     int n;
 
     // Parse the command arguments
@@ -143,56 +212,127 @@ int main(int argc, char **argv)
     TAILQ_INIT(&gpsTrk.trkPtList);
     TAILQ_INIT(&gpsTrk.savedTrkPtList);
 
-    // Process each FIT input file
-    while (n < argc) {
-        const char *fileSuffix;
-        int s;
-        cmdArgs.inFile = argv[n++];
-        if ((fileSuffix = strrchr(cmdArgs.inFile, '.')) == NULL) {
-            fprintf(stderr, "Unsupported input file %s\n", cmdArgs.inFile);
+    // Compress the output on the fly?
+    if (cmdArgs.noCli && (cmdArgs.compType != noComp)) {
+        if ((cmdArgs.outFile = zioOpenWrite(NULL, cmdArgs.compType, cmdArgs.compLevel)) == NULL) {
             return -1;
         }
-        if (strcmp(fileSuffix, ".fit") == 0) {
-            s = parseFitFile(&cmdArgs, &gpsTrk, cmdArgs.inFile);
-        } else {
-            fprintf(stderr, "Unsupported input file %s\n", cmdArgs.inFile);
-            return -1;
+    }
+
+    // Multiple input files need to be stitched together
+    // before their TrkPt's can be checked.
+    if ((argc - n) > 1) {
+        if (cmdArgs.stream && !cmdArgs.quiet) {
+            fprintf(stderr, "INFO: Ignoring --stream option when stitching multiple files !\n");
         }
-        if (s != 0) {
-            fprintf(stderr, "Failed to parse input file %s\n", cmdArgs.inFile);
+        cmdArgs.stream = false;
+        if ((segs = calloc((argc - n), sizeof (TrkSeg))) == NULL) {
+            fprintf(stderr, "Failed to alloc TrkSeg list !!!\n");
             return -1;
         }
-        cmdArgs.inFile = NULL;
     }
 
-    // Done parsing all the input files. Make sure we have
-    // at least one TrkPt!
-    if (TAILQ_FIRST(&gpsTrk.trkPtList) == NULL) {
-        // Hu?
-        fprintf(stderr, "ERROR: No track points found!\n");
+    // Start the processing pipeline
+    if (cmdArgs.stream && (pipeStart(&gpsTrk, &cmdArgs) != 0)) {
         return -1;
     }
 
-    // Unless we are processing the FIT verbatim, check its
-    // TrkPt's for duplicates and bogus values.
-    if (!cmdArgs.verbatim) {
-        if (checkTrkPts(&gpsTrk, &cmdArgs) != 0) {
+    // Process each input file
+    while (n < argc) {
+        TrkPt *pTail = TAILQ_LAST(&gpsTrk.trkPtList, TrkPtList);
+        int inMask = gpsTrk.inMask;
+        cmdArgs.inFile = argv[n++];
+        if (segs != NULL) {
+            // Get the sensor data of this file alone. This is
+            // never done when streaming, as the pipeline's worker
+            // thread owns the mask then.
+            gpsTrk.inMask = SD_NONE;
+        }
+        if (parseInputFile(&cmdArgs, &gpsTrk, cmdArgs.inFile) != 0) {
+            fprintf(stderr, "Failed to parse input file %s\n", cmdArgs.inFile);
+            return -1;
+        }
+        if (segs != NULL) {
+            // Remember which TrkPt's came from this file
+            TrkSeg *pSeg = &segs[numSegs];
+            pSeg->first = (pTail != NULL) ? TAILQ_NEXT(pTail, tqEntry) : TAILQ_FIRST(&gpsTrk.trkPtList);
+            pSeg->last = (pSeg->first != NULL) ? TAILQ_LAST(&gpsTrk.trkPtList, TrkPtList) : NULL;
+            pSeg->inFile = cmdArgs.inFile;
+            pSeg->fileNum = numSegs++;
+            pSeg->inMask = gpsTrk.inMask;
+            gpsTrk.inMask |= inMask;
+        }
+        cmdArgs.inFile = NULL;
+    }
+
+    if (cmdArgs.stream) {
+        // Wait for the pipeline to finish checking the
+        // TrkPt's and computing their metrics.
+        if (pipeFinish(&gpsTrk, &cmdArgs) != 0) {
             // Hu?
             fprintf(stderr, "ERROR: Bogus FIT data!\n");
             return -1;
         }
-    }
 
-    // Compute the metrics
-    if (compMetrics(&gpsTrk, &cmdArgs) != 0) {
-        // Hu?
-        fprintf(stderr, "ERROR: Failed to compute metrics!\n");
-        return -1;
+        if (gpsTrk.numTrkPts == 0) {
+            // Hu?
+            fprintf(stderr, "ERROR: No track points found!\n");
+            return -1;
+        }
+
+        if (TAILQ_FIRST(&gpsTrk.trkPtList) == NULL) {
+            // The TrkPt's have already been written out
+            return (fclose(cmdArgs.outFile) == 0) ? 0 : -1;
+        }
+    } else {
+        if (segs != NULL) {
+            int s;
+            if (cmdArgs.merge) {
+                s = mergeTrkSegs(&gpsTrk, &cmdArgs, segs, numSegs);
+            } else {
+                s = stitchTrkSegs(&gpsTrk, &cmdArgs, segs, numSegs);
+            }
+            free(segs);
+            if (s != 0) {
+                fprintf(stderr, "ERROR: Failed to %s the input files!\n", cmdArgs.merge ? "merge" : "stitch");
+                return -1;
+            }
+        }
+
+        // Done parsing all the input files. Make sure we have
+        // at least one TrkPt!
+        if (TAILQ_FIRST(&gpsTrk.trkPtList) == NULL) {
+            // Hu?
+            fprintf(stderr, "ERROR: No track points found!\n");
+            return -1;
+        }
+
+        // Unless we are processing the FIT verbatim, check its
+        // TrkPt's for duplicates and bogus values.
+        if (!cmdArgs.verbatim) {
+            if (checkTrkPts(&gpsTrk, &cmdArgs) != 0) {
+                // Hu?
+                fprintf(stderr, "ERROR: Bogus FIT data!\n");
+                return -1;
+            }
+        }
+
+        // Compute the metrics
+        if (compMetrics(&gpsTrk, &cmdArgs) != 0) {
+            // Hu?
+            fprintf(stderr, "ERROR: Failed to compute metrics!\n");
+            return -1;
+        }
     }
 
     if (cmdArgs.noCli) {
         // Print summary
-        printOutput(&gpsTrk, &cmdArgs);
+        int s = printOutput(&gpsTrk, &cmdArgs);
+
+        // Make sure all the (compressed) data is written out
+        if ((fclose(cmdArgs.outFile) != 0) || (s != 0)) {
+            return -1;
+        }
     } else {
         // Process the CLI commands
         cliCmdHandler(&gpsTrk, &cmdArgs);
@@ -1,10 +1,19 @@
+#include <errno.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
+#include "aggr.h"
 #include "const.h"
 #include "defs.h"
+#include "pool.h"
 #include "trkpt.h"
+#include "fit/fit_crc.h"
+#include "fit/fit_example.h"
 
 static const char *xmlHeader = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
 
@@ -22,9 +31,23 @@ static const char *tcxHeader = "<TrainingCenterDatabase\n"
                                "  xmlns=\"http://www.garmin.com/xmlschemas/TrainingCenterDatabase/v2\"\n"
                                "  xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xmlns:ns4=\"http://www.garmin.com/xmlschemas/ProfileExtension/v1\">\n";
 
+// Length reserved for the "extra" object of the SHIZ header
+// when the output is streamed, and the offset of the header
+// in the output file.
+#define SHIZ_HDR_PAD_LEN    384
+static long shizHdrOffset = -1;
+
+// Max number of TrkPt's formatted by a worker thread at a
+// time, and max number of chunks formatted before they are
+// written out, which bounds the memory used by the buffers.
+#define OUTPUT_CHUNK_SIZE   2048
+#define OUTPUT_MAX_CHUNKS   64
+
+// The TrkPt's may be formatted by several threads at once,
+// so each one gets its own buffer.
 static const char *fmtTimeStamp(time_t ts, time_t baseTime, TsFmt fmt)
 {
-    static char fmtBuf[64];
+    static __thread char fmtBuf[64];
 
     if (fmt == hms) {
         time_t time = (ts - baseTime);
@@ -132,6 +155,249 @@ static void printSummary(GpsTrk *pTrk, CmdArgs *pArgs)
     }
 }
 
+static void printRangeExt(GpsTrk *pTrk, CmdArgs *pArgs, const char *label, const char *fmt, double value, const TrkPt *p)
+{
+    fprintf(pArgs->outFile, "%15s: ", label);
+    fprintf(pArgs->outFile, fmt, value);
+    fprintf(pArgs->outFile, " @ TrkPt #%d (%s) : time = %s, distance = %.3lf km\n",
+            p->index, fmtTrkPtIdx(p), fmtTimeStamp(p->timestamp, pTrk->startTime, hms), mToKm(p->distance));
+}
+
+// Print the summary of the TrkPt's within the specified range,
+// using the range aggregates of the track.
+int printRangeSummary(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPtRange *pRange)
+{
+    const TrkAggr *pAggr;
+    const TrkPt *p;
+    double value, time, dist;
+    int a, b;
+
+    if (((pAggr = getTrkAggr(pTrk)) == NULL) ||
+        (aggrRange(pAggr, pRange, &a, &b) != 0)) {
+        return -1;
+    }
+
+    time = aggrSum(pAggr, acTime, a, b);
+    dist = aggrSum(pAggr, acDist, a, b);
+
+    fprintf(pArgs->outFile, "      numTrkPts: %d\n", (b - a + 1));
+    fprintf(pArgs->outFile, "    elapsedTime: %s\n", fmtTimeStamp((time_t) time, 0, hms));
+    fprintf(pArgs->outFile, "       distance: %.3lf km\n", mToKm(dist));
+    fprintf(pArgs->outFile, "       elevGain: %.3lf m\n", aggrSum(pAggr, acGain, a, b));
+    fprintf(pArgs->outFile, "       elevLoss: %.3lf m\n", aggrSum(pAggr, acLoss, a, b));
+
+    p = aggrMax(pAggr, amElevation, a, b, &value);
+    printRangeExt(pTrk, pArgs, "maxElev", "%.3lf m", value, p);
+    p = aggrMin(pAggr, amElevation, a, b, &value);
+    printRangeExt(pTrk, pArgs, "minElev", "%.3lf m", value, p);
+
+    p = aggrMax(pAggr, amSpeed, a, b, &value);
+    printRangeExt(pTrk, pArgs, "maxSpeed", "%.3lf km/h", mpsToKph(value), p);
+    p = aggrMin(pAggr, amSpeed, a, b, &value);
+    printRangeExt(pTrk, pArgs, "minSpeed", "%.3lf km/h", mpsToKph(value), p);
+    if (time > 0.0) {
+        fprintf(pArgs->outFile, "       avgSpeed: %.3lf km/h\n", mpsToKph(dist / time));
+    }
+
+    p = aggrMax(pAggr, amGrade, a, b, &value);
+    printRangeExt(pTrk, pArgs, "maxGrade", "%.2lf%%", value, p);
+    p = aggrMin(pAggr, amGrade, a, b, &value);
+    printRangeExt(pTrk, pArgs, "minGrade", "%.2lf%%", value, p);
+    if (b > a) {
+        fprintf(pArgs->outFile, "       avgGrade: %.2lf%%\n", (aggrSum(pAggr, acGrade, a, b) / (b - a)));
+    }
+
+    if (pTrk->inMask & SD_POWER) {
+        p = aggrMax(pAggr, amPower, a, b, &value);
+        printRangeExt(pTrk, pArgs, "maxPower", "%.0lf W", value, p);
+        if (time > 0.0) {
+            fprintf(pArgs->outFile, "       avgPower: %.0lf W\n", (aggrSum(pAggr, acPowerDt, a, b) / time));
+        }
+    }
+
+    if (pTrk->inMask & SD_HR) {
+        p = aggrMax(pAggr, amHeartRate, a, b, &value);
+        printRangeExt(pTrk, pArgs, "maxHeartRate", "%.0lf bpm", value, p);
+        if (time > 0.0) {
+            fprintf(pArgs->outFile, "   avgHeartRate: %.0lf bpm\n", (aggrSum(pAggr, acHrDt, a, b) / time));
+        }
+    }
+
+    if ((pTrk->inMask & SD_CADENCE) && (time > 0.0)) {
+        fprintf(pArgs->outFile, "     avgCadence: %.0lf rpm\n", (aggrSum(pAggr, acCadenceDt, a, b) / time));
+    }
+
+    return 0;
+}
+
+// Function that prints a single TrkPt
+typedef void (*PrintTrkPtFunc)(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p);
+
+// Chunk of consecutive TrkPt's formatted into its own buffer
+typedef struct OutChunk {
+    const TrkPt *first;     // first TrkPt in the chunk
+    int numTrkPts;          // number of TrkPt's in the chunk
+    char *buf;              // formatted data
+    size_t len;             // length of the formatted data
+} OutChunk;
+
+typedef struct OutJob {
+    GpsTrk *pTrk;
+    CmdArgs *pArgs;
+    PrintTrkPtFunc printTrkPt;
+    OutChunk chunks[OUTPUT_MAX_CHUNKS];
+} OutJob;
+
+// Format the TrkPt's of the chunk into a memory buffer. If the
+// buffer can't be allocated the chunk is left alone, and it's
+// printed directly to the output file later on.
+static void fmtOutChunk(void *arg, int item)
+{
+    OutJob *pJob = arg;
+    OutChunk *pChunk = &pJob->chunks[item];
+    CmdArgs args = *pJob->pArgs;
+    const TrkPt *p = pChunk->first;
+
+    if ((args.outFile = open_memstream(&pChunk->buf, &pChunk->len)) == NULL) {
+        pChunk->buf = NULL;
+        return;
+    }
+
+    for (int n = 0; n < pChunk->numTrkPts; n++, p = TAILQ_NEXT(p, tqEntry)) {
+        pJob->printTrkPt(pJob->pTrk, &args, p);
+    }
+
+    fclose(args.outFile);
+}
+
+// Write out the buffers of the chunks, in order
+static int writeOutChunks(OutJob *pJob, int numChunks)
+{
+    FILE *fp = pJob->pArgs->outFile;
+    struct iovec iov[OUTPUT_MAX_CHUNKS];
+    struct iovec *pIov = iov;
+    int fd = fileno(fp);
+    int numIov = numChunks;
+
+    for (int n = 0; n < numChunks; n++) {
+        if (pJob->chunks[n].buf == NULL) {
+            // Fall back to the buffered stream
+            fd = -1;
+        }
+        iov[n].iov_base = pJob->chunks[n].buf;
+        iov[n].iov_len = pJob->chunks[n].len;
+    }
+
+    if (fd < 0) {
+        // E.g. the output is being compressed, so there is
+        // no file descriptor to write to.
+        for (int n = 0; n < numChunks; n++) {
+            OutChunk *pChunk = &pJob->chunks[n];
+
+            if (pChunk->buf != NULL) {
+                if ((pChunk->len != 0) && (fwrite(pChunk->buf, pChunk->len, 1, fp) != 1)) {
+                    fprintf(stderr, "Failed to write output data !!!\n");
+                    return -1;
+                }
+            } else {
+                const TrkPt *p = pChunk->first;
+
+                for (int i = 0; i < pChunk->numTrkPts; i++, p = TAILQ_NEXT(p, tqEntry)) {
+                    pJob->printTrkPt(pJob->pTrk, pJob->pArgs, p);
+                }
+            }
+        }
+        return 0;
+    }
+
+    // Anything already printed (e.g. the header) needs to
+    // go out first.
+    if (fflush(fp) != 0) {
+        fprintf(stderr, "Failed to write output data !!!\n");
+        return -1;
+    }
+
+    while (numIov > 0) {
+        ssize_t len = writev(fd, pIov, numIov);
+
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to write output data !!!\n");
+            return -1;
+        }
+
+        // Skip over what has been written
+        while ((numIov > 0) && ((size_t) len >= pIov->iov_len)) {
+            len -= pIov->iov_len;
+            pIov++;
+            numIov--;
+        }
+        if (numIov > 0) {
+            pIov->iov_base = (char *) pIov->iov_base + len;
+            pIov->iov_len -= len;
+        }
+    }
+
+    return 0;
+}
+
+// Print all the TrkPt's. The list is split into chunks that
+// are formatted in parallel by the worker threads, each one
+// into its own buffer, and the buffers are then written out in
+// the same order as the TrkPt's. Returns -1 if the data
+// can't be written out.
+static int printTrkPts(GpsTrk *pTrk, CmdArgs *pArgs, PrintTrkPtFunc printTrkPt)
+{
+    const TrkPt *p = TAILQ_FIRST(&pTrk->trkPtList);
+    OutJob *pJob;
+    int s = 0;
+
+    if ((pJob = calloc(1, sizeof (OutJob))) == NULL) {
+        // Print them the old-fashioned way
+        for (; p != NULL; p = TAILQ_NEXT(p, tqEntry)) {
+            printTrkPt(pTrk, pArgs, p);
+        }
+        return 0;
+    }
+
+    pJob->pTrk = pTrk;
+    pJob->pArgs = pArgs;
+    pJob->printTrkPt = printTrkPt;
+
+    while (p != NULL) {
+        int numChunks = 0;
+
+        while ((p != NULL) && (numChunks < OUTPUT_MAX_CHUNKS)) {
+            OutChunk *pChunk = &pJob->chunks[numChunks++];
+
+            pChunk->first = p;
+            pChunk->numTrkPts = 0;
+            pChunk->buf = NULL;
+            pChunk->len = 0;
+            while ((p != NULL) && (pChunk->numTrkPts < OUTPUT_CHUNK_SIZE)) {
+                pChunk->numTrkPts++;
+                p = TAILQ_NEXT(p, tqEntry);
+            }
+        }
+
+        poolRun(numChunks, fmtOutChunk, pJob);
+
+        s = writeOutChunks(pJob, numChunks);
+
+        for (int n = 0; n < numChunks; n++) {
+            free(pJob->chunks[n].buf);
+        }
+
+        if (s != 0)
+            break;
+    }
+
+    free(pJob);
+
+    return s;
+}
+
 static double csvDist(double distance, const CmdArgs *pArgs)
 {
     return (pArgs->units == metric) ? distance : (distance * kmToMile);
@@ -147,28 +413,33 @@ static double csvSpeed(double speed, const CmdArgs *pArgs)
     return (pArgs->units == metric) ? speed : (speed * kmToMile);
 }
 
-static void printCsvFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+static void printCsvHdr(GpsTrk *pTrk, CmdArgs *pArgs)
 {
-    TrkPt *p;
-
     // Print column banner line
     fprintf(pArgs->outFile, "%s\n", csvBannerLine);
+}
 
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        fprintf(pArgs->outFile, "%d,%s,%d,%s,",
-                p->index,                                       // <trkPt>
-                p->inFile,                                      // <inFile>
-                p->lineNum,                                     // <line#>
-                fmtTimeStamp(p->timestamp, pTrk->startTime, pArgs->tsFmt));   // <time>
-        fprintf(pArgs->outFile, "%.10lf,%.10lf,%.3lf,%.3lf,%.3lf,%.3lf\n",
-                p->latitude,                                    // <lat> [decimal degrees]
-                p->longitude,                                   // <lon> [decimal degrees]
-                csvElev(p->elevation, pArgs),                   // <ele> [meters/feet]
-                csvDist(mToKm(p->distance), pArgs),             // <distance> [km/miles]
-                csvSpeed(mpsToKph(p->speed), pArgs),            // <speed> [kph/mph]
-                p->grade);                                      // garde [%]
+static void printCsvTrkPt(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p)
+{
+    fprintf(pArgs->outFile, "%d,%s,%d,%s,",
+            p->index,                                       // <trkPt>
+            p->inFile,                                      // <inFile>
+            p->lineNum,                                     // <line#>
+            fmtTimeStamp(p->timestamp, pTrk->startTime, pArgs->tsFmt));   // <time>
+    fprintf(pArgs->outFile, "%.10lf,%.10lf,%.3lf,%.3lf,%.3lf,%.3lf\n",
+            p->latitude,                                    // <lat> [decimal degrees]
+            p->longitude,                                   // <lon> [decimal degrees]
+            csvElev(p->elevation, pArgs),                   // <ele> [meters/feet]
+            csvDist(mToKm(p->distance), pArgs),             // <distance> [km/miles]
+            csvSpeed(mpsToKph(p->speed), pArgs),            // <speed> [kph/mph]
+            p->grade);                                      // garde [%]
+}
 
-    }
+static int printCsvFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    printCsvHdr(pTrk, pArgs);
+
+    return printTrkPts(pTrk, pArgs, printCsvTrkPt);
 }
 
 static int gpxActType(GpsTrk *pTrk, CmdArgs *pArgs)
@@ -184,12 +455,11 @@ static int gpxActType(GpsTrk *pTrk, CmdArgs *pArgs)
     return type;
 }
 
-static void printGpxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+static void printGpxHdr(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     time_t now;
     struct tm brkDwnTime = {0};
     char timeBuf[128];
-    TrkPt *p;
 
     // Print headers
     fprintf(pArgs->outFile, "%s", xmlHeader);
@@ -212,27 +482,32 @@ static void printGpxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
 
     // Print track segment
     fprintf(pArgs->outFile, "    <trkseg>\n");
+}
 
-    // Print all the track points
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        double timeStamp = p->timestamp;
-        time_t time;
-        int ms = 0;
-
-        time = (time_t) timeStamp;  // sec only
-        ms = (timeStamp - (double) time) * 1000.0;  // milliseconds
-        strftime(timeBuf, sizeof (timeBuf), "%Y-%m-%dT%H:%M:%S", gmtime_r(&time, &brkDwnTime));
-        fprintf(pArgs->outFile, "      <trkpt lat=\"%.10lf\" lon=\"%.10lf\">\n", p->latitude, p->longitude);
-        fprintf(pArgs->outFile, "        <ele>%.10lf</ele>\n", p->elevation);
-        fprintf(pArgs->outFile, "        <time>%s.%03dZ</time>\n", timeBuf, ms);
-        fprintf(pArgs->outFile, "        <extensions>\n");
-        if (pTrk->inMask & SD_POWER) {
-            fprintf(pArgs->outFile, "          <power>%d</power>\n", p->power);
-        }
-        fprintf(pArgs->outFile, "        </extensions>\n");
-        fprintf(pArgs->outFile, "      </trkpt>\n");
+static void printGpxTrkPt(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p)
+{
+    struct tm brkDwnTime = {0};
+    char timeBuf[128];
+    double timeStamp = p->timestamp;
+    time_t time;
+    int ms = 0;
+
+    time = (time_t) timeStamp;  // sec only
+    ms = (timeStamp - (double) time) * 1000.0;  // milliseconds
+    strftime(timeBuf, sizeof (timeBuf), "%Y-%m-%dT%H:%M:%S", gmtime_r(&time, &brkDwnTime));
+    fprintf(pArgs->outFile, "      <trkpt lat=\"%.10lf\" lon=\"%.10lf\">\n", p->latitude, p->longitude);
+    fprintf(pArgs->outFile, "        <ele>%.10lf</ele>\n", p->elevation);
+    fprintf(pArgs->outFile, "        <time>%s.%03dZ</time>\n", timeBuf, ms);
+    fprintf(pArgs->outFile, "        <extensions>\n");
+    if (pTrk->inMask & SD_POWER) {
+        fprintf(pArgs->outFile, "          <power>%d</power>\n", p->power);
     }
+    fprintf(pArgs->outFile, "        </extensions>\n");
+    fprintf(pArgs->outFile, "      </trkpt>\n");
+}
 
+static void printGpxTlr(GpsTrk *pTrk, CmdArgs *pArgs)
+{
     fprintf(pArgs->outFile, "    </trkseg>\n");
 
     fprintf(pArgs->outFile, "  </trk>\n");
@@ -240,6 +515,20 @@ static void printGpxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
     fprintf(pArgs->outFile, "</gpx>\n");
 }
 
+static int printGpxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    printGpxHdr(pTrk, pArgs);
+
+    // Print all the track points
+    if (printTrkPts(pTrk, pArgs, printGpxTrkPt) != 0) {
+        return -1;
+    }
+
+    printGpxTlr(pTrk, pArgs);
+
+    return 0;
+}
+
 static const char *tcxActType(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     int type;
@@ -262,20 +551,22 @@ static const char *tcxActType(GpsTrk *pTrk, CmdArgs *pArgs)
     return actTypeTbl[type];
 }
 
-// Format the data according to the FulGaz ".shiz" format
-static void printShizFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+// Print the SHIZ header. When 'padLen' is not zero, the
+// "extra" object is padded with white space to that length,
+// so that it can later be rewritten in place once the final
+// values are known.
+static void printShizHdr(GpsTrk *pTrk, CmdArgs *pArgs, double startTime, double endTime, int padLen)
 {
     const int toughness = 100;
     const int speed_filter = 0;
     const int elevation_filter = 0;
     const int grade_filter = 0;
-    const int timeshift = 0;
+    const int timeshift = pTrk->timeShift;
     time_t now;
     struct tm brkDwnTime = {0};
     char dateBuf[64];
-    double startTime = TAILQ_FIRST(&pTrk->trkPtList)->timestamp;
-    double endTime = TAILQ_LAST(&pTrk->trkPtList, TrkPtList)->timestamp;
-    TrkPt *p;
+    char extraBuf[512];
+    int len;
 
     now = time(NULL);
     strftime(dateBuf, sizeof (dateBuf), "%A, %B %d, %Y", gmtime_r(&now, &brkDwnTime));
@@ -283,28 +574,62 @@ static void printShizFmt(GpsTrk *pTrk, CmdArgs *pArgs)
     // This format is valid as of FulGaz version 4.2.15
     // Duration is in hh:mm:ss, distance is in kilometers,
     // elevation is in meters, and speed is in km/h.
-    fprintf(pArgs->outFile, "{\"extra\":{\"duration\":\"%s\",\"distance\":%.5lf,\"toughness\":\"%d\",\"elevation_gain\":%u,\"date_processed\":\"%s\",\"speed_filter\":\"%d\",\"elevation_filter\":\"%d\",\"grade_filter\":\"%d\",\"timeshift\":\"%d\"},\"gpx\":{\"trk\":{\"trkseg\":{\"trkpt\":[",
+    len = snprintf(extraBuf, sizeof (extraBuf), "{\"extra\":{\"duration\":\"%s\",\"distance\":%.5lf,\"toughness\":\"%d\",\"elevation_gain\":%u,\"date_processed\":\"%s\",\"speed_filter\":\"%d\",\"elevation_filter\":\"%d\",\"grade_filter\":\"%d\",\"timeshift\":\"%d\"}",
             fmtTimeStamp((endTime - startTime), 0, hms), mToKm(pTrk->distance), toughness, (unsigned) pTrk->elevGain, dateBuf, speed_filter, elevation_filter, grade_filter, timeshift);
 
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        // The first "trkpt" is included in the header line,
-        // while all the other ones are printed on separate
-        // lines...
+    fprintf(pArgs->outFile, "%s%*s,\"gpx\":{\"trk\":{\"trkseg\":{\"trkpt\":[", extraBuf, (len < padLen) ? (padLen - len) : 0, "");
+}
 
-        fprintf(pArgs->outFile, "{\"-lon\":\"%.7lf\",\"-lat\":\"%.7lf\",\"speed\":\"%.1lf\",\"ele\":\"%.3lf\",\"distance\":\"%.5lf\",\"bearing\":\"%.2lf\",\"slope\":\"%.1lf\",\"time\":\"%s\",\"index\":%u,\"cadence\":%u,\"p\":%u}%s",
-                p->longitude, p->latitude, mpsToKph(p->speed), p->elevation, mToKm(p->distance), p->bearing, p->grade, fmtTimeStamp((p->timestamp - startTime), 0, hms), p->index, p->cadence, 0, (TAILQ_NEXT(p, tqEntry) != NULL) ? ",\n" : "");
+static void printShizTrkPt(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p, double startTime, Bool first)
+{
+    // The first "trkpt" is included in the header line,
+    // while all the other ones are printed on separate
+    // lines...
+    if (!first) {
+        fprintf(pArgs->outFile, ",\n");
     }
 
+    fprintf(pArgs->outFile, "{\"-lon\":\"%.7lf\",\"-lat\":\"%.7lf\",\"speed\":\"%.1lf\",\"ele\":\"%.3lf\",\"distance\":\"%.5lf\",\"bearing\":\"%.2lf\",\"slope\":\"%.1lf\",\"time\":\"%s\",\"index\":%u,\"cadence\":%u,\"p\":%u}",
+            p->longitude, p->latitude, mpsToKph(p->speed), p->elevation, mToKm(p->distance), p->bearing, p->grade, fmtTimeStamp((p->timestamp - startTime), 0, hms), p->index, p->cadence, 0);
+}
+
+// Print a "trkpt" of the entire track. Only the very first
+// one skips the separator, so the chunk boundaries make no
+// difference.
+static void printShizTrkPtOfTrk(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p)
+{
+    const TrkPt *pFirst = TAILQ_FIRST(&pTrk->trkPtList);
+
+    printShizTrkPt(pTrk, pArgs, p, pFirst->timestamp, (p == pFirst));
+}
+
+static void printShizTlr(GpsTrk *pTrk, CmdArgs *pArgs)
+{
     fprintf(pArgs->outFile, "]}},\"seg\":[]}}\n");
 }
 
-// Format the data according to the Garmin Connect style
-static void printTcxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+// Format the data according to the FulGaz ".shiz" format
+static int printShizFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    double startTime = TAILQ_FIRST(&pTrk->trkPtList)->timestamp;
+    double endTime = TAILQ_LAST(&pTrk->trkPtList, TrkPtList)->timestamp;
+
+    printShizHdr(pTrk, pArgs, startTime, endTime, 0);
+
+    if (printTrkPts(pTrk, pArgs, printShizTrkPtOfTrk) != 0) {
+        return -1;
+    }
+
+    printShizTlr(pTrk, pArgs);
+
+    return 0;
+}
+
+static void printTcxHdr(GpsTrk *pTrk, CmdArgs *pArgs)
 {
     time_t now;
     struct tm brkDwnTime = {0};
     char timeBuf[128];
-    TrkPt *p;
 
     // Print headers
     fprintf(pArgs->outFile, "%s", xmlHeader);
@@ -330,37 +655,42 @@ static void printTcxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
     fprintf(pArgs->outFile, "        <Cadence>%d</Cadence>\n", pTrk->maxCadence);   // this <Cadence> seems to be the max cadence value
     fprintf(pArgs->outFile, "        <TriggerMethod>Manual</TriggerMethod>\n");
     fprintf(pArgs->outFile, "        <Track>\n");
+}
 
-    // Print all the track points
-    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
-        double timeStamp = p->timestamp;
-        time_t time;
-        int ms = 0;
-
-        time = (time_t) timeStamp;  // sec only
-        ms = (timeStamp - (double) time) * 1000.0;  // milliseconds
-        strftime(timeBuf, sizeof (timeBuf), "%Y-%m-%dT%H:%M:%S", gmtime_r(&time, &brkDwnTime));
-
-        fprintf(pArgs->outFile, "          <Trackpoint>\n");
-        fprintf(pArgs->outFile, "            <Time>%s.%03dZ</Time>\n", timeBuf, ms);
-        fprintf(pArgs->outFile, "            <Position>\n");
-        fprintf(pArgs->outFile, "              <LatitudeDegrees>%.10lf</LatitudeDegrees>\n", p->latitude);
-        fprintf(pArgs->outFile, "              <LongitudeDegrees>%.10lf</LongitudeDegrees>\n", p->longitude);
-        fprintf(pArgs->outFile, "            </Position>\n");
-        fprintf(pArgs->outFile, "            <AltitudeMeters>%.10lf</AltitudeMeters>\n", p->elevation);
-        fprintf(pArgs->outFile, "            <DistanceMeters>%.10lf</DistanceMeters>\n", p->distance);
-        fprintf(pArgs->outFile, "            <Extensions>\n");
-        fprintf(pArgs->outFile, "              <GradePercent>%.2lf</GradePercent>\n", p->grade);
-        fprintf(pArgs->outFile, "              <ns3:TPX>\n");
-        fprintf(pArgs->outFile, "                <ns3:Speed>%.10lf</ns3:Speed>\n", p->speed);
-        if (pTrk->inMask & SD_POWER) {
-            fprintf(pArgs->outFile, "                <ns3:Watts>%d</ns3:Watts>\n", p->power);
-        }
-        fprintf(pArgs->outFile, "              </ns3:TPX>\n");
-        fprintf(pArgs->outFile, "            </Extensions>\n");
-        fprintf(pArgs->outFile, "          </Trackpoint>\n");
+static void printTcxTrkPt(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p)
+{
+    struct tm brkDwnTime = {0};
+    char timeBuf[128];
+    double timeStamp = p->timestamp;
+    time_t time;
+    int ms = 0;
+
+    time = (time_t) timeStamp;  // sec only
+    ms = (timeStamp - (double) time) * 1000.0;  // milliseconds
+    strftime(timeBuf, sizeof (timeBuf), "%Y-%m-%dT%H:%M:%S", gmtime_r(&time, &brkDwnTime));
+
+    fprintf(pArgs->outFile, "          <Trackpoint>\n");
+    fprintf(pArgs->outFile, "            <Time>%s.%03dZ</Time>\n", timeBuf, ms);
+    fprintf(pArgs->outFile, "            <Position>\n");
+    fprintf(pArgs->outFile, "              <LatitudeDegrees>%.10lf</LatitudeDegrees>\n", p->latitude);
+    fprintf(pArgs->outFile, "              <LongitudeDegrees>%.10lf</LongitudeDegrees>\n", p->longitude);
+    fprintf(pArgs->outFile, "            </Position>\n");
+    fprintf(pArgs->outFile, "            <AltitudeMeters>%.10lf</AltitudeMeters>\n", p->elevation);
+    fprintf(pArgs->outFile, "            <DistanceMeters>%.10lf</DistanceMeters>\n", p->distance);
+    fprintf(pArgs->outFile, "            <Extensions>\n");
+    fprintf(pArgs->outFile, "              <GradePercent>%.2lf</GradePercent>\n", p->grade);
+    fprintf(pArgs->outFile, "              <ns3:TPX>\n");
+    fprintf(pArgs->outFile, "                <ns3:Speed>%.10lf</ns3:Speed>\n", p->speed);
+    if (pTrk->inMask & SD_POWER) {
+        fprintf(pArgs->outFile, "                <ns3:Watts>%d</ns3:Watts>\n", p->power);
     }
+    fprintf(pArgs->outFile, "              </ns3:TPX>\n");
+    fprintf(pArgs->outFile, "            </Extensions>\n");
+    fprintf(pArgs->outFile, "          </Trackpoint>\n");
+}
 
+static void printTcxTlr(GpsTrk *pTrk, CmdArgs *pArgs)
+{
     fprintf(pArgs->outFile, "        </Track>\n");
     fprintf(pArgs->outFile, "      </Lap>\n");
     fprintf(pArgs->outFile, "    </Activity>\n");
@@ -378,17 +708,421 @@ static void printTcxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
     fprintf(pArgs->outFile, "</TrainingCenterDatabase>\n");
 }
 
-void printOutput(GpsTrk *pTrk, CmdArgs *pArgs)
+// Format the data according to the Garmin Connect style
+static int printTcxFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    printTcxHdr(pTrk, pArgs);
+
+    // Print all the track points
+    if (printTrkPts(pTrk, pArgs, printTcxTrkPt) != 0) {
+        return -1;
+    }
+
+    printTcxTlr(pTrk, pArgs);
+
+    return 0;
+}
+
+// Local message types used in the FIT output file
+typedef enum FitLocalMesg {
+    fitLocalFileId = 0,
+    fitLocalRecord = 1,
+    fitLocalLap = 2,
+    fitLocalSession = 3,
+    fitLocalActivity = 4,
+} FitLocalMesg;
+
+// Definition of the fields we write in each FIT message. Only
+// the fields for which we have data are included, so that the
+// data messages are as compact as possible.
+static const FIT_FIELD_DEF fitFileIdFields[] = {
+    { FIT_FILE_ID_FIELD_NUM_TIME_CREATED, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_FILE_ID_FIELD_NUM_MANUFACTURER, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_FILE_ID_FIELD_NUM_PRODUCT, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_FILE_ID_FIELD_NUM_TYPE, 1, FIT_BASE_TYPE_ENUM },
+};
+
+static const FIT_FIELD_DEF fitRecordFields[] = {
+    { FIT_RECORD_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_RECORD_FIELD_NUM_POSITION_LAT, 4, FIT_BASE_TYPE_SINT32 },
+    { FIT_RECORD_FIELD_NUM_POSITION_LONG, 4, FIT_BASE_TYPE_SINT32 },
+    { FIT_RECORD_FIELD_NUM_DISTANCE, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_RECORD_FIELD_NUM_ENHANCED_SPEED, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_RECORD_FIELD_NUM_ENHANCED_ALTITUDE, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_RECORD_FIELD_NUM_GRADE, 2, FIT_BASE_TYPE_SINT16 },
+    { FIT_RECORD_FIELD_NUM_POWER, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_RECORD_FIELD_NUM_HEART_RATE, 1, FIT_BASE_TYPE_UINT8 },
+    { FIT_RECORD_FIELD_NUM_CADENCE, 1, FIT_BASE_TYPE_UINT8 },
+    { FIT_RECORD_FIELD_NUM_TEMPERATURE, 1, FIT_BASE_TYPE_SINT8 },
+};
+
+static const FIT_FIELD_DEF fitLapFields[] = {
+    { FIT_LAP_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_START_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_TOTAL_ELAPSED_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_TOTAL_TIMER_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_TOTAL_DISTANCE, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_ENHANCED_MAX_SPEED, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_TOTAL_ASCENT, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_LAP_FIELD_NUM_TOTAL_DESCENT, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_LAP_FIELD_NUM_EVENT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_LAP_FIELD_NUM_EVENT_TYPE, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_LAP_FIELD_NUM_SPORT, 1, FIT_BASE_TYPE_ENUM },
+};
+
+static const FIT_FIELD_DEF fitSessionFields[] = {
+    { FIT_SESSION_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_START_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_ELAPSED_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_TIMER_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_DISTANCE, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_ENHANCED_MAX_SPEED, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_ASCENT, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_DESCENT, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_FIRST_LAP_INDEX, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_NUM_LAPS, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_EVENT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_SESSION_FIELD_NUM_EVENT_TYPE, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_SESSION_FIELD_NUM_SPORT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_SESSION_FIELD_NUM_SUB_SPORT, 1, FIT_BASE_TYPE_ENUM },
+};
+
+static const FIT_FIELD_DEF fitActivityFields[] = {
+    { FIT_ACTIVITY_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_ACTIVITY_FIELD_NUM_TOTAL_TIMER_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_ACTIVITY_FIELD_NUM_NUM_SESSIONS, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_ACTIVITY_FIELD_NUM_TYPE, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_ACTIVITY_FIELD_NUM_EVENT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_ACTIVITY_FIELD_NUM_EVENT_TYPE, 1, FIT_BASE_TYPE_ENUM },
+};
+
+typedef struct FitMesgDef {
+    FitLocalMesg localMesg;
+    FIT_MESG_NUM globalMesgNum;
+    const FIT_FIELD_DEF *fields;
+    int numFields;
+} FitMesgDef;
+
+#define FIT_MESG_DEF(local, global, fields)   { local, global, fields, (sizeof (fields) / sizeof (fields[0])) }
+
+static const FitMesgDef fitMesgDefTbl[] = {
+    FIT_MESG_DEF(fitLocalFileId, FIT_MESG_NUM_FILE_ID, fitFileIdFields),
+    FIT_MESG_DEF(fitLocalRecord, FIT_MESG_NUM_RECORD, fitRecordFields),
+    FIT_MESG_DEF(fitLocalLap, FIT_MESG_NUM_LAP, fitLapFields),
+    FIT_MESG_DEF(fitLocalSession, FIT_MESG_NUM_SESSION, fitSessionFields),
+    FIT_MESG_DEF(fitLocalActivity, FIT_MESG_NUM_ACTIVITY, fitActivityFields),
+};
+
+#define FIT_NUM_MESG_DEFS   (sizeof (fitMesgDefTbl) / sizeof (fitMesgDefTbl[0]))
+
+// Buffered FIT writer. The messages are assembled in the
+// buffer, and the CRC is updated as the buffer is flushed
+// out to the output file.
+typedef struct FitWriter {
+    FILE *fp;
+    FIT_UINT16 crc;
+    size_t len;
+    FIT_UINT8 buf[8192];
+} FitWriter;
+
+static void fitFlush(FitWriter *pFw)
 {
+    if (pFw->len != 0) {
+        pFw->crc = FitCRC_Update16(pFw->crc, pFw->buf, (FIT_UINT32) pFw->len);
+        fwrite(pFw->buf, pFw->len, 1, pFw->fp);
+        pFw->len = 0;
+    }
+}
+
+// Make sure there is room for a message of the given size
+static void fitReserve(FitWriter *pFw, size_t size)
+{
+    if ((pFw->len + size) > sizeof (pFw->buf)) {
+        fitFlush(pFw);
+    }
+}
+
+// FIT files use little-endian byte order
+static void fitPut8(FitWriter *pFw, FIT_UINT8 val)
+{
+    pFw->buf[pFw->len++] = val;
+}
+
+static void fitPut16(FitWriter *pFw, FIT_UINT16 val)
+{
+    fitPut8(pFw, (FIT_UINT8) val);
+    fitPut8(pFw, (FIT_UINT8) (val >> 8));
+}
+
+static void fitPut32(FitWriter *pFw, FIT_UINT32 val)
+{
+    fitPut16(pFw, (FIT_UINT16) val);
+    fitPut16(pFw, (FIT_UINT16) (val >> 16));
+}
+
+static size_t fitDefMesgSize(const FitMesgDef *pDef)
+{
+    return (FIT_HDR_SIZE + 5 + (pDef->numFields * FIT_FIELD_DEF_SIZE));
+}
+
+static size_t fitDataMesgSize(const FitMesgDef *pDef)
+{
+    size_t size = FIT_HDR_SIZE;
+
+    for (int n = 0; n < pDef->numFields; n++) {
+        size += pDef->fields[n].size;
+    }
+
+    return size;
+}
+
+static void fitPutDefMesg(FitWriter *pFw, const FitMesgDef *pDef)
+{
+    fitReserve(pFw, fitDefMesgSize(pDef));
+    fitPut8(pFw, FIT_HDR_TYPE_DEF_BIT | pDef->localMesg);
+    fitPut8(pFw, 0);    // reserved
+    fitPut8(pFw, FIT_ARCH_ENDIAN_LITTLE);
+    fitPut16(pFw, pDef->globalMesgNum);
+    fitPut8(pFw, pDef->numFields);
+    for (int n = 0; n < pDef->numFields; n++) {
+        fitPut8(pFw, pDef->fields[n].field_def_num);
+        fitPut8(pFw, pDef->fields[n].size);
+        fitPut8(pFw, pDef->fields[n].base_type);
+    }
+}
+
+static FIT_UINT32 fitTimeStamp(double timestamp)
+{
+    return (FIT_UINT32) ((time_t) timestamp - fitEpoch);
+}
+
+static FIT_UINT32 fitSemiCircles(double degrees)
+{
+    return (FIT_UINT32) (FIT_SINT32) lround((degrees / (double) 180.0) * (double) 0x7FFFFFFF);
+}
+
+static FIT_SPORT fitSport(GpsTrk *pTrk)
+{
+    if (pTrk->actType == run) {
+        return FIT_SPORT_RUNNING;
+    } else if (pTrk->actType == walk) {
+        return FIT_SPORT_WALKING;
+    } else if (pTrk->actType == hike) {
+        return FIT_SPORT_HIKING;
+    } else if (pTrk->actType == other) {
+        return FIT_SPORT_GENERIC;
+    }
+
+    return FIT_SPORT_CYCLING;   // default: Ride
+}
+
+static void fitPutRecordMesg(FitWriter *pFw, GpsTrk *pTrk, const TrkPt *p)
+{
+    fitReserve(pFw, fitDataMesgSize(&fitMesgDefTbl[fitLocalRecord]));
+    fitPut8(pFw, fitLocalRecord);
+    fitPut32(pFw, fitTimeStamp(p->timestamp));
+    fitPut32(pFw, fitSemiCircles(p->latitude));
+    fitPut32(pFw, fitSemiCircles(p->longitude));
+    fitPut32(pFw, (FIT_UINT32) lround(p->distance * 100.0));
+    fitPut32(pFw, (FIT_UINT32) lround(p->speed * 1000.0));
+    fitPut32(pFw, (FIT_UINT32) lround((p->elevation + 500.0) * 5.0));
+    fitPut16(pFw, (FIT_UINT16) (FIT_SINT16) lround(p->grade * 100.0));
+    fitPut16(pFw, (pTrk->inMask & SD_POWER) ? (FIT_UINT16) p->power : FIT_UINT16_INVALID);
+    fitPut8(pFw, (pTrk->inMask & SD_HR) ? (FIT_UINT8) p->heartRate : FIT_UINT8_INVALID);
+    fitPut8(pFw, (pTrk->inMask & SD_CADENCE) ? (FIT_UINT8) p->cadence : FIT_UINT8_INVALID);
+    fitPut8(pFw, (FIT_UINT8) ((pTrk->inMask & SD_ATEMP) ? (FIT_SINT8) p->ambTemp : FIT_SINT8_INVALID));
+}
+
+// The LAP and SESSION messages carry the same totals
+static void fitPutTotals(FitWriter *pFw, GpsTrk *pTrk)
+{
+    fitPut32(pFw, fitTimeStamp(pTrk->endTime));
+    fitPut32(pFw, fitTimeStamp(pTrk->startTime));
+    fitPut32(pFw, (FIT_UINT32) lround((pTrk->endTime - pTrk->startTime) * 1000.0));
+    fitPut32(pFw, (FIT_UINT32) lround((pTrk->time - pTrk->stoppedTime) * 1000.0));
+    fitPut32(pFw, (FIT_UINT32) lround(pTrk->distance * 100.0));
+    fitPut32(pFw, (FIT_UINT32) lround(pTrk->maxSpeed * 1000.0));
+    fitPut16(pFw, (FIT_UINT16) lround(pTrk->elevGain));
+    fitPut16(pFw, (FIT_UINT16) lround(pTrk->elevLoss));
+}
+
+// Format the data as a binary FIT activity file. The size of
+// the data must be known in advance, as it goes in the file
+// header, but as all the messages have a fixed size, it only
+// takes knowing how many TrkPt's there are.
+static void printFitFmt(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    static FitWriter fitWriter;
+    FitWriter *pFw = &fitWriter;
+    FIT_UINT32 dataSize = 0;
+    int numTrkPts = 0;
+    TrkPt *p;
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        numTrkPts++;
+    }
+
+    for (int n = 0; n < FIT_NUM_MESG_DEFS; n++) {
+        const FitMesgDef *pDef = &fitMesgDefTbl[n];
+        dataSize += fitDefMesgSize(pDef);
+        dataSize += fitDataMesgSize(pDef) * ((pDef->localMesg == fitLocalRecord) ? numTrkPts : 1);
+    }
+
+    pFw->fp = pArgs->outFile;
+    pFw->len = 0;
+
+    // File header, with its own CRC
+    fitPut8(pFw, FIT_FILE_HDR_SIZE);
+    fitPut8(pFw, FIT_PROTOCOL_VERSION);
+    fitPut16(pFw, FIT_PROFILE_VERSION);
+    fitPut32(pFw, dataSize);
+    fitPut8(pFw, '.');
+    fitPut8(pFw, 'F');
+    fitPut8(pFw, 'I');
+    fitPut8(pFw, 'T');
+    fitPut16(pFw, FitCRC_Calc16(pFw->buf, FIT_FILE_HDR_SIZE - 2));
+
+    // The file CRC covers the header too
+    pFw->crc = 0;
+
+    // Definition messages
+    for (int n = 0; n < FIT_NUM_MESG_DEFS; n++) {
+        fitPutDefMesg(pFw, &fitMesgDefTbl[n]);
+    }
+
+    // FILE_ID
+    fitReserve(pFw, fitDataMesgSize(&fitMesgDefTbl[fitLocalFileId]));
+    fitPut8(pFw, fitLocalFileId);
+    fitPut32(pFw, fitTimeStamp(pTrk->startTime));
+    fitPut16(pFw, FIT_MANUFACTURER_DEVELOPMENT);
+    fitPut16(pFw, 0);
+    fitPut8(pFw, FIT_FILE_ACTIVITY);
+
+    // RECORD's
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        fitPutRecordMesg(pFw, pTrk, p);
+    }
+
+    // LAP
+    fitReserve(pFw, fitDataMesgSize(&fitMesgDefTbl[fitLocalLap]));
+    fitPut8(pFw, fitLocalLap);
+    fitPutTotals(pFw, pTrk);
+    fitPut8(pFw, FIT_EVENT_LAP);
+    fitPut8(pFw, FIT_EVENT_TYPE_STOP);
+    fitPut8(pFw, fitSport(pTrk));
+
+    // SESSION
+    fitReserve(pFw, fitDataMesgSize(&fitMesgDefTbl[fitLocalSession]));
+    fitPut8(pFw, fitLocalSession);
+    fitPutTotals(pFw, pTrk);
+    fitPut16(pFw, 0);   // first_lap_index
+    fitPut16(pFw, 1);   // num_laps
+    fitPut8(pFw, FIT_EVENT_SESSION);
+    fitPut8(pFw, FIT_EVENT_TYPE_STOP);
+    fitPut8(pFw, fitSport(pTrk));
+    fitPut8(pFw, (pTrk->actType == vride) ? FIT_SUB_SPORT_VIRTUAL_ACTIVITY : FIT_SUB_SPORT_GENERIC);
+
+    // ACTIVITY
+    fitReserve(pFw, fitDataMesgSize(&fitMesgDefTbl[fitLocalActivity]));
+    fitPut8(pFw, fitLocalActivity);
+    fitPut32(pFw, fitTimeStamp(pTrk->endTime));
+    fitPut32(pFw, (FIT_UINT32) lround((pTrk->time - pTrk->stoppedTime) * 1000.0));
+    fitPut16(pFw, 1);   // num_sessions
+    fitPut8(pFw, FIT_ACTIVITY_MANUAL);
+    fitPut8(pFw, FIT_EVENT_ACTIVITY);
+    fitPut8(pFw, FIT_EVENT_TYPE_STOP);
+
+    fitFlush(pFw);
+
+    // File CRC
+    fitPut16(pFw, pFw->crc);
+    fwrite(pFw->buf, pFw->len, 1, pFw->fp);
+    pFw->len = 0;
+}
+
+int printOutput(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    int s = 0;
+
     if (pArgs->outFmt == nil) {
         printSummary(pTrk, pArgs);
     } else if (pArgs->outFmt == csv) {
-        printCsvFmt(pTrk, pArgs);
+        s = printCsvFmt(pTrk, pArgs);
     } else if (pArgs->outFmt == gpx) {
-        printGpxFmt(pTrk, pArgs);
+        s = printGpxFmt(pTrk, pArgs);
     } else if (pArgs->outFmt == shiz) {
-        printShizFmt(pTrk, pArgs);
+        s = printShizFmt(pTrk, pArgs);
     } else if (pArgs->outFmt == tcx) {
-        printTcxFmt(pTrk, pArgs);
+        s = printTcxFmt(pTrk, pArgs);
+    } else if (pArgs->outFmt == fit) {
+        printFitFmt(pTrk, pArgs);
+    }
+
+    // Catch the errors of the buffered writes too, e.g.
+    // those of the header and the trailer.
+    if ((s == 0) && ferror(pArgs->outFile)) {
+        fprintf(stderr, "Failed to write output data !!!\n");
+        s = -1;
+    }
+
+    return s;
+}
+
+// Returns true if the output can be generated one TrkPt at a
+// time, without having the entire track in memory: i.e. the
+// format doesn't require any aggregate values up front, or the
+// output file is seekable so that they can be filled in later.
+Bool printOutputStreamable(CmdArgs *pArgs)
+{
+    struct stat st;
+
+    if ((pArgs->outFmt == csv) || (pArgs->outFmt == gpx)) {
+        return true;
+    } else if (pArgs->outFmt == shiz) {
+        return ((fstat(fileno(pArgs->outFile), &st) == 0) && S_ISREG(st.st_mode));
+    }
+
+    return false;
+}
+
+void printOutputBegin(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    if (pArgs->outFmt == csv) {
+        printCsvHdr(pTrk, pArgs);
+    } else if (pArgs->outFmt == gpx) {
+        printGpxHdr(pTrk, pArgs);
+    } else if (pArgs->outFmt == shiz) {
+        // The duration, distance, and elevation gain are not
+        // known yet, so reserve room for the final values.
+        shizHdrOffset = ftell(pArgs->outFile);
+        printShizHdr(pTrk, pArgs, 0.0, 0.0, SHIZ_HDR_PAD_LEN);
+    }
+}
+
+void printOutputTrkPt(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p, Bool first)
+{
+    if (pArgs->outFmt == csv) {
+        printCsvTrkPt(pTrk, pArgs, p);
+    } else if (pArgs->outFmt == gpx) {
+        printGpxTrkPt(pTrk, pArgs, p);
+    } else if (pArgs->outFmt == shiz) {
+        printShizTrkPt(pTrk, pArgs, p, pTrk->startTime, first);
+    }
+}
+
+void printOutputEnd(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    if (pArgs->outFmt == gpx) {
+        printGpxTlr(pTrk, pArgs);
+    } else if (pArgs->outFmt == shiz) {
+        printShizTlr(pTrk, pArgs);
+
+        // Go back and fill in the final values
+        if (shizHdrOffset >= 0) {
+            fseek(pArgs->outFile, shizHdrOffset, SEEK_SET);
+            printShizHdr(pTrk, pArgs, pTrk->startTime, pTrk->endTime, SHIZ_HDR_PAD_LEN);
+            fseek(pArgs->outFile, 0, SEEK_END);
+            shizHdrOffset = -1;
+        }
     }
 }
@@ -6,7 +6,18 @@
 extern "C" {
 #endif
 
-extern void printOutput(GpsTrk *pTrk, CmdArgs *pArgs);
+// Print the track in the specified output format. Returns
+// -1 if the data can't be written out.
+extern int printOutput(GpsTrk *pTrk, CmdArgs *pArgs);
+
+// Print the summary of the TrkPt's within the specified range
+extern int printRangeSummary(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPtRange *pRange);
+
+// Streamed output, one TrkPt at a time
+extern Bool printOutputStreamable(CmdArgs *pArgs);
+extern void printOutputBegin(GpsTrk *pTrk, CmdArgs *pArgs);
+extern void printOutputTrkPt(GpsTrk *pTrk, CmdArgs *pArgs, const TrkPt *p, Bool first);
+extern void printOutputEnd(GpsTrk *pTrk, CmdArgs *pArgs);
 
 #ifdef __cplusplus
 };
@@ -0,0 +1,392 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PACK_AVX2
+#endif
+
+#include "output.h"
+#include "packed.h"
+
+// Location and type of each column in the CompactTrk
+static const struct {
+    size_t colOff;      // offset of the column pointer
+    int size;           // size of each value (in bytes)
+    Bool isSigned;
+    Bool isFloat;
+} packColTbl[numPackedCols] = {
+    [pcIndex]       = { offsetof(CompactTrk, index),        4, true,  false },
+    [pcLineNum]     = { offsetof(CompactTrk, lineNum),      4, true,  false },
+    [pcTime]        = { offsetof(CompactTrk, time),         4, false, false },
+    [pcLatitude]    = { offsetof(CompactTrk, latitude),     4, true,  false },
+    [pcLongitude]   = { offsetof(CompactTrk, longitude),    4, true,  false },
+    [pcDistance]    = { offsetof(CompactTrk, distance),     4, true,  false },
+    [pcElevation]   = { offsetof(CompactTrk, elevation),    4, false, true },
+    [pcSpeed]       = { offsetof(CompactTrk, speed),        4, false, true },
+    [pcDist]        = { offsetof(CompactTrk, dist),         4, false, true },
+    [pcRise]        = { offsetof(CompactTrk, rise),         4, false, true },
+    [pcRun]         = { offsetof(CompactTrk, run),          4, false, true },
+    [pcBearing]     = { offsetof(CompactTrk, bearing),      4, false, true },
+    [pcGrade]       = { offsetof(CompactTrk, grade),        4, false, true },
+    [pcPower]       = { offsetof(CompactTrk, power),        2, false, false },
+    [pcAmbTemp]     = { offsetof(CompactTrk, ambTemp),      1, true,  false },
+    [pcCadence]     = { offsetof(CompactTrk, cadence),      1, false, false },
+    [pcHeartRate]   = { offsetof(CompactTrk, heartRate),    1, false, false },
+};
+
+static void *colPtr(const CompactTrk *pCt, int c)
+{
+    return *(void **) ((const char *) pCt + packColTbl[c].colOff);
+}
+
+// Get the n-th value of the column as a 32-bit word
+static uint32_t getRaw(const CompactTrk *pCt, int c, int n)
+{
+    const void *col = colPtr(pCt, c);
+
+    switch (packColTbl[c].size) {
+    case 1:
+        return packColTbl[c].isSigned ? (uint32_t) ((const int8_t *) col)[n] : ((const uint8_t *) col)[n];
+    case 2:
+        return packColTbl[c].isSigned ? (uint32_t) ((const int16_t *) col)[n] : ((const uint16_t *) col)[n];
+    default:
+        return ((const uint32_t *) col)[n];
+    }
+}
+
+static void setRaw(CompactTrk *pCt, int c, int n, uint32_t raw)
+{
+    void *col = colPtr(pCt, c);
+
+    switch (packColTbl[c].size) {
+    case 1:
+        ((uint8_t *) col)[n] = (uint8_t) raw;
+        break;
+    case 2:
+        ((uint16_t *) col)[n] = (uint16_t) raw;
+        break;
+    default:
+        ((uint32_t *) col)[n] = raw;
+        break;
+    }
+}
+
+static uint32_t residual(uint32_t prev, uint32_t val, Bool isFloat)
+{
+    int32_t delta;
+
+    if (isFloat) {
+        return (val ^ prev);
+    }
+
+    // Zigzag encoding: 0, -1, 1, -2, 2, ... => 0, 1, 2, 3, 4, ...
+    delta = (int32_t) (val - prev);
+    return ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+}
+
+static uint32_t unResidual(uint32_t prev, uint32_t res, Bool isFloat)
+{
+    if (isFloat) {
+        return (res ^ prev);
+    }
+
+    return prev + ((res >> 1) ^ (0 - (res & 1)));
+}
+
+static int bitWidth(uint32_t val)
+{
+    return (val == 0) ? 0 : (32 - __builtin_clz(val));
+}
+
+static int packCol(const CompactTrk *pCt, int c, int numBlocks, PackedCol *pCol)
+{
+    Bool isFloat = packColTbl[c].isFloat;
+    uint32_t res[PACK_BLOCK_SIZE];
+    uint32_t *data;
+    size_t len = 0;
+
+    pCol->first = malloc((numBlocks * sizeof (uint32_t)) + 1);
+    pCol->width = malloc((numBlocks * sizeof (uint8_t)) + 1);
+    pCol->offset = malloc((numBlocks * sizeof (uint32_t)) + 1);
+    // Worst case: all the residuals need 32 bits; plus one
+    // extra word so that the decoder can always read a pair
+    // of words.
+    pCol->data = calloc(((size_t) pCt->numPts + 1), sizeof (uint32_t));
+    if ((pCol->first == NULL) || (pCol->width == NULL) || (pCol->offset == NULL) || (pCol->data == NULL)) {
+        return -1;
+    }
+
+    for (int b = 0; b < numBlocks; b++) {
+        int from = b * PACK_BLOCK_SIZE;
+        int numRes = ((pCt->numPts - from) < PACK_BLOCK_SIZE) ? (pCt->numPts - from - 1) : (PACK_BLOCK_SIZE - 1);
+        uint32_t prev = getRaw(pCt, c, from);
+        uint64_t acc = 0;
+        int accBits = 0;
+        int width = 0;
+
+        pCol->first[b] = prev;
+        for (int i = 0; i < numRes; i++) {
+            uint32_t val = getRaw(pCt, c, from + 1 + i);
+            res[i] = residual(prev, val, isFloat);
+            if (bitWidth(res[i]) > width)
+                width = bitWidth(res[i]);
+            prev = val;
+        }
+        pCol->width[b] = width;
+        pCol->offset[b] = len;
+
+        if (width == 0)
+            continue;
+
+        for (int i = 0; i < numRes; i++) {
+            acc |= ((uint64_t) res[i] << accBits);
+            accBits += width;
+            if (accBits >= 32) {
+                pCol->data[len++] = (uint32_t) acc;
+                acc >>= 32;
+                accBits -= 32;
+            }
+        }
+        if (accBits > 0) {
+            pCol->data[len++] = (uint32_t) acc;
+        }
+    }
+
+    // Trim the data to its actual length, keeping the
+    // extra word at the end.
+    pCol->dataLen = len + 1;
+    pCol->data[len] = 0;
+    if ((data = realloc(pCol->data, pCol->dataLen * sizeof (uint32_t))) != NULL) {
+        pCol->data = data;
+    }
+
+    return 0;
+}
+
+static void freePackedCol(PackedCol *pCol)
+{
+    free(pCol->first);
+    free(pCol->width);
+    free(pCol->offset);
+    free(pCol->data);
+}
+
+PackedTrk *packTrk(const CompactTrk *pCt)
+{
+    PackedTrk *pPt;
+
+    if ((pPt = calloc(1, sizeof (PackedTrk))) == NULL) {
+        fprintf(stderr, "Failed to alloc PackedTrk object !!!\n");
+        return NULL;
+    }
+
+    pPt->numPts = pCt->numPts;
+    pPt->numBlocks = (pCt->numPts + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+    pPt->baseTime = pCt->baseTime;
+    pPt->numSegs = pCt->numSegs;
+    if ((pPt->segs = malloc((pCt->numSegs * sizeof (CompactSeg)) + 1)) == NULL) {
+        goto error;
+    }
+    memcpy(pPt->segs, pCt->segs, (pCt->numSegs * sizeof (CompactSeg)));
+
+    for (int c = 0; c < numPackedCols; c++) {
+        if (packCol(pCt, c, pPt->numBlocks, &pPt->cols[c]) != 0) {
+            goto error;
+        }
+    }
+
+    return pPt;
+
+error:
+    fprintf(stderr, "Failed to alloc PackedTrk columns !!!\n");
+    freePackedTrk(pPt);
+    return NULL;
+}
+
+size_t packedTrkSize(const PackedTrk *pPt)
+{
+    size_t size = sizeof (PackedTrk) + (pPt->numSegs * sizeof (CompactSeg));
+
+    for (int c = 0; c < numPackedCols; c++) {
+        size += pPt->numBlocks * ((2 * sizeof (uint32_t)) + sizeof (uint8_t));
+        size += pPt->cols[c].dataLen * sizeof (uint32_t);
+    }
+
+    return size;
+}
+
+void freePackedTrk(PackedTrk *pPt)
+{
+    if (pPt != NULL) {
+        for (int c = 0; c < numPackedCols; c++) {
+            freePackedCol(&pPt->cols[c]);
+        }
+        free(pPt->segs);
+        free(pPt);
+    }
+}
+
+#ifdef PACK_AVX2
+// Unpack the residuals four at a time: gather the 64-bit
+// window of each one, shift each window by the bit position
+// of its residual, and pack the low words of the result.
+// Returns the number of residuals unpacked.
+__attribute__((target("avx2")))
+static int unpackBitsAvx2(const uint32_t *data, int width, int num, uint32_t *res)
+{
+    const __m256i mask = _mm256_set1_epi64x((long long) ((1ULL << width) - 1));
+    const __m256i lowWords = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+    const __m128i step = _mm_setr_epi32(0, width, (2 * width), (3 * width));
+    int i;
+
+    for (i = 0; (i + 4) <= num; i += 4) {
+        __m128i bitPos = _mm_add_epi32(_mm_set1_epi32(i * width), step);
+        __m128i wordPos = _mm_srli_epi32(bitPos, 5);
+        __m256i shift = _mm256_cvtepu32_epi64(_mm_and_si128(bitPos, _mm_set1_epi32(31)));
+        __m256i win = _mm256_i32gather_epi64((const long long *) data, wordPos, 4);
+        __m256i val = _mm256_and_si256(_mm256_srlv_epi64(win, shift), mask);
+
+        val = _mm256_permutevar8x32_epi32(val, lowWords);
+        _mm_storeu_si128((__m128i *) &res[i], _mm256_castsi256_si128(val));
+    }
+
+    return i;
+}
+#endif
+
+// Unpack 'num' residuals of 'width' bits each. Each residual is
+// read from a 64-bit window, so there are no branches in the
+// loop, and the loop iterations are independent of each other.
+// The AVX2 version is used when the CPU supports it, and this
+// loop unpacks the rest.
+static void unpackBits(const uint32_t *data, int width, int num, uint32_t *res)
+{
+    uint64_t mask = (1ULL << width) - 1;
+    int i = 0;
+
+#ifdef PACK_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        i = unpackBitsAvx2(data, width, num, res);
+    }
+#endif
+
+    for (; i < num; i++) {
+        unsigned bitPos = i * width;
+        const uint32_t *w = &data[bitPos >> 5];
+        uint64_t win = (uint64_t) w[0] | ((uint64_t) w[1] << 32);
+        res[i] = (uint32_t) ((win >> (bitPos & 31)) & mask);
+    }
+}
+
+int unpackBlock(const PackedTrk *pPt, int blk, CompactTrk *pBlk)
+{
+    int from = blk * PACK_BLOCK_SIZE;
+    int num = ((pPt->numPts - from) < PACK_BLOCK_SIZE) ? (pPt->numPts - from) : PACK_BLOCK_SIZE;
+    uint32_t res[PACK_BLOCK_SIZE];
+
+    for (int c = 0; c < numPackedCols; c++) {
+        const PackedCol *pCol = &pPt->cols[c];
+        Bool isFloat = packColTbl[c].isFloat;
+        int width = pCol->width[blk];
+        uint32_t val = pCol->first[blk];
+
+        if (width != 0) {
+            unpackBits(&pCol->data[pCol->offset[blk]], width, (num - 1), res);
+        } else {
+            memset(res, 0, sizeof (res));
+        }
+
+        setRaw(pBlk, c, 0, val);
+        for (int i = 1; i < num; i++) {
+            val = unResidual(val, res[i - 1], isFloat);
+            setRaw(pBlk, c, i, val);
+        }
+    }
+
+    pBlk->baseTime = pPt->baseTime;
+
+    return num;
+}
+
+int packedIterInit(const PackedTrk *pPt, PackedIter *pIter)
+{
+    memset(pIter, 0, sizeof (*pIter));
+    pIter->pPt = pPt;
+
+    if ((pIter->pBlk = newCompactTrk(PACK_BLOCK_SIZE, 0)) == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+Bool packedIterNext(PackedIter *pIter, TrkPt *p)
+{
+    const PackedTrk *pPt = pIter->pPt;
+    int pos = pIter->pos;
+    int i = pos % PACK_BLOCK_SIZE;
+
+    if (pos >= pPt->numPts) {
+        return false;
+    }
+
+    if (i == 0) {
+        // Decompress the next block
+        unpackBlock(pPt, (pos / PACK_BLOCK_SIZE), pIter->pBlk);
+    }
+
+    if (((pIter->seg + 1) < pPt->numSegs) && (pos == pPt->segs[pIter->seg + 1].first)) {
+        pIter->seg++;
+    }
+
+    memset(p, 0, sizeof (*p));
+    compactGetTrkPt(pIter->pBlk, i, p);
+    p->inFile = pPt->segs[pIter->seg].inFile;
+    if (pos != 0) {
+        p->deltaT = p->timestamp - pIter->prevTimestamp;
+        p->deltaG = fabs(p->grade - pIter->prevGrade);
+    }
+    pIter->prevTimestamp = p->timestamp;
+    pIter->prevGrade = p->grade;
+
+    pIter->pos++;
+
+    return true;
+}
+
+void packedIterEnd(PackedIter *pIter)
+{
+    freeCompactTrk(pIter->pBlk);
+    pIter->pBlk = NULL;
+}
+
+int printPackedTrk(const PackedTrk *pPt, GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    PackedIter iter;
+    TrkPt trkPt;
+    Bool first = true;
+
+    if (!printOutputStreamable(pArgs)) {
+        fprintf(stderr, "Output format can't be streamed !!!\n");
+        return -1;
+    }
+
+    if (packedIterInit(pPt, &iter) != 0) {
+        return -1;
+    }
+
+    printOutputBegin(pTrk, pArgs);
+    while (packedIterNext(&iter, &trkPt)) {
+        printOutputTrkPt(pTrk, pArgs, &trkPt, first);
+        first = false;
+    }
+    printOutputEnd(pTrk, pArgs);
+
+    packedIterEnd(&iter);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "compact.h"
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of TrkPt's in each block of a packed column
+#define PACK_BLOCK_SIZE 128
+
+// Columns of a packed track; same as in the CompactTrk
+typedef enum PackedColId {
+    pcIndex = 0,
+    pcLineNum,
+    pcTime,
+    pcLatitude,
+    pcLongitude,
+    pcDistance,
+    pcElevation,
+    pcSpeed,
+    pcDist,
+    pcRise,
+    pcRun,
+    pcBearing,
+    pcGrade,
+    pcPower,
+    pcAmbTemp,
+    pcCadence,
+    pcHeartRate,
+    numPackedCols
+} PackedColId;
+
+// Block-compressed column. The values in each block are
+// stored as the first value, followed by the residuals of
+// the others bit-packed using the smallest width that fits
+// all of them. The residual of an integer value is the
+// zigzag-encoded delta from the previous value, and that of
+// a float value is the XOR of its bits with the previous one.
+typedef struct PackedCol {
+    uint32_t *first;    // first value of each block
+    uint8_t *width;     // bit width of the residuals of each block
+    uint32_t *offset;   // offset of each block in 'data' (in words)
+    uint32_t *data;     // bit-packed residuals
+    size_t dataLen;     // length of 'data' (in words)
+} PackedCol;
+
+// Compressed representation of a CompactTrk. The GpsTrk keeps
+// the reference track (e.g. for 'compare' or 'sync') in this
+// form, and its users decompress it one block at a time. The
+// filters still work on the TrkPt list of the track.
+typedef struct PackedTrk {
+    int numPts;
+    int numBlocks;
+    double baseTime;
+    int numSegs;
+    CompactSeg *segs;
+    PackedCol cols[numPackedCols];
+} PackedTrk;
+
+// Iterator that decompresses the packed track on the fly,
+// one block at a time.
+typedef struct PackedIter {
+    const PackedTrk *pPt;
+    CompactTrk *pBlk;   // values of the current block
+    int pos;            // position of the next TrkPt
+    int seg;            // segment of the next TrkPt
+    double prevTimestamp;
+    double prevGrade;
+} PackedIter;
+
+// Compress the compact track. Returns NULL on error.
+extern PackedTrk *packTrk(const CompactTrk *pCt);
+
+// Number of bytes used by the packed track
+extern size_t packedTrkSize(const PackedTrk *pPt);
+
+extern void freePackedTrk(PackedTrk *pPt);
+
+// Decompress the specified block of the packed track into
+// the first positions of the columns of 'pBlk'. Returns the
+// number of TrkPt's in the block.
+extern int unpackBlock(const PackedTrk *pPt, int blk, CompactTrk *pBlk);
+
+// Iterate over the TrkPt's of the packed track. The values of
+// the next TrkPt are copied into '*p'. Returns false when
+// there are no more TrkPt's.
+extern int packedIterInit(const PackedTrk *pPt, PackedIter *pIter);
+extern Bool packedIterNext(PackedIter *pIter, TrkPt *p);
+extern void packedIterEnd(PackedIter *pIter);
+
+// Write out the packed track in the current output format,
+// which must be streamable, one TrkPt at a time.
+extern int printPackedTrk(const PackedTrk *pPt, GpsTrk *pTrk, CmdArgs *pArgs);
+
+#ifdef __cplusplus
+};
+#endif
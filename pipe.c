@@ -0,0 +1,228 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "comp.h"
+#include "output.h"
+#include "pipe.h"
+#include "trkpt.h"
+
+// Max number of TrkPt's that can be queued between the
+// input parser and the worker thread. When the queue is
+// full the parser blocks, which keeps the memory used by
+// the pipeline bounded.
+#define PIPE_QUEUE_SIZE 1024
+
+// Check/compute/output pipeline
+typedef struct TrkPipe {
+    GpsTrk *pTrk;
+    CmdArgs *pArgs;
+
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    // Ring of TrkPt's waiting to be processed, along with
+    // their sensor data masks
+    TrkPt *queue[PIPE_QUEUE_SIZE];
+    int sdMask[PIPE_QUEUE_SIZE];
+    int head;           // next TrkPt to be processed
+    int count;          // number of TrkPt's in the queue
+    Bool eof;           // no more TrkPt's will be queued
+
+    Bool streamOut;     // write out each TrkPt as soon as it's ready
+    int status;         // 0=OK -1=ERROR
+} TrkPipe;
+
+static TrkPt *pipeGetTrkPt(TrkPipe *pPipe, int *pSdMask)
+{
+    TrkPt *p = NULL;
+
+    pthread_mutex_lock(&pPipe->mutex);
+    while ((pPipe->count == 0) && !pPipe->eof) {
+        pthread_cond_wait(&pPipe->notEmpty, &pPipe->mutex);
+    }
+    if (pPipe->count != 0) {
+        p = pPipe->queue[pPipe->head];
+        *pSdMask = pPipe->sdMask[pPipe->head];
+        pPipe->head = (pPipe->head + 1) % PIPE_QUEUE_SIZE;
+        pPipe->count--;
+        pthread_cond_signal(&pPipe->notFull);
+    }
+    pthread_mutex_unlock(&pPipe->mutex);
+
+    return p;
+}
+
+static void pipeSetError(TrkPipe *pPipe)
+{
+    pthread_mutex_lock(&pPipe->mutex);
+    pPipe->status = -1;
+    pthread_mutex_unlock(&pPipe->mutex);
+}
+
+// The worker thread takes the TrkPt's from the queue in the
+// same order they were parsed, and runs them through the same
+// steps as checkTrkPts() and compMetrics(). When the output is
+// streamed only the previous TrkPt is kept around.
+static void *pipeWorker(void *arg)
+{
+    TrkPipe *pPipe = arg;
+    GpsTrk *pTrk = pPipe->pTrk;
+    CmdArgs *pArgs = pPipe->pArgs;
+    TrkPt *p1 = NULL;   // previous TrkPt
+    TrkPt *p2;          // current TrkPt
+    Bool error = false;
+    int sdMask;
+
+    while ((p2 = pipeGetTrkPt(pPipe, &sdMask)) != NULL) {
+        // After an error just drain the queue
+        if (error) {
+            free(p2);
+            continue;
+        }
+
+        // Unless we are processing the data verbatim, check
+        // the TrkPt for duplicates and bogus values.
+        if ((p1 != NULL) && !pArgs->verbatim) {
+            int s;
+
+            if ((s = checkTrkPt(pTrk, pArgs, p1, p2)) < 0) {
+                pipeSetError(pPipe);
+                error = true;
+            }
+
+            if (s != 0) {
+                // Discard this TrkPt
+                free(p2);
+                continue;
+            }
+        }
+
+        // Only this thread touches the mask while the pipeline
+        // is running, so the output of each TrkPt reflects the
+        // sensor data seen up to it.
+        pTrk->inMask |= sdMask;
+
+        // Compute the metrics
+        compTrkPtMetrics(pTrk, pArgs, p1, p2);
+        if (p1 != NULL) {
+            updMinMaxValues(pTrk, p1, p2);
+        }
+
+        if (pPipe->streamOut) {
+            printOutputTrkPt(pTrk, pArgs, p2, (p1 == NULL));
+            free(p1);
+        } else {
+            TAILQ_INSERT_TAIL(&pTrk->trkPtList, p2, tqEntry);
+        }
+
+        p1 = p2;
+    }
+
+    if (pPipe->streamOut) {
+        free(p1);
+    }
+
+    return NULL;
+}
+
+int pipeStart(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    TrkPipe *pPipe;
+
+    if ((pPipe = calloc(1, sizeof (TrkPipe))) == NULL) {
+        fprintf(stderr, "Failed to alloc TrkPipe object !!!\n");
+        return -1;
+    }
+
+    pPipe->pTrk = pTrk;
+    pPipe->pArgs = pArgs;
+    pthread_mutex_init(&pPipe->mutex, NULL);
+    pthread_cond_init(&pPipe->notEmpty, NULL);
+    pthread_cond_init(&pPipe->notFull, NULL);
+
+    // Without the CLI nothing can change the TrkPt's once
+    // their metrics have been computed, so if the output
+    // format allows it there is no need to keep them.
+    pPipe->streamOut = (pArgs->noCli && printOutputStreamable(pArgs));
+
+    initMinMaxValues(pTrk);
+
+    if (pPipe->streamOut) {
+        printOutputBegin(pTrk, pArgs);
+    }
+
+    if (pthread_create(&pPipe->worker, NULL, pipeWorker, pPipe) != 0) {
+        fprintf(stderr, "Failed to create pipeline thread !!!\n");
+        free(pPipe);
+        return -1;
+    }
+
+    pTrk->pipe = pPipe;
+
+    return 0;
+}
+
+int pipePutTrkPt(TrkPipe *pPipe, TrkPt *pTrkPt, int sdMask)
+{
+    int s;
+
+    pthread_mutex_lock(&pPipe->mutex);
+    while ((pPipe->count == PIPE_QUEUE_SIZE) && (pPipe->status == 0)) {
+        pthread_cond_wait(&pPipe->notFull, &pPipe->mutex);
+    }
+    if ((s = pPipe->status) == 0) {
+        int tail = (pPipe->head + pPipe->count) % PIPE_QUEUE_SIZE;
+        pPipe->queue[tail] = pTrkPt;
+        pPipe->sdMask[tail] = sdMask;
+        pPipe->count++;
+        pthread_cond_signal(&pPipe->notEmpty);
+    } else {
+        free(pTrkPt);
+    }
+    pthread_mutex_unlock(&pPipe->mutex);
+
+    return s;
+}
+
+int pipeFinish(GpsTrk *pTrk, CmdArgs *pArgs)
+{
+    TrkPipe *pPipe = pTrk->pipe;
+    int s;
+
+    if (pPipe == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pPipe->mutex);
+    pPipe->eof = true;
+    pthread_cond_signal(&pPipe->notEmpty);
+    pthread_mutex_unlock(&pPipe->mutex);
+
+    pthread_join(pPipe->worker, NULL);
+
+    if ((s = pPipe->status) == 0) {
+        if (pPipe->streamOut) {
+            printOutputEnd(pTrk, pArgs);
+
+            // The TrkPt's are gone, so make sure nobody tries
+            // to access them through the min/max pointers.
+            pTrk->maxCadenceTrkPt = pTrk->maxHeartRateTrkPt = pTrk->maxPowerTrkPt = pTrk->maxTempTrkPt = NULL;
+            pTrk->maxDeltaDTrkPt = pTrk->maxDeltaGTrkPt = pTrk->maxDeltaTTrkPt = NULL;
+            pTrk->maxElevTrkPt = pTrk->maxGradeTrkPt = pTrk->maxSpeedTrkPt = NULL;
+            pTrk->minCadenceTrkPt = pTrk->minHeartRateTrkPt = pTrk->minPowerTrkPt = pTrk->minTempTrkPt = NULL;
+            pTrk->minDeltaDTrkPt = pTrk->minDeltaTTrkPt = NULL;
+            pTrk->minElevTrkPt = pTrk->minGradeTrkPt = pTrk->minSpeedTrkPt = NULL;
+        }
+    }
+
+    pthread_cond_destroy(&pPipe->notFull);
+    pthread_cond_destroy(&pPipe->notEmpty);
+    pthread_mutex_destroy(&pPipe->mutex);
+    free(pPipe);
+    pTrk->pipe = NULL;
+
+    return s;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Start the check/compute/output pipeline for the given track
+extern int pipeStart(GpsTrk *pTrk, CmdArgs *pArgs);
+
+// Feed a newly parsed TrkPt into the pipeline, along with the
+// sensor data (SD_xxx) it carries. The worker thread owns the
+// track's inMask while the pipeline is running.
+extern int pipePutTrkPt(struct TrkPipe *pPipe, TrkPt *pTrkPt, int sdMask);
+
+// Wait for the pipeline to drain and tear it down
+extern int pipeFinish(GpsTrk *pTrk, CmdArgs *pArgs);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,70 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+// Max number of worker threads
+#define POOL_MAX_THREADS    64
+
+// Work items shared by the worker threads
+typedef struct WorkPool {
+    PoolWorkFunc func;
+    void *arg;
+    pthread_mutex_t mutex;
+    int numItems;
+    int nextItem;       // next item to be processed
+} WorkPool;
+
+static void *poolWorker(void *arg)
+{
+    WorkPool *pPool = arg;
+
+    while (1) {
+        int item;
+
+        pthread_mutex_lock(&pPool->mutex);
+        item = pPool->nextItem++;
+        pthread_mutex_unlock(&pPool->mutex);
+
+        if (item >= pPool->numItems)
+            break;
+
+        pPool->func(pPool->arg, item);
+    }
+
+    return NULL;
+}
+
+void poolRun(int numItems, PoolWorkFunc func, void *arg)
+{
+    pthread_t workers[POOL_MAX_THREADS];
+    int numWorkers = 0;
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    WorkPool pool = {
+        .func = func,
+        .arg = arg,
+        .numItems = numItems,
+        .nextItem = 0
+    };
+
+    pthread_mutex_init(&pool.mutex, NULL);
+
+    // The calling thread is one of the workers, so only
+    // spawn the extra ones.
+    while ((numWorkers < (numCpus - 1)) && (numWorkers < (numItems - 1)) &&
+           (numWorkers < POOL_MAX_THREADS)) {
+        if (pthread_create(&workers[numWorkers], NULL, poolWorker, &pool) != 0) {
+            // Make do with the workers we already have
+            break;
+        }
+        numWorkers++;
+    }
+
+    poolWorker(&pool);
+
+    for (int n = 0; n < numWorkers; n++) {
+        pthread_join(workers[n], NULL);
+    }
+
+    pthread_mutex_destroy(&pool.mutex);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Function that processes the specified work item
+typedef void (*PoolWorkFunc)(void *arg, int item);
+
+// Run the work function on the items 0..numItems-1 using a
+// pool of worker threads, and wait for all of them to be done.
+// The items can be processed in any order, so each one must
+// be independent of the others.
+extern void poolRun(int numItems, PoolWorkFunc func, void *arg);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "resample.h"
+#include "trkpt.h"
+
+// Columns of values interpolated
+typedef enum ResCol {
+    colLat = 0,
+    colLon,
+    colElev,
+    colSpeed,
+    colDist,
+    colTime,
+    colTemp,
+    colCad,
+    colHr,
+    colPower,
+    numCols
+} ResCol;
+
+// Linearly interpolate a column: out[k] = in[j] + w * (in[j+1] - in[j])
+static void interpCol(const double *in, double *out, const int *idx, const double *w, int numOut)
+{
+    for (int k = 0; k < numOut; k++) {
+        const double *c = &in[idx[k]];
+        out[k] = c[0] + w[k] * (c[1] - c[0]);
+    }
+}
+
+int resampleTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs, Bool byDist, double step)
+{
+    double *inCol[numCols];
+    double *outCol[numCols];
+    double *inBuf = NULL;
+    double *outBuf = NULL;
+    const double *x;    // the column being resampled
+    TrkPt **inPts = NULL;
+    int *idx = NULL;
+    double *w = NULL;
+    int numIn = 0;
+    int numOut;
+    int s = -1;
+    TrkPt *p;
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        numIn++;
+    }
+
+    if (numIn < 2) {
+        return 0;
+    }
+
+    // Load the values into columns
+    inPts = malloc(numIn * sizeof (TrkPt *));
+    inBuf = malloc(numCols * numIn * sizeof (double));
+    if ((inPts == NULL) || (inBuf == NULL)) {
+        fprintf(stderr, "Failed to alloc resample columns !!!\n");
+        goto done;
+    }
+    for (int c = 0; c < numCols; c++) {
+        inCol[c] = &inBuf[c * numIn];
+    }
+
+    {
+        int n = 0;
+
+        TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+            inPts[n] = p;
+            inCol[colLat][n] = p->latitude;
+            inCol[colLon][n] = p->longitude;
+            inCol[colElev][n] = p->elevation;
+            inCol[colSpeed][n] = p->speed;
+            inCol[colDist][n] = p->distance;
+            inCol[colTime][n] = p->timestamp;
+            inCol[colTemp][n] = p->ambTemp;
+            inCol[colCad][n] = p->cadence;
+            inCol[colHr][n] = p->heartRate;
+            inCol[colPower][n] = p->power;
+            n++;
+        }
+    }
+
+    x = byDist ? inCol[colDist] : inCol[colTime];
+
+    if (x[numIn - 1] <= x[0]) {
+        fprintf(stderr, "Can't resample a track with a null %s span !!!\n", byDist ? "distance" : "time");
+        goto done;
+    }
+
+    // Number of output TrkPt's: one every 'step' units, plus
+    // the last TrkPt if it doesn't fall on the grid.
+    numOut = (int) floor((x[numIn - 1] - x[0]) / step) + 1;
+    if ((x[0] + (numOut - 1) * step) < x[numIn - 1]) {
+        numOut++;
+    }
+
+    idx = malloc(numOut * sizeof (int));
+    w = malloc(numOut * sizeof (double));
+    outBuf = malloc(numCols * numOut * sizeof (double));
+    if ((idx == NULL) || (w == NULL) || (outBuf == NULL)) {
+        fprintf(stderr, "Failed to alloc resample columns !!!\n");
+        goto done;
+    }
+    for (int c = 0; c < numCols; c++) {
+        outCol[c] = &outBuf[c * numOut];
+    }
+
+    // Find the pair of input TrkPt's that surround each output
+    // TrkPt, and its relative position between them. As both
+    // are sorted, this takes a single pass.
+    for (int k = 0, j = 0; k < numOut; k++) {
+        double xk = (k < (numOut - 1)) ? (x[0] + k * step) : x[numIn - 1];
+        double dx;
+
+        while ((j < (numIn - 2)) && (x[j + 1] < xk)) {
+            j++;
+        }
+        idx[k] = j;
+        dx = x[j + 1] - x[j];
+        w[k] = (dx > 0.0) ? ((xk - x[j]) / dx) : 0.0;
+        if (w[k] > 1.0)
+            w[k] = 1.0;
+    }
+
+    // Interpolate all the columns
+    for (int c = 0; c < numCols; c++) {
+        interpCol(inCol[c], outCol[c], idx, w, numOut);
+    }
+
+    // Replace the TrkPt's. The new TrkPt's refer to the input
+    // file location of the nearest original TrkPt.
+    {
+        struct TrkPtList newList = TAILQ_HEAD_INITIALIZER(newList);
+
+        for (int k = 0; k < numOut; k++) {
+            const TrkPt *src = inPts[idx[k] + (w[k] >= 0.5)];
+
+            if ((p = newTrkPt(k, src->inFile, src->lineNum)) == NULL) {
+                while ((p = TAILQ_FIRST(&newList)) != NULL) {
+                    TAILQ_REMOVE(&newList, p, tqEntry);
+                    free(p);
+                }
+                goto done;
+            }
+
+            p->latitude = outCol[colLat][k];
+            p->longitude = outCol[colLon][k];
+            p->elevation = outCol[colElev][k];
+            p->speed = outCol[colSpeed][k];
+            p->distance = outCol[colDist][k];
+            p->timestamp = outCol[colTime][k];
+            p->ambTemp = (int) lround(outCol[colTemp][k]);
+            p->cadence = (int) lround(outCol[colCad][k]);
+            p->heartRate = (int) lround(outCol[colHr][k]);
+            p->power = (int) lround(outCol[colPower][k]);
+
+            TAILQ_INSERT_TAIL(&newList, p, tqEntry);
+        }
+
+        for (int n = 0; n < numIn; n++) {
+            remTrkPt(pTrk, inPts[n]);
+        }
+        TAILQ_CONCAT(&pTrk->trkPtList, &newList, tqEntry);
+        pTrk->numTrkPts = numOut;
+    }
+
+    s = 0;
+
+done:
+    free(inBuf);
+    free(outBuf);
+    free(inPts);
+    free(idx);
+    free(w);
+
+    return s;
+}
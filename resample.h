@@ -0,0 +1,17 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Replace the TrkPt's with a new set of TrkPt's uniformly
+// spaced in time (in seconds) or in distance (in meters),
+// whose values are linearly interpolated from the original
+// ones.
+extern int resampleTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs, Bool byDist, double step);
+
+#ifdef __cplusplus
+};
+#endif
@@ -12,6 +12,12 @@ extern double* dvector(long nl, long nh);
 extern void free_dvector(double *v, long nl, long nh);
 extern char sgfilter(double yr[], double yf[], int mm, int nl, int nr, int ld, int m);
 
+// Numerical Recipes FFT routines; the arrays are 1-based, and
+// their size must be a power of 2.
+extern void four1(double data[], unsigned long nn, int isign);
+extern void realft(double data[], unsigned long n, int isign);
+extern void twofft(double data1[], double data2[], double fft1[], double fft2[], unsigned long n);
+
 #ifdef __cplusplus
 };
 #endif
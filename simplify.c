@@ -0,0 +1,268 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "const.h"
+#include "simplify.h"
+
+// This is a variant of the Visvalingam-Whyatt algorithm: the
+// TrkPt's are removed one at a time, in order of increasing
+// "cost", where the cost of removing a TrkPt is the largest
+// position, elevation, and grade deviation, each one normalized
+// by its tolerance, of the original TrkPt's that would be
+// replaced by the line joining its current neighbors. That
+// includes the TrkPt's removed earlier between them, so the
+// tolerances hold against the original track. Removal stops
+// when the cost of the cheapest TrkPt exceeds 1. The TrkPt's
+// are kept in a binary min-heap ordered by cost, so that the
+// whole thing takes O(N log N) times the length of the spans
+// being replaced.
+//
+// See below for the details:
+//
+//   https://en.wikipedia.org/wiki/Visvalingam%E2%80%93Whyatt_algorithm
+//
+
+typedef struct SimpCtx {
+    const SimplifyTol *pTol;
+    TrkPt **pts;    // TrkPt's in the range
+    int *prev;      // index of the previous TrkPt still in the track
+    int *next;      // index of the next TrkPt still in the track
+    double *cost;   // cost of removing the TrkPt
+    int *heap;      // min-heap of TrkPt indices
+    int *heapPos;   // position of each TrkPt in the heap (-1 if not in it)
+    int heapLen;
+} SimpCtx;
+
+static double segGrade(const TrkPt *p1, const TrkPt *p2)
+{
+    double run = p2->distance - p1->distance;
+    return (run > 0.0) ? (((p2->elevation - p1->elevation) * 100.0) / run) : 0.0;
+}
+
+// Distance (in meters) from 'p' to the line 'p1'-'p2', using
+// a local equirectangular projection, which is accurate
+// enough for points that are close together.
+static double lineDist(const TrkPt *p1, const TrkPt *p, const TrkPt *p2)
+{
+    double kx = cos(p1->latitude * degToRad) * degToRad * earthMeanRadius;
+    double ky = degToRad * earthMeanRadius;
+    double x2 = (p2->longitude - p1->longitude) * kx;
+    double y2 = (p2->latitude - p1->latitude) * ky;
+    double x = (p->longitude - p1->longitude) * kx;
+    double y = (p->latitude - p1->latitude) * ky;
+    double len2 = (x2 * x2) + (y2 * y2);
+    double t;
+
+    if (len2 == 0.0) {
+        return sqrt((x * x) + (y * y));
+    }
+
+    // Project onto the segment
+    t = ((x * x2) + (y * y2)) / len2;
+    if (t < 0.0)
+        t = 0.0;
+    else if (t > 1.0)
+        t = 1.0;
+    x -= t * x2;
+    y -= t * y2;
+
+    return sqrt((x * x) + (y * y));
+}
+
+// Cost of removing TrkPt 'i': the line joining its neighbors
+// replaces all the original TrkPt's between them.
+static double compCost(SimpCtx *pCtx, int i)
+{
+    const SimplifyTol *pTol = pCtx->pTol;
+    int from = pCtx->prev[i];
+    int to = pCtx->next[i];
+    const TrkPt *p1 = pCtx->pts[from];
+    const TrkPt *p2 = pCtx->pts[to];
+    double dist = p2->distance - p1->distance;
+    double grade = segGrade(p1, p2);
+    double cost = 0.0;
+
+    for (int k = (from + 1); k <= to; k++) {
+        const TrkPt *p = pCtx->pts[k];
+
+        // Grade deviation of each original segment
+        cost = fmax(cost, fabs(segGrade(pCtx->pts[k - 1], p) - grade) / pTol->grade);
+
+        if (k == to)
+            break;
+
+        // Position deviation
+        cost = fmax(cost, lineDist(p1, p, p2) / pTol->dist);
+
+        // Elevation deviation, interpolating by distance
+        if (dist > 0.0) {
+            double elev = p1->elevation + ((p2->elevation - p1->elevation) * (p->distance - p1->distance) / dist);
+            cost = fmax(cost, fabs(p->elevation - elev) / pTol->elev);
+        } else {
+            cost = fmax(cost, fabs(p->elevation - p1->elevation) / pTol->elev);
+        }
+    }
+
+    return cost;
+}
+
+static void heapSwap(SimpCtx *pCtx, int a, int b)
+{
+    int t = pCtx->heap[a];
+    pCtx->heap[a] = pCtx->heap[b];
+    pCtx->heap[b] = t;
+    pCtx->heapPos[pCtx->heap[a]] = a;
+    pCtx->heapPos[pCtx->heap[b]] = b;
+}
+
+static void heapUp(SimpCtx *pCtx, int n)
+{
+    while (n > 0) {
+        int parent = (n - 1) / 2;
+        if (pCtx->cost[pCtx->heap[parent]] <= pCtx->cost[pCtx->heap[n]])
+            break;
+        heapSwap(pCtx, n, parent);
+        n = parent;
+    }
+}
+
+static void heapDown(SimpCtx *pCtx, int n)
+{
+    for (;;) {
+        int l = (2 * n) + 1;
+        int r = l + 1;
+        int min = n;
+
+        if ((l < pCtx->heapLen) && (pCtx->cost[pCtx->heap[l]] < pCtx->cost[pCtx->heap[min]]))
+            min = l;
+        if ((r < pCtx->heapLen) && (pCtx->cost[pCtx->heap[r]] < pCtx->cost[pCtx->heap[min]]))
+            min = r;
+        if (min == n)
+            break;
+        heapSwap(pCtx, n, min);
+        n = min;
+    }
+}
+
+static int heapPop(SimpCtx *pCtx)
+{
+    int i = pCtx->heap[0];
+
+    pCtx->heapLen--;
+    if (pCtx->heapLen != 0) {
+        heapSwap(pCtx, 0, pCtx->heapLen);
+        heapDown(pCtx, 0);
+    }
+    pCtx->heapPos[i] = -1;
+
+    return i;
+}
+
+// Update the cost of a TrkPt that is still in the heap
+static void heapUpdate(SimpCtx *pCtx, int i, double minCost)
+{
+    int n = pCtx->heapPos[i];
+
+    if (n < 0) {
+        return;
+    }
+
+    // Don't let the cost drop below that of the TrkPt just
+    // removed, so that the TrkPt's are removed in order of
+    // increasing cost.
+    pCtx->cost[i] = fmax(compCost(pCtx, i), minCost);
+    heapUp(pCtx, n);
+    heapDown(pCtx, pCtx->heapPos[i]);
+}
+
+int simplifyTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs, const SimplifyTol *pTol, TrkPt ***pRemList)
+{
+    SimpCtx ctx = { .pTol = pTol };
+    TrkPt **remList = NULL;
+    int numPts = 0;
+    int numRem = 0;
+    TrkPt *p;
+
+    *pRemList = NULL;
+
+    // Collect the TrkPt's in the range
+    if ((ctx.pts = malloc(pTrk->numTrkPts * sizeof (TrkPt *))) == NULL) {
+        fprintf(stderr, "Failed to alloc TrkPt array !!!\n");
+        return -1;
+    }
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        if ((p->index >= pArgs->range.from) && (p->index <= pArgs->range.to) &&
+            (numPts < pTrk->numTrkPts)) {
+            ctx.pts[numPts++] = p;
+        }
+    }
+
+    if (numPts < 3) {
+        // Nothing to do
+        free(ctx.pts);
+        return 0;
+    }
+
+    ctx.prev = malloc(numPts * sizeof (int));
+    ctx.next = malloc(numPts * sizeof (int));
+    ctx.cost = malloc(numPts * sizeof (double));
+    ctx.heap = malloc(numPts * sizeof (int));
+    ctx.heapPos = malloc(numPts * sizeof (int));
+    remList = malloc(numPts * sizeof (TrkPt *));
+    if ((ctx.prev == NULL) || (ctx.next == NULL) || (ctx.cost == NULL) ||
+        (ctx.heap == NULL) || (ctx.heapPos == NULL) || (remList == NULL)) {
+        fprintf(stderr, "Failed to alloc simplify context !!!\n");
+        numRem = -1;
+        goto done;
+    }
+
+    for (int i = 0; i < numPts; i++) {
+        ctx.prev[i] = i - 1;
+        ctx.next[i] = i + 1;
+        ctx.heapPos[i] = -1;
+    }
+
+    // The first and last TrkPt's in the range are always
+    // kept, so only the ones in between go in the heap.
+    for (int i = 1; i < (numPts - 1); i++) {
+        ctx.cost[i] = compCost(&ctx, i);
+        ctx.heap[ctx.heapLen] = i;
+        ctx.heapPos[i] = ctx.heapLen++;
+        heapUp(&ctx, ctx.heapPos[i]);
+    }
+
+    while (ctx.heapLen != 0) {
+        int i = ctx.heap[0];
+        double cost = ctx.cost[i];
+
+        if (cost > 1.0) {
+            break;
+        }
+
+        heapPop(&ctx);
+        remList[numRem++] = ctx.pts[i];
+
+        // Unlink the TrkPt and update its neighbors
+        ctx.next[ctx.prev[i]] = ctx.next[i];
+        ctx.prev[ctx.next[i]] = ctx.prev[i];
+        heapUpdate(&ctx, ctx.prev[i], cost);
+        heapUpdate(&ctx, ctx.next[i], cost);
+    }
+
+done:
+    free(ctx.pts);
+    free(ctx.prev);
+    free(ctx.next);
+    free(ctx.cost);
+    free(ctx.heap);
+    free(ctx.heapPos);
+
+    if (numRem > 0) {
+        *pRemList = remList;
+    } else {
+        free(remList);
+    }
+
+    return numRem;
+}
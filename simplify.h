@@ -0,0 +1,25 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tolerances used to simplify the track
+typedef struct SimplifyTol {
+    double dist;    // max deviation from the original position (in meters)
+    double elev;    // max deviation from the original elevation (in meters)
+    double grade;   // max deviation from the original grade (in %)
+} SimplifyTol;
+
+// Find the TrkPt's in the range specified in 'pArgs' that can
+// be removed without exceeding the specified tolerances. The
+// list of TrkPt's is returned in '*pRemList', which must be
+// freed by the caller. Returns the number of TrkPt's in the
+// list, or -1 on error.
+extern int simplifyTrkPts(GpsTrk *pTrk, const CmdArgs *pArgs, const SimplifyTol *pTol, TrkPt ***pRemList);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,439 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "comp.h"
+#include "const.h"
+#include "grid.h"
+#include "stitch.h"
+#include "trkpt.h"
+
+#define STITCH_MAX_DUP_DIST     25.0    // max distance (m) between duplicate TrkPt's
+#define STITCH_MAX_TIME_GAP     60.0    // longer time gaps (s) are closed
+#define STITCH_MAX_DIST_GAP     20.0    // longer distance gaps (m) are bridged
+#define STITCH_MIN_SPEED        1.0     // min speed (m/s) assumed across a gap
+
+static TrkPt *segNext(const TrkSeg *pSeg, TrkPt *p)
+{
+    return (p != pSeg->last) ? TAILQ_NEXT(p, tqEntry) : NULL;
+}
+
+// Discard the first 'numPts' TrkPt's of the segment
+static void trimTrkSeg(GpsTrk *pTrk, TrkSeg *pSeg, int numPts)
+{
+    while ((numPts-- > 0) && (pSeg->first != NULL)) {
+        TrkPt *p = pSeg->first;
+
+        if (p == pSeg->last) {
+            pSeg->first = pSeg->last = NULL;
+        } else {
+            pSeg->first = TAILQ_NEXT(p, tqEntry);
+        }
+        remTrkPt(pTrk, p);
+    }
+}
+
+static void renumTrkPts(GpsTrk *pTrk)
+{
+    TrkPt *p;
+    int n = 0;
+
+    TAILQ_FOREACH(p, &pTrk->trkPtList, tqEntry) {
+        p->index = n++;
+    }
+    pTrk->numTrkPts = n;
+}
+
+static int cmpSegStartTime(const void *a, const void *b)
+{
+    const TrkSeg *pSeg1 = a;
+    const TrkSeg *pSeg2 = b;
+
+    if (pSeg1->first->timestamp < pSeg2->first->timestamp)
+        return -1;
+    if (pSeg1->first->timestamp > pSeg2->first->timestamp)
+        return 1;
+
+    return (pSeg1->fileNum - pSeg2->fileNum);
+}
+
+// Check whether the TrkPt 'p' is not behind 'p1' in the
+// direction of travel from 'p1' to 'p2'.
+static Bool notBehind(const TrkPt *p1, const TrkPt *p2, const TrkPt *p)
+{
+    double k = cos(p1->latitude * degToRad);
+    double dot = ((p2->longitude - p1->longitude) * k) * ((p->longitude - p1->longitude) * k) +
+                 (p2->latitude - p1->latitude) * (p->latitude - p1->latitude);
+
+    return (dot >= 0.0);
+}
+
+// Find the number of TrkPt's at the start of the segment that
+// duplicate the end of the previous one. This happens when the
+// device was restarted, or when the same stretch of the route
+// was recorded by another device with a different clock: the
+// segment then starts on the route of the previous segment,
+// and goes past its last TrkPt.
+static int findDupRegion(const TrkSeg *pPrev, const TrkSeg *pSeg)
+{
+    const TrkPt *pLast = pPrev->last;
+    GeoGrid *pPrevGrid = newGeoGrid(pPrev->first, pPrev->last);
+    GeoGrid *pGrid = newGeoGrid(pSeg->first, pSeg->last);
+    GeoHit hit;
+    GeoHit *hits = NULL;
+    int numHits;
+    int numDups = 0;
+
+    if ((pPrevGrid != NULL) && (pGrid != NULL) &&
+        (gridNearest(pPrevGrid, pSeg->first->latitude, pSeg->first->longitude, &hit) == 0) &&
+        (hit.dist <= STITCH_MAX_DUP_DIST) &&
+        ((numHits = gridWithin(pGrid, pLast->latitude, pLast->longitude, STITCH_MAX_DUP_DIST, &hits)) > 0)) {
+        int best = 0;
+
+        const TrkPt *p1, *p2;
+
+        // The segment catches up with the previous one at the
+        // closest TrkPt of its first pass by the last TrkPt.
+        for (int i = 1; (i < numHits) && (hits[i].pos == (hits[i - 1].pos + 1)); i++) {
+            if (hits[i].dist < hits[best].dist)
+                best = i;
+        }
+        numDups = hits[best].pos;
+
+        // That TrkPt is a duplicate too, unless it comes after
+        // the last TrkPt along the route.
+        p1 = hits[best].p;
+        if ((p1 == pSeg->last) || ((p2 = TAILQ_NEXT(p1, tqEntry)) == NULL) ||
+            (notBehind(p1, p2, pLast))) {
+            numDups++;
+        }
+
+        // All the TrkPt's up to there must be on the route of
+        // the previous segment. If the segment leaves it, as in
+        // an out-and-back ride on the next day that starts mid
+        // route and passes the last TrkPt later on, it's not a
+        // duplicate.
+        p1 = pSeg->first;
+        for (int i = 0; i < numDups; i++, p1 = TAILQ_NEXT(p1, tqEntry)) {
+            if ((gridNearest(pPrevGrid, p1->latitude, p1->longitude, &hit) != 0) ||
+                (hit.dist > STITCH_MAX_DUP_DIST)) {
+                numDups = 0;
+                break;
+            }
+        }
+    }
+
+    free(hits);
+    delGeoGrid(pGrid);
+    delGeoGrid(pPrevGrid);
+
+    return numDups;
+}
+
+// Bridge the gap between the last TrkPt of the previous segment
+// and the first TrkPt of the segment with TrkPt's interpolated
+// at 1-second intervals.
+static int bridgeGap(const TrkSeg *pPrev, const TrkSeg *pSeg, double gapDist, double gapTime)
+{
+    const TrkPt *p1 = pPrev->last;
+    TrkPt *p2 = pSeg->first;
+    int numPts = (int) ceil(gapTime) - 1;
+
+    for (int i = 1; i <= numPts; i++) {
+        double f = (double) i / gapTime;
+        TrkPt *p;
+
+        if ((p = dupTrkPt(p1)) == NULL) {
+            return -1;
+        }
+        p->timestamp = p1->timestamp + i;
+        p->latitude = p1->latitude + f * (p2->latitude - p1->latitude);
+        p->longitude = p1->longitude + f * (p2->longitude - p1->longitude);
+        p->elevation = p1->elevation + f * (p2->elevation - p1->elevation);
+        p->distance = p1->distance + f * gapDist;
+        p->speed = gapDist / gapTime;
+        p->cadence = (int) lround(p1->cadence + f * (p2->cadence - p1->cadence));
+        p->heartRate = (int) lround(p1->heartRate + f * (p2->heartRate - p1->heartRate));
+        p->power = (int) lround(p1->power + f * (p2->power - p1->power));
+        TAILQ_INSERT_BEFORE(p2, p, tqEntry);
+    }
+
+    return numPts;
+}
+
+// Stitch the segment to the end of the previous one
+static int stitchTrkSeg(GpsTrk *pTrk, const CmdArgs *pArgs, const TrkSeg *pPrev, TrkSeg *pSeg)
+{
+    const TrkPt *pLast = pPrev->last;
+    TrkPt *p;
+    double gapDist, gapTime;
+    int numDups = 0;
+
+    // Discard the TrkPt's that overlap in time with the
+    // previous segment.
+    for (p = pSeg->first; (p != NULL) && (p->timestamp <= pLast->timestamp); p = segNext(pSeg, p)) {
+        numDups++;
+    }
+    trimTrkSeg(pTrk, pSeg, numDups);
+
+    // Discard the TrkPt's that overlap in space with the
+    // previous segment.
+    if (pSeg->first != NULL) {
+        int n = findDupRegion(pPrev, pSeg);
+        trimTrkSeg(pTrk, pSeg, n);
+        numDups += n;
+    }
+
+    if ((numDups != 0) && !pArgs->quiet) {
+        fprintf(stderr, "INFO: Discarding %d TrkPt's of %s that overlap with %s !\n",
+                numDups, pSeg->inFile, pPrev->inFile);
+    }
+
+    if (pSeg->first == NULL) {
+        return 0;
+    }
+
+    // Close long time gaps; e.g. between the stages of a
+    // multi-day event.
+    gapDist = compHaversine(pLast, pSeg->first);
+    gapTime = pSeg->first->timestamp - pLast->timestamp;
+    pSeg->baseTime = 0.0;
+    if (gapTime > STITCH_MAX_TIME_GAP) {
+        double speed = fmax(((pLast->speed + pSeg->first->speed) / 2.0), STITCH_MIN_SPEED);
+        double newGapTime = fmax(round(gapDist / speed), 1.0);
+
+        if (!pArgs->quiet) {
+            fprintf(stderr, "INFO: Closing the %.0lf s time gap between %s and %s !\n",
+                    gapTime, pPrev->inFile, pSeg->inFile);
+        }
+        pSeg->baseTime = newGapTime - gapTime;
+        gapTime = newGapTime;
+    }
+
+    // Rebase the distance and time values of the segment so
+    // that they continue from the end of the previous one.
+    pSeg->baseDistance = pLast->distance + gapDist - pSeg->first->distance;
+    for (p = pSeg->first; p != NULL; p = segNext(pSeg, p)) {
+        if (p->distance != nilDist) {
+            p->distance += pSeg->baseDistance;
+        }
+        p->timestamp += pSeg->baseTime;
+    }
+
+    if (gapDist > STITCH_MAX_DIST_GAP) {
+        int numPts;
+
+        if ((numPts = bridgeGap(pPrev, pSeg, gapDist, gapTime)) < 0) {
+            return -1;
+        }
+        if (!pArgs->quiet) {
+            fprintf(stderr, "INFO: Bridging the %.1lf m gap between %s and %s with %d TrkPt's !\n",
+                    gapDist, pPrev->inFile, pSeg->inFile, numPts);
+        }
+    }
+
+    return 0;
+}
+
+int stitchTrkSegs(GpsTrk *pTrk, const CmdArgs *pArgs, TrkSeg *segs, int numSegs)
+{
+    TrkSeg *pPrev = NULL;
+    TrkPt *p;
+    int n = 0;
+
+    // Drop the empty segments, and put the others in
+    // chronological order.
+    for (int i = 0; i < numSegs; i++) {
+        if (segs[i].first != NULL) {
+            segs[n++] = segs[i];
+        }
+    }
+    numSegs = n;
+    qsort(segs, numSegs, sizeof (TrkSeg), cmpSegStartTime);
+
+    // Relink the TrkPt's in the new order
+    TAILQ_INIT(&pTrk->trkPtList);
+    for (int i = 0; i < numSegs; i++) {
+        TrkPt *nxt;
+
+        for (p = segs[i].first; p != NULL; p = nxt) {
+            nxt = segNext(&segs[i], p);
+            TAILQ_INSERT_TAIL(&pTrk->trkPtList, p, tqEntry);
+        }
+    }
+
+    for (int i = 0; i < numSegs; i++) {
+        if (pPrev != NULL) {
+            if (stitchTrkSeg(pTrk, pArgs, pPrev, &segs[i]) != 0) {
+                return -1;
+            }
+        }
+        if (segs[i].first != NULL) {
+            pPrev = &segs[i];
+        }
+    }
+
+    renumTrkPts(pTrk);
+
+    return 0;
+}
+
+// Max time gap (s) between consecutive TrkPt's of an input file
+// for the file to be considered as covering the time between
+// them when merging.
+#define MERGE_MAX_GAP   5.0
+
+// Merge cursor over the TrkPt's of an input file
+typedef struct MergeSrc {
+    TrkSeg *pSeg;
+    TrkPt *next;            // next TrkPt to be merged
+    double prevTime;        // timestamp of the last TrkPt merged
+    double distOffset;      // offset applied to the distance values
+    int rank;               // 0=most preferred
+    int numDups;            // number of TrkPt's discarded
+} MergeSrc;
+
+static Bool mergeBefore(const MergeSrc *pSrc1, const MergeSrc *pSrc2)
+{
+    if (pSrc1->next->timestamp != pSrc2->next->timestamp) {
+        return (pSrc1->next->timestamp < pSrc2->next->timestamp);
+    }
+
+    return (pSrc1->rank < pSrc2->rank);
+}
+
+static void heapSiftDown(MergeSrc **heap, int n, int i)
+{
+    for (;;) {
+        int min = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        MergeSrc *pTmp;
+
+        if ((l < n) && mergeBefore(heap[l], heap[min]))
+            min = l;
+        if ((r < n) && mergeBefore(heap[r], heap[min]))
+            min = r;
+        if (min == i)
+            break;
+        pTmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = pTmp;
+        i = min;
+    }
+}
+
+// Check whether a more preferred input file covers the time
+// of the TrkPt 'p' from the specified input file.
+static Bool mergeCovered(const MergeSrc *srcs, int numSrcs, const MergeSrc *pSrc, const TrkPt *p)
+{
+    for (int i = 0; i < numSrcs; i++) {
+        const MergeSrc *pOther = &srcs[i];
+
+        if (pOther->rank >= pSrc->rank)
+            continue;
+
+        if (pOther->prevTime == p->timestamp)
+            return true;
+
+        if ((pOther->prevTime != -HUGE_VAL) && (pOther->next != NULL) &&
+            ((pOther->next->timestamp - pOther->prevTime) <= MERGE_MAX_GAP))
+            return true;
+    }
+
+    return false;
+}
+
+int mergeTrkSegs(GpsTrk *pTrk, const CmdArgs *pArgs, TrkSeg *segs, int numSegs)
+{
+    MergeSrc *srcs;
+    MergeSrc **heap;
+    const MergeSrc *pLastSrc = NULL;
+    TrkPt *pLast = NULL;
+    TrkPt *p;
+    int numSrcs = 0;
+    int n;
+
+    srcs = calloc(numSegs, sizeof (MergeSrc));
+    heap = calloc(numSegs, sizeof (MergeSrc *));
+    if ((srcs == NULL) || (heap == NULL)) {
+        fprintf(stderr, "Failed to alloc MergeSrc list !!!\n");
+        free(srcs);
+        free(heap);
+        return -1;
+    }
+
+    for (int i = 0; i < numSegs; i++) {
+        MergeSrc *pSrc = &srcs[numSrcs];
+
+        if (segs[i].first == NULL)
+            continue;
+
+        pSrc->pSeg = &segs[i];
+        pSrc->next = segs[i].first;
+        pSrc->prevTime = -HUGE_VAL;
+        pSrc->rank = segs[i].fileNum;
+        if ((pArgs->mergePref != SD_NONE) && ((segs[i].inMask & pArgs->mergePref) == 0)) {
+            pSrc->rank += numSegs;
+        }
+        heap[numSrcs] = pSrc;
+        numSrcs++;
+    }
+    for (int i = (numSrcs / 2) - 1; i >= 0; i--) {
+        heapSiftDown(heap, numSrcs, i);
+    }
+
+    // Take the TrkPt's in order of their timestamps, and link
+    // them back into the track. The links between the TrkPt's
+    // of each file are only used before the TrkPt is merged.
+    TAILQ_INIT(&pTrk->trkPtList);
+    n = numSrcs;
+    while (n > 0) {
+        MergeSrc *pSrc = heap[0];
+
+        p = pSrc->next;
+        pSrc->next = segNext(pSrc->pSeg, p);
+        if (pSrc->next == NULL) {
+            heap[0] = heap[--n];
+        }
+        heapSiftDown(heap, n, 0);
+
+        if (mergeCovered(srcs, numSrcs, pSrc, p) ||
+            ((pLast != NULL) && (p->timestamp <= pLast->timestamp))) {
+            pSrc->prevTime = p->timestamp;
+            pSrc->numDups++;
+            free(p);
+            continue;
+        }
+
+        // Make the distance values continue from the last
+        // TrkPt merged when switching input files.
+        if ((pSrc != pLastSrc) && (pLast != NULL) && (p->distance != nilDist)) {
+            pSrc->distOffset = pLast->distance + compHaversine(pLast, p) - p->distance;
+        }
+        pSrc->prevTime = p->timestamp;
+        if (p->distance != nilDist) {
+            p->distance += pSrc->distOffset;
+        }
+
+        TAILQ_INSERT_TAIL(&pTrk->trkPtList, p, tqEntry);
+        pLastSrc = pSrc;
+        pLast = p;
+    }
+
+    if (!pArgs->quiet) {
+        for (int i = 0; i < numSrcs; i++) {
+            if (srcs[i].numDups != 0) {
+                fprintf(stderr, "INFO: Discarding %d TrkPt's of %s that overlap with other files !\n",
+                        srcs[i].numDups, srcs[i].pSeg->inFile);
+            }
+        }
+    }
+
+    free(heap);
+    free(srcs);
+
+    renumTrkPts(pTrk);
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Range of TrkPt's parsed from a single input file
+typedef struct TrkSeg {
+    TrkPt *first;           // NULL if the file had no TrkPt's
+    TrkPt *last;
+    const char *inFile;
+    int fileNum;            // position in the command line
+    int inMask;             // sensor data present in the file (SD_xxx)
+    double baseDistance;    // distance offset applied when stitching
+    double baseTime;        // time offset applied when stitching
+} TrkSeg;
+
+// Stitch together the TrkPt's parsed from multiple input files:
+// the files are put in chronological order, the regions where
+// consecutive files overlap are discarded, the distance and time
+// values of each file are rebased so that they continue from
+// the previous file, and the gaps between files are bridged.
+extern int stitchTrkSegs(GpsTrk *pTrk, const CmdArgs *pArgs, TrkSeg *segs, int numSegs);
+
+// Merge the TrkPt's parsed from multiple input files in the
+// order of their timestamps; e.g. when the same ride has been
+// recorded by several devices. Where the files overlap, only
+// the TrkPt's of the preferred file are kept: the first file
+// in the command line that has the sensor data specified by
+// 'pArgs->mergePref'.
+extern int mergeTrkSegs(GpsTrk *pTrk, const CmdArgs *pArgs, TrkSeg *segs, int numSegs);
+
+#ifdef __cplusplus
+};
+#endif
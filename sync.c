@@ -0,0 +1,325 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "input.h"
+#include "packed.h"
+#include "sgfilter.h"
+#include "sync.h"
+
+// The profiles of the two tracks are sampled at 1-second
+// intervals, detrended, and cross-correlated using the FFT,
+// which takes O(N log N) instead of O(N^2). The correlation at
+// each lag is normalized using the sums of the overlapping
+// samples, which are computed from prefix sums, so that each
+// lag gets the Pearson correlation coefficient of the samples
+// that overlap. The lags where less than half of the shorter
+// profile overlaps are not considered.
+//
+#define SYNC_DETREND_WINDOW 121     // window (s) of the moving average removed
+
+// Source of the values of a profile, in track order: the
+// TrkPt's of the track, or the packed reference track.
+typedef struct ProfileSrc {
+    SyncMetric metric;
+    const TrkPt *p;             // next TrkPt of the track
+    PackedIter *pIter;          // iterator of the reference track
+} ProfileSrc;
+
+// Get the timestamp and the value of the next TrkPt.
+// Returns false when there are no more TrkPt's.
+static Bool profileNext(ProfileSrc *pSrc, double *pTime, double *pVal)
+{
+    if (pSrc->pIter != NULL) {
+        TrkPt trkPt;
+
+        if (!packedIterNext(pSrc->pIter, &trkPt))
+            return false;
+        *pTime = trkPt.timestamp;
+        *pVal = (pSrc->metric == smSpeed) ? trkPt.speed : trkPt.elevation;
+    } else {
+        const TrkPt *p = pSrc->p;
+
+        if (p == NULL)
+            return false;
+        *pTime = p->timestamp;
+        *pVal = (pSrc->metric == smSpeed) ? p->speed : p->elevation;
+        pSrc->p = TAILQ_NEXT(p, tqEntry);
+    }
+
+    return true;
+}
+
+// Sample the profile at 1-second intervals, starting at the
+// first TrkPt, and remove its slow changes by subtracting its
+// centered moving average.
+static double *sampleProfile(ProfileSrc *pSrc, int *pNumSamples)
+{
+    double t0, t1, t2, v1, v2;
+    Bool more;
+    double *samples = NULL, *sums;
+    int numSamples = 0, maxSamples = 0;
+
+    if (!profileNext(pSrc, &t1, &v1)) {
+        fprintf(stderr, "No track points to sample !!!\n");
+        return NULL;
+    }
+    t0 = t1;
+    more = profileNext(pSrc, &t2, &v2);
+
+    for (int k = 0; ; k++) {
+        double t = t0 + k;
+
+        while (more && (t2 < t)) {
+            t1 = t2;
+            v1 = v2;
+            more = profileNext(pSrc, &t2, &v2);
+        }
+
+        // Past the last TrkPt?
+        if (!more && (t > t1))
+            break;
+
+        if (numSamples == maxSamples) {
+            double *tmp;
+
+            maxSamples = (maxSamples != 0) ? (2 * maxSamples) : 4096;
+            if ((tmp = realloc(samples, maxSamples * sizeof (double))) == NULL) {
+                fprintf(stderr, "Failed to alloc profile samples !!!\n");
+                free(samples);
+                return NULL;
+            }
+            samples = tmp;
+        }
+
+        if (!more || (t2 <= t1)) {
+            samples[numSamples++] = v1;
+        } else {
+            double f = (t - t1) / (t2 - t1);
+            f = (f < 0.0) ? 0.0 : (f > 1.0) ? 1.0 : f;
+            samples[numSamples++] = v1 + f * (v2 - v1);
+        }
+    }
+
+    if ((sums = malloc((numSamples + 1) * sizeof (double))) == NULL) {
+        fprintf(stderr, "Failed to alloc profile samples !!!\n");
+        free(samples);
+        return NULL;
+    }
+
+    sums[0] = 0.0;
+    for (int k = 0; k < numSamples; k++) {
+        sums[k + 1] = sums[k] + samples[k];
+    }
+    for (int k = 0; k < numSamples; k++) {
+        int from = ((k - SYNC_DETREND_WINDOW / 2) > 0) ? (k - SYNC_DETREND_WINDOW / 2) : 0;
+        int to = ((k + SYNC_DETREND_WINDOW / 2) < (numSamples - 1)) ? (k + SYNC_DETREND_WINDOW / 2) : (numSamples - 1);
+        samples[k] -= (sums[to + 1] - sums[from]) / (to - from + 1);
+    }
+
+    free(sums);
+
+    *pNumSamples = numSamples;
+
+    return samples;
+}
+
+// Number of samples that overlap when 'b[k+lag]' is aligned
+// with 'a[k]'.
+static int overlapLen(int numA, int numB, int lag)
+{
+    int from = (lag < 0) ? -lag : 0;
+    int to = ((numB - lag) < numA) ? (numB - lag) : numA;
+
+    return (to > from) ? (to - from) : 0;
+}
+
+// Prefix sums of the samples and of their squares
+static int prefixSums(const double *x, int num, double **pSum, double **pSum2)
+{
+    double *sum = malloc((num + 1) * sizeof (double));
+    double *sum2 = malloc((num + 1) * sizeof (double));
+
+    if ((sum == NULL) || (sum2 == NULL)) {
+        fprintf(stderr, "Failed to alloc prefix sums !!!\n");
+        free(sum);
+        free(sum2);
+        return -1;
+    }
+
+    sum[0] = sum2[0] = 0.0;
+    for (int k = 0; k < num; k++) {
+        sum[k + 1] = sum[k] + x[k];
+        sum2[k + 1] = sum2[k] + x[k] * x[k];
+    }
+
+    *pSum = sum;
+    *pSum2 = sum2;
+
+    return 0;
+}
+
+// Correlation of the two profiles
+typedef struct SyncCorr {
+    int numA, numB;
+    double *sumA, *sumA2;   // prefix sums of the track's profile
+    double *sumB, *sumB2;   // prefix sums of the reference's profile
+    double *ans;            // raw correlation (1-based, wrapped)
+    unsigned long n;
+} SyncCorr;
+
+// Pearson correlation coefficient of the samples that overlap
+// when sample k of the track is aligned with sample k+lag of
+// the reference.
+static double corrAt(const SyncCorr *pCorr, int lag)
+{
+    int from = (lag < 0) ? -lag : 0;
+    int to = ((pCorr->numB - lag) < pCorr->numA) ? (pCorr->numB - lag) : pCorr->numA;
+    int num = to - from;
+    double sab, sa, sa2, sb, sb2, va, vb;
+
+    if (num <= 0)
+        return 0.0;
+
+    sab = pCorr->ans[(lag >= 0) ? (lag + 1) : (pCorr->n + 1 + lag)];
+    sa = pCorr->sumA[to] - pCorr->sumA[from];
+    sa2 = pCorr->sumA2[to] - pCorr->sumA2[from];
+    sb = pCorr->sumB[to + lag] - pCorr->sumB[from + lag];
+    sb2 = pCorr->sumB2[to + lag] - pCorr->sumB2[from + lag];
+    va = sa2 - (sa * sa) / num;
+    vb = sb2 - (sb * sb) / num;
+    if ((va <= 1.0e-9) || (vb <= 1.0e-9))
+        return 0.0;
+
+    return (sab - (sa * sb) / num) / sqrt(va * vb);
+}
+
+int syncTrks(GpsTrk *pTrk, CmdArgs *pArgs, const char *refFile, SyncMetric metric)
+{
+    const PackedTrk *pRef;
+    PackedIter iter = {0};
+    ProfileSrc srcA = {0}, srcB = {0};
+    double *a = NULL, *b = NULL;
+    double *data1 = NULL, *data2 = NULL, *fft = NULL, *ans = NULL;
+    SyncCorr corr = {0};
+    int numA, numB, minOverlap, minLag, maxLag;
+    unsigned long n = 0, no2;
+    double best = -HUGE_VAL, lag;
+    int bestLag = 0;
+    int s = -1;
+
+    if (TAILQ_FIRST(&pTrk->trkPtList) == NULL) {
+        fprintf(stderr, "No track points to sync\n");
+        return -1;
+    }
+
+    if (((pRef = loadRefTrk(pTrk, pArgs, refFile)) == NULL) ||
+        (packedIterInit(pRef, &iter) != 0)) {
+        return -1;
+    }
+
+    srcA.metric = srcB.metric = metric;
+    srcA.p = TAILQ_FIRST(&pTrk->trkPtList);
+    srcB.pIter = &iter;
+    if (((a = sampleProfile(&srcA, &numA)) == NULL) ||
+        ((b = sampleProfile(&srcB, &numB)) == NULL)) {
+        goto done;
+    }
+
+    // Zero-pad both profiles to avoid the wrap-around of the
+    // circular correlation.
+    for (n = 2; n < (unsigned long) (numA + numB); n <<= 1)
+        ;
+    data1 = dvector(1, n);
+    data2 = dvector(1, n);
+    fft = dvector(1, n << 1);
+    ans = dvector(1, n << 1);
+    if ((data1 == NULL) || (data2 == NULL) || (fft == NULL) || (ans == NULL)) {
+        fprintf(stderr, "Failed to alloc FFT arrays !!!\n");
+        goto done;
+    }
+    for (unsigned long i = 1; i <= n; i++) {
+        data1[i] = (i <= (unsigned long) numB) ? b[i - 1] : 0.0;
+        data2[i] = (i <= (unsigned long) numA) ? a[i - 1] : 0.0;
+    }
+
+    // Multiply the transform of one profile by the complex
+    // conjugate of the transform of the other, and transform
+    // the product back. The correlation at lag L ends up in
+    // ans[L+1], with the negative lags wrapped around.
+    twofft(data1, data2, fft, ans, n);
+    no2 = n >> 1;
+    for (unsigned long i = 2; i <= (n + 2); i += 2) {
+        double dum = ans[i - 1];
+        ans[i - 1] = (fft[i - 1] * dum + fft[i] * ans[i]) / no2;
+        ans[i] = (fft[i] * dum - fft[i - 1] * ans[i]) / no2;
+    }
+    ans[2] = ans[n + 1];
+    realft(ans, n, -1);
+
+    corr.numA = numA;
+    corr.numB = numB;
+    corr.ans = ans;
+    corr.n = n;
+    if ((prefixSums(a, numA, &corr.sumA, &corr.sumA2) != 0) ||
+        (prefixSums(b, numB, &corr.sumB, &corr.sumB2) != 0)) {
+        goto done;
+    }
+
+    // Find the lag with the highest correlation
+    minOverlap = ((numA < numB) ? numA : numB) / 2;
+    minOverlap = (minOverlap < 2) ? 2 : minOverlap;
+    minLag = minOverlap - numA;
+    maxLag = numB - minOverlap;
+    if (minLag > maxLag) {
+        fprintf(stderr, "The profiles are too short !!!\n");
+        goto done;
+    }
+    for (int l = minLag; l <= maxLag; l++) {
+        double c = corrAt(&corr, l);
+
+        if (c > best) {
+            best = c;
+            bestLag = l;
+        }
+    }
+
+    if (best <= 0.0) {
+        fprintf(stderr, "The profiles do not correlate !!!\n");
+        goto done;
+    }
+
+    // Refine the lag by fitting a parabola through the peak
+    lag = bestLag;
+    if ((bestLag > minLag) && (bestLag < maxLag)) {
+        double y1 = corrAt(&corr, bestLag - 1);
+        double y3 = corrAt(&corr, bestLag + 1);
+        double den = y1 - 2.0 * best + y3;
+        if (den < 0.0) {
+            lag += 0.5 * (y1 - y3) / den;
+        }
+    }
+
+    pTrk->timeShift = (int) lround(lag);
+
+    fprintf(pArgs->outFile, "Time shift: %+.1lf s (correlation=%.2lf over %d s)\n",
+            lag, best, overlapLen(numA, numB, bestLag));
+    fprintf(pArgs->outFile, "SHIZ timeshift set to %d s\n", pTrk->timeShift);
+
+    s = 0;
+
+done:
+    free_dvector(data1, 1, n);
+    free_dvector(data2, 1, n);
+    free_dvector(fft, 1, n << 1);
+    free_dvector(ans, 1, n << 1);
+    free(corr.sumA);
+    free(corr.sumA2);
+    free(corr.sumB);
+    free(corr.sumB2);
+    free(a);
+    free(b);
+    packedIterEnd(&iter);
+
+    return s;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Profile used to align the tracks
+typedef enum SyncMetric {
+    smElevation,
+    smSpeed,
+} SyncMetric;
+
+// Find the time shift between the track and the one in the
+// specified reference file (e.g. the GPS log of the camera)
+// that best aligns their speed or elevation profiles. A shift
+// of N seconds means that what happens at time T in the track
+// happens at time T+N in the reference track, with both times
+// relative to the start of each track. The shift is stored
+// in 'pTrk->timeShift'.
+extern int syncTrks(GpsTrk *pTrk, CmdArgs *pArgs, const char *refFile, SyncMetric metric);
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,615 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "zio.h"
+
+// Size of the chunks of data handed over between the
+// (de)compressor thread and the reader/writer.
+#define ZIO_CHUNK_SIZE  (64 * 1024)
+
+// Max number of decompressed bytes queued ahead of the
+// reader.
+#define ZIO_MAX_QUEUED  (16 * ZIO_CHUNK_SIZE)
+
+typedef struct ZChunk {
+    struct ZChunk *next;
+    size_t len;             // number of valid bytes in data[]
+    size_t off;             // number of bytes already consumed
+    unsigned char data[ZIO_CHUNK_SIZE];
+} ZChunk;
+
+// Compressed stream
+typedef struct ZStream {
+    FILE *raw;              // underlying compressed file
+    const char *path;       // file name
+    CompType compType;      // compression type
+    int level;              // compression level (0=default)
+    Bool closeRaw;          // close the raw file along with the stream
+
+    pthread_t thread;       // (de)compressor thread
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // Queue of uncompressed data chunks. When reading,
+    // the queue is bounded so that the decompressor does
+    // not run too far ahead of the reader; when writing,
+    // it's unbounded so that the writer never has to wait
+    // for the compressor.
+    ZChunk *head;
+    ZChunk *tail;
+    size_t numBytes;        // number of bytes queued
+
+    Bool eof;               // no more chunks will be queued
+    Bool closing;           // the stream is being closed
+    int status;             // 0=OK -1=ERROR
+} ZStream;
+
+static ZChunk *zsNewChunk(void)
+{
+    ZChunk *pChunk;
+
+    if ((pChunk = malloc(sizeof (ZChunk))) == NULL) {
+        fprintf(stderr, "Failed to alloc ZChunk object !!!\n");
+        return NULL;
+    }
+
+    pChunk->next = NULL;
+    pChunk->len = 0;
+    pChunk->off = 0;
+
+    return pChunk;
+}
+
+static void zsFreeChunks(ZStream *pZs)
+{
+    ZChunk *pChunk;
+
+    while ((pChunk = pZs->head) != NULL) {
+        pZs->head = pChunk->next;
+        free(pChunk);
+    }
+    pZs->tail = NULL;
+    pZs->numBytes = 0;
+}
+
+// Hand a chunk of decompressed data over to the reader,
+// waiting while too much data is already queued. Returns
+// -1 if the reader has closed the stream.
+static int zsPutChunk(ZStream *pZs, ZChunk *pChunk)
+{
+    int s = 0;
+
+    pthread_mutex_lock(&pZs->mutex);
+    while ((pZs->numBytes >= ZIO_MAX_QUEUED) && !pZs->closing) {
+        pthread_cond_wait(&pZs->cond, &pZs->mutex);
+    }
+    if (!pZs->closing) {
+        if (pZs->tail != NULL) {
+            pZs->tail->next = pChunk;
+        } else {
+            pZs->head = pChunk;
+        }
+        pZs->tail = pChunk;
+        pZs->numBytes += pChunk->len;
+        pthread_cond_broadcast(&pZs->cond);
+    } else {
+        free(pChunk);
+        s = -1;
+    }
+    pthread_mutex_unlock(&pZs->mutex);
+
+    return s;
+}
+
+static int zsInflate(ZStream *pZs)
+{
+    unsigned char inBuf[ZIO_CHUNK_SIZE];
+    z_stream strm = {0};
+    ZChunk *pChunk = NULL;
+    Bool endOfStream = false;
+    size_t n;
+    int ret;
+
+    // Accept both gzip and zlib headers
+    if (inflateInit2(&strm, (15 + 32)) != Z_OK) {
+        return -1;
+    }
+
+    while ((n = fread(inBuf, 1, sizeof (inBuf), pZs->raw)) > 0) {
+        strm.next_in = inBuf;
+        strm.avail_in = n;
+
+        while (strm.avail_in != 0) {
+            if ((pChunk == NULL) && ((pChunk = zsNewChunk()) == NULL)) {
+                inflateEnd(&strm);
+                return -1;
+            }
+
+            strm.next_out = pChunk->data + pChunk->len;
+            strm.avail_out = ZIO_CHUNK_SIZE - pChunk->len;
+            ret = inflate(&strm, Z_NO_FLUSH);
+            pChunk->len = ZIO_CHUNK_SIZE - strm.avail_out;
+            endOfStream = false;
+
+            if (ret == Z_STREAM_END) {
+                // The file may consist of several concatenated
+                // gzip members.
+                endOfStream = true;
+                inflateReset(&strm);
+            } else if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+                fprintf(stderr, "Corrupt gzip data in %s: %s\n", pZs->path, (strm.msg != NULL) ? strm.msg : "???");
+                free(pChunk);
+                inflateEnd(&strm);
+                return -1;
+            }
+
+            if (pChunk->len == ZIO_CHUNK_SIZE) {
+                if (zsPutChunk(pZs, pChunk) != 0) {
+                    inflateEnd(&strm);
+                    return 0;
+                }
+                pChunk = NULL;
+            }
+        }
+    }
+
+    inflateEnd(&strm);
+
+    if ((pChunk != NULL) && (zsPutChunk(pZs, pChunk) != 0)) {
+        return 0;
+    }
+
+    if (!endOfStream) {
+        fprintf(stderr, "Unexpected end of gzip data in %s\n", pZs->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+static int zsZstdDecompress(ZStream *pZs)
+{
+    unsigned char inBuf[ZIO_CHUNK_SIZE];
+    ZSTD_DStream *pDs;
+    ZChunk *pChunk = NULL;
+    size_t ret = 1;
+    size_t n;
+
+    if ((pDs = ZSTD_createDStream()) == NULL) {
+        return -1;
+    }
+    ZSTD_initDStream(pDs);
+
+    while ((n = fread(inBuf, 1, sizeof (inBuf), pZs->raw)) > 0) {
+        ZSTD_inBuffer in = { inBuf, n, 0 };
+
+        while (in.pos < in.size) {
+            ZSTD_outBuffer out;
+
+            if ((pChunk == NULL) && ((pChunk = zsNewChunk()) == NULL)) {
+                ZSTD_freeDStream(pDs);
+                return -1;
+            }
+
+            out.dst = pChunk->data;
+            out.size = ZIO_CHUNK_SIZE;
+            out.pos = pChunk->len;
+
+            // A return value of 0 means a frame has been completely
+            // decoded. Concatenated frames are handled transparently.
+            ret = ZSTD_decompressStream(pDs, &out, &in);
+            if (ZSTD_isError(ret)) {
+                fprintf(stderr, "Corrupt zstd data in %s: %s\n", pZs->path, ZSTD_getErrorName(ret));
+                free(pChunk);
+                ZSTD_freeDStream(pDs);
+                return -1;
+            }
+            pChunk->len = out.pos;
+
+            if (pChunk->len == ZIO_CHUNK_SIZE) {
+                if (zsPutChunk(pZs, pChunk) != 0) {
+                    ZSTD_freeDStream(pDs);
+                    return 0;
+                }
+                pChunk = NULL;
+            }
+        }
+    }
+
+    ZSTD_freeDStream(pDs);
+
+    if ((pChunk != NULL) && (zsPutChunk(pZs, pChunk) != 0)) {
+        return 0;
+    }
+
+    if (ret != 0) {
+        fprintf(stderr, "Unexpected end of zstd data in %s\n", pZs->path);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+static void *zsDecompressor(void *arg)
+{
+    ZStream *pZs = arg;
+    int s = -1;
+
+    if (pZs->compType == gzip) {
+        s = zsInflate(pZs);
+    }
+#ifdef HAVE_ZSTD
+    else if (pZs->compType == zstd) {
+        s = zsZstdDecompress(pZs);
+    }
+#endif
+
+    pthread_mutex_lock(&pZs->mutex);
+    pZs->status = s;
+    pZs->eof = true;
+    pthread_cond_broadcast(&pZs->cond);
+    pthread_mutex_unlock(&pZs->mutex);
+
+    return NULL;
+}
+
+// Take all the queued chunks of uncompressed data, waiting
+// for the writer to queue some. Returns NULL once the stream
+// has been closed and all the data has been consumed.
+static ZChunk *zsGetChunks(ZStream *pZs)
+{
+    ZChunk *pChunks;
+
+    pthread_mutex_lock(&pZs->mutex);
+    while ((pZs->head == NULL) && !pZs->closing) {
+        pthread_cond_wait(&pZs->cond, &pZs->mutex);
+    }
+    pChunks = pZs->head;
+    pZs->head = pZs->tail = NULL;
+    pZs->numBytes = 0;
+    pthread_mutex_unlock(&pZs->mutex);
+
+    return pChunks;
+}
+
+static void zsWriteRaw(ZStream *pZs, const void *buf, size_t len)
+{
+    if ((pZs->status == 0) && (len != 0) &&
+        (fwrite(buf, 1, len, pZs->raw) != len)) {
+        fprintf(stderr, "Failed to write output file %s\n", pZs->path);
+        pZs->status = -1;
+    }
+}
+
+static int zsDeflate(ZStream *pZs)
+{
+    unsigned char outBuf[ZIO_CHUNK_SIZE];
+    z_stream strm = {0};
+    ZChunk *pChunks;
+    int level = (pZs->level != 0) ? pZs->level : Z_DEFAULT_COMPRESSION;
+    int ret;
+
+    // Generate a gzip header
+    if (deflateInit2(&strm, level, Z_DEFLATED, (15 + 16), 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Invalid gzip compression level %d\n", pZs->level);
+        return -1;
+    }
+
+    do {
+        ZChunk *pChunk;
+        int flush;
+
+        pChunks = zsGetChunks(pZs);
+        flush = (pChunks == NULL) ? Z_FINISH : Z_NO_FLUSH;
+
+        strm.next_in = NULL;
+        strm.avail_in = 0;
+        pChunk = pChunks;
+        do {
+            if (pChunk != NULL) {
+                strm.next_in = pChunk->data;
+                strm.avail_in = pChunk->len;
+            }
+            do {
+                strm.next_out = outBuf;
+                strm.avail_out = sizeof (outBuf);
+                ret = deflate(&strm, flush);
+                zsWriteRaw(pZs, outBuf, (sizeof (outBuf) - strm.avail_out));
+            } while ((strm.avail_out == 0) || ((flush == Z_FINISH) && (ret == Z_OK)));
+            if (pChunk != NULL) {
+                ZChunk *pNext = pChunk->next;
+                free(pChunk);
+                pChunk = pNext;
+            }
+        } while (pChunk != NULL);
+    } while (pChunks != NULL);
+
+    deflateEnd(&strm);
+
+    return pZs->status;
+}
+
+#ifdef HAVE_ZSTD
+static int zsZstdCompress(ZStream *pZs)
+{
+    unsigned char outBuf[ZIO_CHUNK_SIZE];
+    ZSTD_CStream *pCs;
+    ZChunk *pChunks;
+    size_t ret;
+
+    if ((pCs = ZSTD_createCStream()) == NULL) {
+        return -1;
+    }
+    if (ZSTD_isError(ZSTD_initCStream(pCs, pZs->level))) {
+        fprintf(stderr, "Invalid zstd compression level %d\n", pZs->level);
+        ZSTD_freeCStream(pCs);
+        return -1;
+    }
+
+    while ((pChunks = zsGetChunks(pZs)) != NULL) {
+        while (pChunks != NULL) {
+            ZChunk *pNext = pChunks->next;
+            ZSTD_inBuffer in = { pChunks->data, pChunks->len, 0 };
+
+            while (in.pos < in.size) {
+                ZSTD_outBuffer out = { outBuf, sizeof (outBuf), 0 };
+                ret = ZSTD_compressStream(pCs, &out, &in);
+                if (ZSTD_isError(ret)) {
+                    fprintf(stderr, "Failed to compress %s: %s\n", pZs->path, ZSTD_getErrorName(ret));
+                    pZs->status = -1;
+                    break;
+                }
+                zsWriteRaw(pZs, outBuf, out.pos);
+            }
+
+            free(pChunks);
+            pChunks = pNext;
+        }
+    }
+
+    // Flush the rest of the frame
+    do {
+        ZSTD_outBuffer out = { outBuf, sizeof (outBuf), 0 };
+        ret = ZSTD_endStream(pCs, &out);
+        zsWriteRaw(pZs, outBuf, out.pos);
+    } while ((ret != 0) && !ZSTD_isError(ret));
+
+    ZSTD_freeCStream(pCs);
+
+    return pZs->status;
+}
+#endif
+
+static void *zsCompressor(void *arg)
+{
+    ZStream *pZs = arg;
+    int s = -1;
+
+    if (pZs->compType == gzip) {
+        s = zsDeflate(pZs);
+    }
+#ifdef HAVE_ZSTD
+    else if (pZs->compType == zstd) {
+        s = zsZstdCompress(pZs);
+    }
+#endif
+
+    pthread_mutex_lock(&pZs->mutex);
+    pZs->status = s;
+    pZs->eof = true;
+    pthread_mutex_unlock(&pZs->mutex);
+
+    return NULL;
+}
+
+static ssize_t zsRead(void *cookie, char *buf, size_t size)
+{
+    ZStream *pZs = cookie;
+    size_t numBytes = 0;
+
+    pthread_mutex_lock(&pZs->mutex);
+    while ((pZs->head == NULL) && !pZs->eof) {
+        pthread_cond_wait(&pZs->cond, &pZs->mutex);
+    }
+    while ((numBytes < size) && (pZs->head != NULL)) {
+        ZChunk *pChunk = pZs->head;
+        size_t len = pChunk->len - pChunk->off;
+
+        if (len > (size - numBytes)) {
+            len = size - numBytes;
+        }
+        memcpy(buf + numBytes, pChunk->data + pChunk->off, len);
+        pChunk->off += len;
+        numBytes += len;
+
+        if (pChunk->off == pChunk->len) {
+            if ((pZs->head = pChunk->next) == NULL) {
+                pZs->tail = NULL;
+            }
+            pZs->numBytes -= pChunk->len;
+            free(pChunk);
+        }
+    }
+    pthread_cond_broadcast(&pZs->cond);
+    pthread_mutex_unlock(&pZs->mutex);
+
+    // Notice that on a decompression error we simply report
+    // EOF, so that the decoder bails out with a truncated
+    // input.
+    return numBytes;
+}
+
+static ssize_t zsWrite(void *cookie, const char *buf, size_t size)
+{
+    ZStream *pZs = cookie;
+    size_t numBytes = 0;
+
+    pthread_mutex_lock(&pZs->mutex);
+    while (numBytes < size) {
+        ZChunk *pChunk = pZs->tail;
+        size_t len;
+
+        if ((pChunk == NULL) || (pChunk->len == ZIO_CHUNK_SIZE)) {
+            if ((pChunk = zsNewChunk()) == NULL) {
+                break;
+            }
+            if (pZs->tail != NULL) {
+                pZs->tail->next = pChunk;
+            } else {
+                pZs->head = pChunk;
+            }
+            pZs->tail = pChunk;
+        }
+
+        if ((len = ZIO_CHUNK_SIZE - pChunk->len) > (size - numBytes)) {
+            len = size - numBytes;
+        }
+        memcpy(pChunk->data + pChunk->len, buf + numBytes, len);
+        pChunk->len += len;
+        pZs->numBytes += len;
+        numBytes += len;
+    }
+    pthread_cond_broadcast(&pZs->cond);
+    pthread_mutex_unlock(&pZs->mutex);
+
+    return numBytes;
+}
+
+static int zsClose(void *cookie)
+{
+    ZStream *pZs = cookie;
+    int s;
+
+    pthread_mutex_lock(&pZs->mutex);
+    pZs->closing = true;
+    pthread_cond_broadcast(&pZs->cond);
+    pthread_mutex_unlock(&pZs->mutex);
+
+    pthread_join(pZs->thread, NULL);
+
+    s = pZs->status;
+    zsFreeChunks(pZs);
+    if (pZs->closeRaw) {
+        if (fclose(pZs->raw) != 0)
+            s = -1;
+    } else if (fflush(pZs->raw) != 0) {
+        s = -1;
+    }
+    pthread_cond_destroy(&pZs->cond);
+    pthread_mutex_destroy(&pZs->mutex);
+    free(pZs);
+
+    return (s == 0) ? 0 : EOF;
+}
+
+static CompType zioCompType(FILE *fp)
+{
+    unsigned char magic[4] = {0};
+    size_t n;
+    CompType compType = noComp;
+
+    n = fread(magic, 1, sizeof (magic), fp);
+    if ((n >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b)) {
+        compType = gzip;
+    } else if ((n == 4) && (magic[0] == 0x28) && (magic[1] == 0xb5) && (magic[2] == 0x2f) && (magic[3] == 0xfd)) {
+        compType = zstd;
+    }
+    rewind(fp);
+
+    return compType;
+}
+
+// Create a compressed stream on top of the raw file, along
+// with its (de)compressor thread.
+static FILE *zsOpen(FILE *raw, const char *path, const char *mode, CompType compType, int level)
+{
+    cookie_io_functions_t ioFuncs = { .read = zsRead, .write = zsWrite, .close = zsClose };
+    Bool reading = (mode[0] == 'r');
+    ZStream *pZs;
+    FILE *fp;
+
+#ifndef HAVE_ZSTD
+    if (compType == zstd) {
+        fprintf(stderr, "No zstd support: can't %s %s\n", reading ? "decompress" : "compress", path);
+        if (raw != stdout)
+            fclose(raw);
+        return NULL;
+    }
+#endif
+
+    if ((pZs = calloc(1, sizeof (ZStream))) == NULL) {
+        fprintf(stderr, "Failed to alloc ZStream object !!!\n");
+        if (raw != stdout)
+            fclose(raw);
+        return NULL;
+    }
+
+    pZs->raw = raw;
+    pZs->path = path;
+    pZs->compType = compType;
+    pZs->level = level;
+    pZs->closeRaw = (raw != stdout);
+    pthread_mutex_init(&pZs->mutex, NULL);
+    pthread_cond_init(&pZs->cond, NULL);
+
+    if (pthread_create(&pZs->thread, NULL, (reading ? zsDecompressor : zsCompressor), pZs) != 0) {
+        fprintf(stderr, "Failed to create %s thread !!!\n", reading ? "decompressor" : "compressor");
+        pthread_cond_destroy(&pZs->cond);
+        pthread_mutex_destroy(&pZs->mutex);
+        if (pZs->closeRaw)
+            fclose(raw);
+        free(pZs);
+        return NULL;
+    }
+
+    if ((fp = fopencookie(pZs, mode, ioFuncs)) == NULL) {
+        zsClose(pZs);
+        return NULL;
+    }
+
+    return fp;
+}
+
+FILE *zioOpenRead(const char *path)
+{
+    FILE *raw;
+    CompType compType;
+
+    if ((raw = fopen(path, "r")) == NULL) {
+        return NULL;
+    }
+
+    if ((compType = zioCompType(raw)) == noComp) {
+        // Plain file
+        return raw;
+    }
+
+    return zsOpen(raw, path, "r", compType, 0);
+}
+
+FILE *zioOpenWrite(const char *path, CompType compType, int level)
+{
+    FILE *raw;
+
+    if (path == NULL) {
+        raw = stdout;
+        path = "<stdout>";
+    } else if ((raw = fopen(path, "w")) == NULL) {
+        return NULL;
+    }
+
+    if (compType == noComp) {
+        // Plain file
+        return raw;
+    }
+
+    return zsOpen(raw, path, "w", compType, level);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Open the specified file for reading. Compressed files are
+// detected by their magic bytes, and are decompressed on the
+// fly by a separate thread. The returned stream is closed
+// with fclose().
+extern FILE *zioOpenRead(const char *path);
+
+// Open the specified file (or the standard output if 'path'
+// is NULL) for writing, compressing the data on the fly with
+// the specified algorithm and level (0=default). The data is
+// compressed by a separate thread, and the writer never has
+// to wait for it. The returned stream is closed with fclose(),
+// which waits for all the data to be compressed and written.
+extern FILE *zioOpenWrite(const char *path, CompType compType, int level);
+
+#ifdef __cplusplus
+};
+#endif